@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "arbiter.h"
+
+Arbiter::Arbiter() : _mode(0), _winner(CommandSource::Count), _nextExpiry(ARBITER_NO_EXPIRY) {
+  memset(_slots, 0, sizeof(_slots));
+}
+
+bool Arbiter::set(CommandSource source, uint8_t mode, uint8_t priority, uint32_t lease, uint32_t now) {
+  ArbiterRequest& r = _slots[uint8_t(source)];
+  r.active = true;
+  r.mode = mode;
+  r.priority = priority;
+  r.expiry = lease ? now + lease : ARBITER_NO_EXPIRY;
+  if (r.expiry == ARBITER_NO_EXPIRY && lease)
+    r.expiry = 1;  // 'now + lease' wrapped to exactly 0; expire at once rather than never
+  r.stamp = now;
+  return recompute(now);
+}
+
+bool Arbiter::clear(CommandSource source, uint32_t now) {
+  ArbiterRequest& r = _slots[uint8_t(source)];
+  if (!r.active)
+    return false;
+  r.active = false;
+  return recompute(now);
+}
+
+bool Arbiter::expire(uint32_t now) {
+  if (_nextExpiry == ARBITER_NO_EXPIRY || int32_t(now - _nextExpiry) < 0)
+    return false;
+  return recompute(now);
+}
+
+uint32_t Arbiter::remaining(CommandSource source, uint32_t now) const {
+  const ArbiterRequest& r = _slots[uint8_t(source)];
+  if (!r.active || r.expiry == ARBITER_NO_EXPIRY || int32_t(r.expiry - now) <= 0)
+    return 0;
+  return r.expiry - now;
+}
+
+bool Arbiter::recompute(uint32_t now) {
+  uint8_t oldMode = _mode;
+  CommandSource oldWinner = _winner;
+
+  _winner = CommandSource::Count;
+  _nextExpiry = ARBITER_NO_EXPIRY;
+  const ArbiterRequest* best = nullptr;
+  for (uint8_t i = 0; i < uint8_t(CommandSource::Count); i++) {
+    ArbiterRequest& r = _slots[i];
+    if (!r.active)
+      continue;
+    if (r.expiry != ARBITER_NO_EXPIRY) {
+      if (int32_t(now - r.expiry) >= 0) {
+        r.active = false;
+        continue;
+      }
+      if (_nextExpiry == ARBITER_NO_EXPIRY || int32_t(r.expiry - _nextExpiry) < 0)
+        _nextExpiry = r.expiry;
+    }
+    if (!best || r.priority > best->priority || (r.priority == best->priority && int32_t(r.stamp - best->stamp) >= 0)) {
+      best = &r;
+      _winner = CommandSource(i);
+    }
+  }
+  _mode = best ? best->mode : 0;
+  return _mode != oldMode || _winner != oldWinner;
+}
+
+const char* Arbiter::sourceName(CommandSource source) {
+  switch (source) {
+    case CommandSource::Mqtt:        return "mqtt";
+    case CommandSource::Schedule:    return "schedule";
+    case CommandSource::PowerSensor: return "power";
+    case CommandSource::Modbus:      return "modbus";
+    case CommandSource::Manual:      return "manual";
+    default:                         return "none";
+  }
+}
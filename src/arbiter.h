@@ -0,0 +1,62 @@
+/*
+  Arbitration between the sources that may ask for an SG Ready mode.
+
+  Every source has one slot holding its latest request: mode, priority, expiry and the time it was
+  made. The effective mode comes from the live request with the highest priority; on a tie the
+  newest request wins. With no live request the mode is Normal (0).
+
+  The winner is recomputed in O(sources) only when a request changes or expires. expire() is
+  called every tick but compares against the cached earliest expiry, so it is O(1). Times are in
+  seconds on any monotonic clock (the controller uses its uptime counter).
+
+  Not thread-safe; the controller drives it from the timer task only.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+enum class CommandSource : uint8_t {
+  Mqtt,         // Home Assistant over MQTT
+  Schedule,     // local time schedule / tariff calendar
+  PowerSensor,  // local export measurement
+  Modbus,
+  Manual,       // button on the board
+  Count
+};
+
+#define ARBITER_NO_EXPIRY 0
+
+struct ArbiterRequest {
+  bool active;
+  uint8_t mode;
+  uint8_t priority;   // higher wins
+  uint32_t expiry;    // ARBITER_NO_EXPIRY or the time at which the request lapses
+  uint32_t stamp;     // when the request was made
+};
+
+class Arbiter {
+ public:
+  Arbiter();
+
+  // returns true if the effective mode or the winning source changed
+  bool set(CommandSource source, uint8_t mode, uint8_t priority, uint32_t lease, uint32_t now);  // lease 0 = no expiry
+  bool clear(CommandSource source, uint32_t now);
+  bool expire(uint32_t now);  // call every tick
+
+  uint8_t mode() const { return _mode; }
+  bool hasWinner() const { return _winner != CommandSource::Count; }
+  CommandSource winner() const { return _winner; }  // Count = no live request
+  const ArbiterRequest& request(CommandSource source) const { return _slots[uint8_t(source)]; }
+  uint32_t remaining(CommandSource source, uint32_t now) const;  // seconds until expiry, 0 = none or inactive
+
+  static const char* sourceName(CommandSource source);  // "mqtt", ..., "none" for Count
+
+ private:
+  bool recompute(uint32_t now);
+
+  ArbiterRequest _slots[uint8_t(CommandSource::Count)];
+  uint8_t _mode;
+  CommandSource _winner;
+  uint32_t _nextExpiry;  // earliest expiry of an active request, ARBITER_NO_EXPIRY if none
+};
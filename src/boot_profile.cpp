@@ -0,0 +1,63 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#if __has_include(<esp_private/esp_clk.h>)
+#include <esp_private/esp_clk.h>
+#else
+#include <esp32/clk.h>
+#endif
+
+#include "boot_profile.h"
+
+static uint32_t s_phaseMicros[size_t(BootPhase::Count)];
+static uint32_t s_romMicros;  // RTC time minus esp_timer time at AppStart
+
+void bootMark(BootPhase phase) {
+  uint32_t& slot = s_phaseMicros[size_t(phase)];
+  if (slot)
+    return;
+
+  uint64_t now = esp_timer_get_time();
+  if (phase == BootPhase::AppStart) {
+    uint64_t sinceReset = esp_clk_rtc_time();
+    s_romMicros = sinceReset > now ? uint32_t(sinceReset - now) : 0;
+  }
+  slot = now ? uint32_t(now) : 1;  // 0 means "not reached"
+}
+
+uint32_t bootMicros(BootPhase phase) {
+  return s_phaseMicros[size_t(phase)];
+}
+
+bool bootComplete() {
+  return bootMicros(BootPhase::DiscoveryDone) != 0;
+}
+
+const char* bootResetReason() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:   return "poweron";
+    case ESP_RST_EXT:       return "external";
+    case ESP_RST_SW:        return "software";
+    case ESP_RST_PANIC:     return "panic";
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:       return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deepsleep";
+    case ESP_RST_BROWNOUT:  return "brownout";
+    default:                return "unknown";
+  }
+}
+
+size_t bootProfileJson(char* buf, size_t size) {
+  bool powerOn = esp_reset_reason() == ESP_RST_POWERON;
+  int n = snprintf(buf, size,
+    "{\"reset\":\"%s\",\"rom_us\":%u,\"app_us\":%u,\"pins_us\":%u,\"wifi_us\":%u,\"mqtt_us\":%u,\"discovery_us\":%u}",
+    bootResetReason(), powerOn ? s_romMicros : 0,
+    bootMicros(BootPhase::AppStart), bootMicros(BootPhase::PinsSafe), bootMicros(BootPhase::WifiUp),
+    bootMicros(BootPhase::MqttUp), bootMicros(BootPhase::DiscoveryDone));
+  return n < 0 ? 0 : min(size_t(n), size - 1);
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+  Boot-phase timestamps.
+
+  Each phase is stamped once per boot in microseconds of esp_timer, which starts counting when the
+  application's startup code runs. The ROM and second-stage bootloader time before that is taken
+  from the RTC timer and is only meaningful after a power-on reset, since a software reset doesn't
+  restart the RTC timer.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum class BootPhase : uint8_t {
+  AppStart,       // first C++ constructor
+  PinsSafe,       // SG pins driven to the restored (or Normal) mode
+  WifiUp,         // first IP address
+  MqttUp,         // first CONNACK
+  DiscoveryDone,  // Home Assistant discovery sent
+  Count
+};
+
+void bootMark(BootPhase phase);          // only the first call per phase counts
+uint32_t bootMicros(BootPhase phase);    // 0 if the phase has not been reached
+bool bootComplete();
+const char* bootResetReason();
+
+// {"reset":"poweron","rom_us":...,"app_us":...,"pins_us":...,"wifi_us":...,"mqtt_us":...,"discovery_us":...}
+size_t bootProfileJson(char* buf, size_t size);
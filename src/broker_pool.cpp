@@ -0,0 +1,119 @@
+#include "broker_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+BrokerPool::BrokerPool() : _brokers(), _count(0) {
+}
+
+void BrokerPool::clear() {
+  memset(_brokers, 0, sizeof(_brokers));
+  _count = 0;
+}
+
+bool BrokerPool::add(const char* host, uint16_t port) {
+  if (_count >= BROKER_POOL_MAX || !host || !*host || strlen(host) >= BROKER_HOST_SIZE)
+    return false;
+  BrokerHealth& b = _brokers[_count++];
+  memset(&b, 0, sizeof(b));
+  strcpy(b.host, host);
+  b.port = port;
+  b.score = BROKER_SCORE_MAX;
+  return true;
+}
+
+size_t BrokerPool::addList(const char* list, uint16_t defaultPort) {
+  size_t added = 0;
+  while (list && *list) {
+    const char* end = strchr(list, ',');
+    size_t length = end ? size_t(end - list) : strlen(list);
+    char entry[BROKER_HOST_SIZE + 7];
+    if (length && length < sizeof(entry)) {
+      memcpy(entry, list, length);
+      entry[length] = 0;
+      uint16_t port = defaultPort;
+      char* colon = strrchr(entry, ':');
+      if (colon) {
+        *colon = 0;
+        port = uint16_t(atoi(colon + 1));
+      }
+      if (port && add(entry, port))
+        added++;
+    }
+    list = end ? end + 1 : nullptr;
+  }
+  return added;
+}
+
+uint8_t BrokerPool::health(size_t i, uint32_t now) const {
+  const BrokerHealth& b = _brokers[i];
+  uint32_t recovered = (now - b.changedAt) / BROKER_RECOVER_MS * 10;
+  return b.score + recovered >= BROKER_SCORE_MAX ? BROKER_SCORE_MAX : uint8_t(b.score + recovered);
+}
+
+size_t BrokerPool::select(uint32_t now) const {
+  size_t best = 0;
+  for (size_t i = 0; i < _count; i++)
+    if (due(i, now) && health(i, now) >= BROKER_SCORE_HEALTHY)
+      return i;
+
+  bool anyDue = false;
+  for (size_t i = 0; i < _count; i++) {
+    if (!due(i, now))
+      continue;
+    if (!anyDue || health(i, now) > health(best, now))
+      best = i;
+    anyDue = true;
+  }
+  if (anyDue)
+    return best;
+
+  for (size_t i = 1; i < _count; i++)  // nobody is due; take whoever is due first
+    if (int32_t(_brokers[i].retryAt - _brokers[best].retryAt) < 0)
+      best = i;
+  return best;
+}
+
+uint32_t BrokerPool::wait(size_t i, uint32_t now) const {
+  if (due(i, now))
+    return 0;
+  uint32_t left = _brokers[i].retryAt - now;
+  return left > BROKER_RETRY_MAX_MS ? BROKER_RETRY_MAX_MS : left;
+}
+
+size_t BrokerPool::preferred(size_t current, uint32_t now) const {
+  for (size_t i = 0; i < current && i < _count; i++)
+    if (due(i, now) && health(i, now) >= BROKER_SCORE_FAILBACK)
+      return i;
+  return current;
+}
+
+void BrokerPool::attempt(size_t i) {
+  _brokers[i].attempts++;
+}
+
+void BrokerPool::connected(size_t i, uint32_t now) {
+  BrokerHealth& b = _brokers[i];
+  uint8_t score = health(i, now);
+  b.score = score + (BROKER_SCORE_MAX - score) / 2;
+  b.failures = 0;
+  b.changedAt = now;
+  b.retryAt = now;
+  b.connects++;
+}
+
+void BrokerPool::failed(size_t i, uint32_t now) {
+  BrokerHealth& b = _brokers[i];
+  b.score = health(i, now) / 2;
+  if (b.failures < 31)
+    b.failures++;
+  uint32_t backoff = b.failures > 7 ? BROKER_BACKOFF_MAX_MS : uint32_t(BROKER_BACKOFF_MS) << (b.failures - 1);
+  b.retryAt = now + (backoff > BROKER_BACKOFF_MAX_MS ? BROKER_BACKOFF_MAX_MS : backoff);
+  b.changedAt = now;
+}
+
+void BrokerPool::lost(size_t i, uint32_t now, uint32_t sessionMs) {
+  if (sessionMs < BROKER_STABLE_MS)
+    failed(i, now);
+  // else: a long healthy session; reconnecting to the same broker right away is fine
+}
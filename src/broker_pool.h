@@ -0,0 +1,79 @@
+/*
+  Ordered list of MQTT brokers with health scores, for failing over to a standby broker.
+
+  Every broker starts with a full score. A failed or timed-out connect halves the score and keeps
+  the broker out of rotation for a backoff that doubles with each consecutive failure. A session
+  that drops soon after connecting counts as a failure too. The score recovers slowly while the
+  broker is left alone, so a primary that went down for maintenance becomes eligible again.
+
+  select() prefers list order: the first healthy broker whose backoff has passed wins. Without one,
+  it takes the best score among the brokers that are due. The backoff only steers that choice:
+  when no broker is due, as with a single broker that is down, wait() is at most
+  BROKER_RETRY_MAX_MS, so a broker back from a short restart is found again within seconds and not
+  after its backoff, which may be longer than the dead time. preferred() tells the caller, while it is
+  connected to a fallback, that an earlier broker has recovered enough to try again; with one
+  failure behind it that takes about four minutes.
+
+  Portable and not thread-safe; times are milliseconds on any monotonic clock.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BROKER_POOL_MAX 3
+#define BROKER_HOST_SIZE 64
+#define BROKER_SCORE_MAX 100
+#define BROKER_SCORE_HEALTHY 50
+#define BROKER_BACKOFF_MS 5000          // first wait after a failure, doubled per consecutive failure
+#define BROKER_BACKOFF_MAX_MS 600000
+#define BROKER_RETRY_MAX_MS 5000        // longest wait() when no broker is due
+#define BROKER_SCORE_FAILBACK 90        // an earlier broker this healthy is worth leaving a fallback for
+#define BROKER_RECOVER_MS 60000         // ten points of score back per this long without a failure
+#define BROKER_STABLE_MS 60000          // a session shorter than this that drops counts as a failure
+
+#ifndef BROKER_CONNECT_TIMEOUT_MS
+#define BROKER_CONNECT_TIMEOUT_MS 5000  // connect to CONNACK; then the next broker is tried
+#endif
+
+struct BrokerHealth {
+  char host[BROKER_HOST_SIZE];
+  uint16_t port;
+  uint8_t score;         // at the last failure or success, see BrokerPool::health()
+  uint8_t failures;      // consecutive
+  uint32_t changedAt;    // time of the last failure or success
+  uint32_t retryAt;      // no attempt before this
+  uint32_t attempts;
+  uint32_t connects;
+};
+
+class BrokerPool {
+ public:
+  BrokerPool();
+
+  void clear();
+  bool add(const char* host, uint16_t port);
+  // append "host[:port],host[:port]"; returns how many were added
+  size_t addList(const char* list, uint16_t defaultPort);
+
+  size_t count() const { return _count; }
+  const BrokerHealth& broker(size_t i) const { return _brokers[i]; }
+  uint8_t health(size_t i, uint32_t now) const;  // the score, recovered for the time since the last failure
+
+  size_t select(uint32_t now) const;
+  uint32_t wait(size_t i, uint32_t now) const;  // milliseconds until broker i may be tried, 0 = now; capped
+  // an earlier, healthy broker worth leaving 'current' for, or 'current'
+  size_t preferred(size_t current, uint32_t now) const;
+
+  void attempt(size_t i);
+  void connected(size_t i, uint32_t now);
+  void failed(size_t i, uint32_t now);
+  void lost(size_t i, uint32_t now, uint32_t sessionMs);
+
+ private:
+  bool due(size_t i, uint32_t now) const { return int32_t(now - _brokers[i].retryAt) >= 0; }
+
+  BrokerHealth _brokers[BROKER_POOL_MAX];
+  size_t _count;
+};
@@ -0,0 +1,216 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/md.h>
+
+#include "config.h"
+
+#define CONFIG_NAMESPACE "sgready"
+#define CONFIG_KEY "cfg"
+#define CONFIG_HMAC_HEX 64
+
+// the layout before the broker fallbacks
+struct SgConfigV1 {
+  uint16_t version;
+  uint16_t size;
+  char wifiSsid[33];
+  char wifiPass[65];
+  char mqttHost[64];
+  uint16_t mqttPort;
+  char mqttUser[33];
+  char mqttPass[65];
+  uint32_t keepAliveInterval;
+  uint32_t deadTime;
+  uint32_t seq;
+  uint32_t crc;
+};
+
+template <class T>
+static uint32_t configCrc(const T& config) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&config), offsetof(T, crc));
+}
+
+template <class T>
+static bool configValid(const T& config, size_t length, uint16_t version) {
+  return length == sizeof(config) && config.version == version && config.size == sizeof(config) && config.crc == configCrc(config);
+}
+
+bool configLoad(SgConfig& config, const SgConfig& fallback) {
+  union {
+    SgConfig current;
+    SgConfigV1 v1;
+  } blob;
+  Preferences prefs;
+  size_t length = 0;
+  if (prefs.begin(CONFIG_NAMESPACE, true)) {
+    length = prefs.getBytes(CONFIG_KEY, &blob, sizeof(blob));
+    prefs.end();
+  }
+
+  if (configValid(blob.current, length, CONFIG_VERSION)) {
+    config = blob.current;
+    return true;
+  }
+
+  config = fallback;
+  if (!configValid(blob.v1, length, 1))
+    return false;
+
+  // new fields keep their defaults; saved in the new layout with the next update
+  const SgConfigV1& v1 = blob.v1;
+  memcpy(config.wifiSsid, v1.wifiSsid, sizeof(config.wifiSsid));
+  memcpy(config.wifiPass, v1.wifiPass, sizeof(config.wifiPass));
+  memcpy(config.mqttHost, v1.mqttHost, sizeof(config.mqttHost));
+  config.mqttPort = v1.mqttPort;
+  memcpy(config.mqttUser, v1.mqttUser, sizeof(config.mqttUser));
+  memcpy(config.mqttPass, v1.mqttPass, sizeof(config.mqttPass));
+  config.keepAliveInterval = v1.keepAliveInterval;
+  config.deadTime = v1.deadTime;
+  config.seq = v1.seq;
+  return true;
+}
+
+bool configSave(SgConfig& config) {
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(config);
+  config.crc = configCrc(config);
+
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NAMESPACE, false))
+    return false;
+  bool ok = prefs.putBytes(CONFIG_KEY, &config, sizeof(config)) == sizeof(config);
+  prefs.end();
+  return ok;
+}
+
+static bool hexByte(const char* hex, uint8_t& out) {
+  uint8_t v = 0;
+  for (int i = 0; i < 2; i++) {
+    char c = hex[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9') v |= c - '0';
+    else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+    else return false;
+  }
+  out = v;
+  return true;
+}
+
+static bool verifyHmac(const char* secret, const char* hex, const char* json, size_t jsonLength) {
+  uint8_t expected[32];
+  if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), reinterpret_cast<const unsigned char*>(secret), strlen(secret),
+                      reinterpret_cast<const unsigned char*>(json), jsonLength, expected) != 0)
+    return false;
+
+  uint8_t diff = 0;  // constant time
+  for (int i = 0; i < 32; i++) {
+    uint8_t b;
+    if (!hexByte(hex + 2*i, b))
+      return false;
+    diff |= b ^ expected[i];
+  }
+  return diff == 0;
+}
+
+// copy a string field if present; false if it does not fit
+static bool takeString(JsonDocument& doc, const char* key, char* field, size_t size, uint8_t change, uint8_t& changes) {
+  const char* value = doc[key];
+  if (!value)
+    return true;
+  if (strlen(value) >= size)
+    return false;
+  if (strcmp(field, value)) {
+    strcpy(field, value);
+    changes |= change;
+  }
+  return true;
+}
+
+bool configVerify(const SgConfig& config, const char* secret, const char* payload, size_t length, JsonDocument& doc, const char*& error) {
+  if (!secret || !*secret) {
+    error = "no CONFIG_SECRET compiled in";
+    return false;
+  }
+  if (length > CONFIG_MAX_PAYLOAD) {
+    error = "payload too long";
+    return false;
+  }
+  if (length < CONFIG_HMAC_HEX + 2 || payload[CONFIG_HMAC_HEX] != ' ') {
+    error = "expected '<hmac> <json>'";
+    return false;
+  }
+
+  const char* json = payload + CONFIG_HMAC_HEX + 1;
+  size_t jsonLength = length - CONFIG_HMAC_HEX - 1;
+  if (!verifyHmac(secret, payload, json, jsonLength)) {
+    error = "bad signature";
+    return false;
+  }
+
+  if (deserializeJson(doc, json, jsonLength)) {
+    error = "invalid JSON";
+    return false;
+  }
+
+  uint32_t seq = doc["seq"] | 0u;
+  if (seq <= config.seq) {
+    error = "stale sequence number";
+    return false;
+  }
+  return true;
+}
+
+bool configUpdate(SgConfig& config, const char* secret, const char* payload, size_t length, uint8_t& changes, const char*& error) {
+  changes = 0;
+  DynamicJsonDocument doc(CONFIG_MAX_PAYLOAD);
+  if (!configVerify(config, secret, payload, length, doc, error))
+    return false;
+
+  SgConfig updated = config;
+  bool fits = takeString(doc, "wifi_ssid", updated.wifiSsid, sizeof(updated.wifiSsid), CONFIG_CHANGED_WIFI, changes)
+           && takeString(doc, "wifi_pass", updated.wifiPass, sizeof(updated.wifiPass), CONFIG_CHANGED_WIFI, changes)
+           && takeString(doc, "mqtt_host", updated.mqttHost, sizeof(updated.mqttHost), CONFIG_CHANGED_BROKER, changes)
+           && takeString(doc, "mqtt_user", updated.mqttUser, sizeof(updated.mqttUser), CONFIG_CHANGED_BROKER, changes)
+           && takeString(doc, "mqtt_pass", updated.mqttPass, sizeof(updated.mqttPass), CONFIG_CHANGED_BROKER, changes)
+           && takeString(doc, "mqtt_fallback", updated.mqttFallback, sizeof(updated.mqttFallback), CONFIG_CHANGED_BROKER, changes);
+  if (!fits) {
+    error = "string field too long";
+    return false;
+  }
+
+  if (!*updated.mqttHost) {
+    error = "mqtt_host must not be empty";
+    return false;
+  }
+  long port = doc["mqtt_port"] | long(updated.mqttPort);
+  if (port < 1 || port > 65535) {
+    error = "mqtt_port must be 1 to 65535";
+    return false;
+  }
+  if (port != updated.mqttPort) {
+    updated.mqttPort = port;
+    changes |= CONFIG_CHANGED_BROKER;
+  }
+
+  uint32_t keepAlive = doc["keepalive"] | updated.keepAliveInterval;
+  uint32_t deadTime = doc["dead_time"] | updated.deadTime;
+  if (keepAlive < CONFIG_KEEPALIVE_MIN || keepAlive > CONFIG_KEEPALIVE_MAX || deadTime < 2*keepAlive || deadTime > CONFIG_DEAD_TIME_MAX) {
+    error = "keepalive must be 10 to 3600 s and dead_time from twice the keepalive to 86400 s";
+    return false;
+  }
+  if (keepAlive != updated.keepAliveInterval || deadTime != updated.deadTime) {
+    updated.keepAliveInterval = keepAlive;
+    updated.deadTime = deadTime;
+    changes |= CONFIG_CHANGED_TIMING;
+  }
+
+  updated.seq = doc["seq"];
+  config = updated;
+  return true;
+}
+
+#endif
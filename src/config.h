@@ -0,0 +1,67 @@
+/*
+  Runtime configuration kept in NVS.
+
+  The whole configuration is one versioned, CRC32-protected blob read with a single getBytes() at
+  boot. A missing, outdated or corrupt blob falls back to the compiled-in defaults from
+  credentials.h.
+
+  Updates arrive on the config topic as "<hmac> <json>". <hmac> is the hex HMAC-SHA256 of <json>
+  keyed with CONFIG_SECRET. The JSON carries only the fields to change, plus a "seq" that must be
+  higher than the last accepted one, so a recorded update cannot be replayed:
+
+    {"seq":7,"mqtt_host":"192.168.0.2","dead_time":240}
+
+  tools/sign_config.py builds and signs such payloads.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ArduinoJson.h>
+
+#define CONFIG_VERSION 2  // 2 added mqttFallback; version 1 records are migrated
+#define CONFIG_MAX_PAYLOAD 768  // hmac, space and json
+#define CONFIG_KEEPALIVE_MIN 10       // seconds
+#define CONFIG_KEEPALIVE_MAX 3600
+#define CONFIG_DEAD_TIME_MAX 86400
+
+struct SgConfig {
+  uint16_t version;
+  uint16_t size;             // sizeof(SgConfig), catches layout changes without a version bump
+  char wifiSsid[33];
+  char wifiPass[65];
+  char mqttHost[64];
+  uint16_t mqttPort;
+  char mqttUser[33];
+  char mqttPass[65];
+  char mqttFallback[96];       // "host[:port],host[:port]", tried in order when mqttHost fails
+  uint32_t keepAliveInterval;  // seconds between liveness publishes
+  uint32_t deadTime;           // seconds without a PUBACK before the broker counts as dead
+  uint32_t seq;                // last accepted update
+  uint32_t crc;                // CRC32 of everything above
+};
+
+// what an update touched, so only the affected parts are restarted
+enum ConfigChange : uint8_t {
+  CONFIG_CHANGED_WIFI = 0x01,
+  CONFIG_CHANGED_BROKER = 0x02,   // host, port, fallbacks or credentials
+  CONFIG_CHANGED_TIMING = 0x04    // keepalive interval or dead time
+};
+
+// load from NVS, migrating older versions; on failure 'config' is set to 'fallback' and false is returned
+bool configLoad(SgConfig& config, const SgConfig& fallback);
+bool configSave(SgConfig& config);  // updates the CRC
+
+/* Check the signature and sequence number of a signed command and parse its JSON into 'doc'.
+   Other signed commands (OTA) share the sequence number, so the caller stores the new "seq" in
+   config.seq once it acts on the command.
+*/
+bool configVerify(const SgConfig& config, const char* secret, const char* payload, size_t length, JsonDocument& doc, const char*& error);
+
+/* Check the signature and sequence number of an update and apply it to 'config'. Returns false and
+   sets 'error' if the update is rejected, in which case 'config' is unchanged. An empty host, port 0
+   and a keepalive or dead time outside its bounds are rejected. 'changes' receives
+   a ConfigChange mask; the caller saves and applies.
+*/
+bool configUpdate(SgConfig& config, const char* secret, const char* payload, size_t length, uint8_t& changes, const char*& error);
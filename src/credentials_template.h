@@ -3,8 +3,33 @@
 
 #define WIFI_SSID "YOUR_WIFI_SSID"
 #define WIFI_PASSWORD "YOUR_WIFI_PASS"
+// optional further networks for roaming, as { ssid, password, bssid }; a BSSID pins one access point, "" takes any
+// #define WIFI_ROAM_NETWORKS { "YOUR_WIFI_SSID", "YOUR_WIFI_PASS", "24:a4:3c:01:02:03" }, { "Garage", "garage pass", "" }
 
 #define MQTT_HOST IPAddress(192, 168, 0, 1)
 #define MQTT_PORT 1883
 #define MQTT_USER "YOUR_MQTT_USER"
 #define MQTT_PASS "YOUR_MQTT_PASS"
+// #define MQTT_FALLBACK "192.168.0.2,192.168.0.3:1884"  // optional standby brokers, same credentials
+
+/* Optional MQTT over TLS, used by the 'tls' environment only. Point MQTT_PORT at the broker's TLS
+   listener (usually 8883) and authenticate the broker with a pinned key, a CA certificate, or both.
+   The pin is the SHA-256 of the broker's public key:
+     openssl x509 -in server.crt -pubkey -noout | openssl pkey -pubin -outform der | sha256sum
+*/
+// #define MQTT_TLS_PIN_SHA256 "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+// #define MQTT_TLS_CA_PEM "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"
+
+/* Optional remote configuration. With a secret, signed updates on sgready_board/config/set can
+   change the WiFi and broker settings, the keepalive interval and the dead time, which are then kept
+   in NVS (see src/config.h and tools/sign_config.py). Without a secret, updates are rejected.
+*/
+// #define CONFIG_SECRET "a long random string"
+
+/* Optional time-of-use tariff: cheap hours request Excess on the hour, without Home Assistant
+   (see src/tariff.h for the syntax). SNTP_SERVER defaults to pool.ntp.org.
+*/
+// #define TARIFF_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+// #define TARIFF_WEEK "Mo-Fr 0-6,22-24; Sa,Su,Ho 0-24"
+// #define TARIFF_HOLIDAYS "01-01,05-01,12-25,12-26,2026-04-06"
+// #define SNTP_SERVER "192.168.0.1"
@@ -0,0 +1,81 @@
+#include "display_flush.h"
+
+#include <string.h>
+
+#define SSD1306_COLUMNADDR 0x21
+#define SSD1306_PAGEADDR 0x22
+
+DisplayFlush::DisplayFlush()
+  : _frame(), _shown(), _busy(false), _page(0), _x(0), _spanEnd(0), _windowSent(false), _stats() {
+}
+
+void DisplayFlush::begin(const uint8_t* shown) {
+  memcpy(_shown, shown, sizeof(_shown));
+  _busy = false;
+}
+
+bool DisplayFlush::start(const uint8_t* frame) {
+  if (_busy)
+    _stats.superseded++;
+  memcpy(_frame, frame, sizeof(_frame));
+  _page = 0;
+  _x = 0;
+  _windowSent = false;
+  _busy = findSpan();
+  if (_busy)
+    _stats.frames++;
+  else
+    _stats.unchanged++;
+  return _busy;
+}
+
+// from _page/_x on, the next run of changed columns on one page
+bool DisplayFlush::findSpan() {
+  for (; _page < DISPLAY_FLUSH_PAGES; _page++, _x = 0) {
+    const uint8_t* frame = _frame + _page * DISPLAY_FLUSH_WIDTH;
+    const uint8_t* shown = _shown + _page * DISPLAY_FLUSH_WIDTH;
+    int first = -1, last = -1;
+    for (int x = _x; x < DISPLAY_FLUSH_WIDTH; x++)
+      if (frame[x] != shown[x]) {
+        if (first < 0)
+          first = x;
+        last = x;
+      }
+    if (first >= 0) {
+      _x = uint8_t(first);
+      _spanEnd = uint8_t(last);
+      _windowSent = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t DisplayFlush::next(uint8_t* out) {
+  if (!_busy)
+    return 0;
+
+  size_t n;
+  if (!_windowSent) {
+    const uint8_t window[] = { 0x00, SSD1306_COLUMNADDR, _x, _spanEnd, SSD1306_PAGEADDR, _page, _page };
+    memcpy(out, window, sizeof(window));
+    n = sizeof(window);
+    _windowSent = true;
+  }
+  else {
+    size_t count = _spanEnd - _x + 1;
+    if (count > DISPLAY_FLUSH_CHUNK)
+      count = DISPLAY_FLUSH_CHUNK;
+    size_t offset = _page * DISPLAY_FLUSH_WIDTH + _x;
+    out[0] = 0x40;
+    memcpy(out + 1, _frame + offset, count);
+    memcpy(_shown + offset, _frame + offset, count);
+    n = 1 + count;
+    _x += uint8_t(count);
+    if (_x > _spanEnd)
+      _busy = findSpan();  // the rest of the page is unchanged, so this moves on to the next page
+  }
+  _stats.transactions++;
+  _stats.bytes += uint32_t(n);
+  return n;
+}
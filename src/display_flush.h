@@ -0,0 +1,58 @@
+/*
+  Incremental framebuffer transfer to an SSD1306, one small I2C transaction at a time.
+
+  The driver's display() sends the bounding box of all changed bytes in one blocking call. This
+  state machine works per page instead. start() takes a new frame, and each next() call returns the
+  next transaction to put on the bus: the column and page window of a changed span in one command
+  transaction (control byte 0x00), then its bytes in data transactions (control byte 0x40) of at
+  most DISPLAY_FLUSH_CHUNK bytes. Changes far apart on different pages cost only their own bytes.
+  The caller decides when each transaction goes out, so no single call holds the bus longer than
+  one chunk.
+
+  A frame that arrives mid-flush replaces the rest of the old one. What was sent stays sent, and
+  the diff continues against it.
+
+  Portable and not thread-safe; the firmware drives it from its display task only.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DISPLAY_FLUSH_WIDTH 128
+#define DISPLAY_FLUSH_PAGES 8
+#define DISPLAY_FLUSH_SIZE (DISPLAY_FLUSH_WIDTH * DISPLAY_FLUSH_PAGES)
+#define DISPLAY_FLUSH_CHUNK 16                             // data bytes per transaction
+#define DISPLAY_FLUSH_MAX_TRANSACTION (1 + DISPLAY_FLUSH_CHUNK)
+
+struct DisplayFlushStats {
+  uint32_t frames;        // start() calls with something to send
+  uint32_t unchanged;     // start() calls without
+  uint32_t superseded;    // frames replaced before they were fully sent
+  uint32_t transactions;
+  uint32_t bytes;         // control bytes included, address bytes not
+};
+
+class DisplayFlush {
+ public:
+  DisplayFlush();
+
+  void begin(const uint8_t* shown);  // what the panel holds now
+  bool start(const uint8_t* frame);  // false if the frame is what the panel already shows
+  size_t next(uint8_t* out);         // the next transaction, 0 once the frame is on the panel
+  bool busy() const { return _busy; }
+  const DisplayFlushStats& stats() const { return _stats; }
+
+ private:
+  bool findSpan();
+
+  uint8_t _frame[DISPLAY_FLUSH_SIZE];
+  uint8_t _shown[DISPLAY_FLUSH_SIZE];
+  bool _busy;
+  uint8_t _page;        // current page
+  uint8_t _x;           // next column to send in the current span
+  uint8_t _spanEnd;     // last column of the current span
+  bool _windowSent;     // the span's address window is set
+  DisplayFlushStats _stats;
+};
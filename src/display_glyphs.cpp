@@ -0,0 +1,69 @@
+#include "display_glyphs.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>  // PROGMEM
+#else
+#define PROGMEM
+#endif
+
+// 5x7 glyphs plus one blank column, in GLYPH index order
+const uint8_t GLYPHS[GLYPH_COUNT][GLYPH_WIDTH] PROGMEM = {
+  { 0x3e, 0x51, 0x49, 0x45, 0x3e, 0x00 },  // 0
+  { 0x00, 0x42, 0x7f, 0x40, 0x00, 0x00 },  // 1
+  { 0x42, 0x61, 0x51, 0x49, 0x46, 0x00 },  // 2
+  { 0x21, 0x41, 0x45, 0x4b, 0x31, 0x00 },  // 3
+  { 0x18, 0x14, 0x12, 0x7f, 0x10, 0x00 },  // 4
+  { 0x27, 0x45, 0x45, 0x45, 0x39, 0x00 },  // 5
+  { 0x3c, 0x4a, 0x49, 0x49, 0x30, 0x00 },  // 6
+  { 0x01, 0x71, 0x09, 0x05, 0x03, 0x00 },  // 7
+  { 0x36, 0x49, 0x49, 0x49, 0x36, 0x00 },  // 8
+  { 0x06, 0x49, 0x49, 0x29, 0x1e, 0x00 },  // 9
+  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+  { 0x00, 0x60, 0x60, 0x00, 0x00, 0x00 },  // .
+  { 0x00, 0x36, 0x36, 0x00, 0x00, 0x00 },  // :
+  { 0x08, 0x08, 0x08, 0x08, 0x08, 0x00 },  // -
+  { 0x48, 0x54, 0x54, 0x54, 0x20, 0x00 },  // s
+};
+
+char* formatUnsigned(char* out, uint32_t value, size_t width) {
+  if (!width)
+    for (uint32_t v = value; width < 10 && (v || !width); v /= 10)
+      width++;
+  char* p = out + width;
+  *p = '\0';
+  do {
+    *--p = char('0' + value % 10);
+    value /= 10;
+  } while (value && p > out);
+  char pad = value ? '-' : ' ';  // too wide for the field: dashes rather than a wrong number
+  if (value)
+    p = out + width;
+  while (p > out)
+    *--p = pad;
+  return out;
+}
+
+char* formatSigned(char* out, int32_t value, size_t width) {
+  if (value >= 0)
+    return formatUnsigned(out, uint32_t(value), width);
+  char* p = formatUnsigned(out + 1, uint32_t(-int64_t(value)), width > 1 ? width - 1 : 0);
+  out[0] = ' ';
+  while (*p == ' ')
+    p++;
+  p[-1] = '-';  // all dashes if it didn't fit
+  return out;
+}
+
+char* formatIp(char* out, uint32_t ip) {
+  char* p = out;
+  for (int i = 0; i < 4; i++) {
+    uint8_t octet = uint8_t(ip >> (8 * i));
+    if (octet >= 100)
+      *p++ = char('0' + octet / 100);
+    if (octet >= 10)
+      *p++ = char('0' + octet / 10 % 10);
+    *p++ = char('0' + octet % 10);
+    *p++ = i < 3 ? '.' : '\0';
+  }
+  return out;
+}
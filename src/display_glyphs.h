@@ -0,0 +1,51 @@
+/*
+  Fixed-width numeric fields for the OLED, drawn from a table of pre-rendered glyphs.
+
+  Each glyph is 6 columns of 8 pixels, one byte per column with the least significant bit at the
+  top. That is the SSD1306 page layout, so drawFastImage() copies a glyph straight into the
+  framebuffer. There is no printf and no font lookup: format*() writes the digits into a small
+  buffer and drawGlyphs() blits one glyph per character. A field drawn with a fixed width is
+  right-aligned and always covers the same pixels, whatever the value.
+
+  The table holds digits, space, '.', ':', '-' and 's'; other characters draw as a space.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GLYPH_WIDTH 6
+#define GLYPH_HEIGHT 8
+#define GLYPH_COUNT 15
+
+extern const uint8_t GLYPHS[GLYPH_COUNT][GLYPH_WIDTH];
+
+// index into GLYPHS; unknown characters map to the space
+inline uint8_t glyphIndex(char c) {
+  if (c >= '0' && c <= '9')
+    return uint8_t(c - '0');
+  switch (c) {
+    case '.': return 11;
+    case ':': return 12;
+    case '-': return 13;
+    case 's': return 14;
+    default:  return 10;
+  }
+}
+
+// right-aligned in 'width' characters, padded with spaces, all dashes if it doesn't fit; width 0 takes
+// as many as the value needs. 'out' needs width + 1 bytes, at most 11.
+char* formatUnsigned(char* out, uint32_t value, size_t width);
+// as formatUnsigned(), with a '-' right before the digits of a negative value; 'out' needs width + 1 bytes
+char* formatSigned(char* out, int32_t value, size_t width);
+// dotted quad of an address in network order (first octet in the low byte); 'out' needs 16 bytes
+char* formatIp(char* out, uint32_t ip);
+
+// 'Display' is any type with OLEDDisplay's drawFastImage()
+template <class Display>
+int16_t drawGlyphs(Display& display, int16_t x, int16_t y, const char* text) {
+  for (; *text; text++, x += GLYPH_WIDTH)
+    display.drawFastImage(x, y, GLYPH_WIDTH, GLYPH_HEIGHT, GLYPHS[glyphIndex(*text)]);
+  return x;
+}
@@ -0,0 +1,111 @@
+#include "display_pages.h"
+
+#define CHART_MODE_ROWS 32  // chart pages 0-3; page 4 holds the liveness strips
+
+HistoryChart::HistoryChart() {
+  clear();
+}
+
+void HistoryChart::clear() {
+  memset(_columns, 0, sizeof(_columns));
+  memset(_bitmap, 0, sizeof(_bitmap));
+  _newest = DISPLAY_HISTORY_COLUMNS - 1;
+  _period = 0;
+  _started = false;
+}
+
+bool HistoryChart::sample(const DisplayView& v) {
+  uint32_t period = v.uptime / DISPLAY_HISTORY_COLUMN_SECONDS;
+  bool changed = false;
+  if (!_started) {
+    _started = true;
+    _period = period;
+  }
+  else if (period != _period) {
+    uint32_t steps = period - _period;
+    if (steps > DISPLAY_HISTORY_COLUMNS)
+      steps = DISPLAY_HISTORY_COLUMNS;
+    for (; steps; steps--) {  // scroll: one byte per chart row, and an empty column at the right
+      _newest = uint8_t((_newest + 1) % DISPLAY_HISTORY_COLUMNS);
+      _columns[_newest] = 0;
+      for (uint8_t page = 0; page < DISPLAY_CHART_PAGES; page++) {
+        memmove(_bitmap[page], _bitmap[page] + 1, DISPLAY_WIDTH - 1);
+        _bitmap[page][DISPLAY_WIDTH - 1] = 0;
+      }
+    }
+    _period = period;
+    changed = true;
+  }
+
+  uint8_t flags = uint8_t(1 << (v.mode & 3)) | (v.ip ? HISTORY_WIFI_UP : HISTORY_WIFI_DOWN) |
+                  (v.mqttConnected ? HISTORY_MQTT_UP : HISTORY_MQTT_DOWN);
+  uint8_t& column = _columns[_newest];
+  if ((column | flags) != column) {
+    column |= flags;
+    draw(DISPLAY_WIDTH - 1, column);
+    changed = true;
+  }
+  return changed;
+}
+
+void HistoryChart::rebuild() {
+  for (uint8_t x = 0; x < DISPLAY_HISTORY_COLUMNS; x++)
+    draw(x, column(x));
+}
+
+// three rows: solid if up all the time, the middle one if up part of the time, none if down
+static uint8_t liveness(uint8_t flags, uint8_t up, uint8_t down) {
+  if (!(flags & up))
+    return 0;
+  return flags & down ? 0x02 : 0x07;
+}
+
+// a bar as high as the highest mode the column saw, and the WiFi and MQTT strips below it
+void HistoryChart::draw(uint8_t x, uint8_t flags) {
+  int top = CHART_MODE_ROWS;  // the bar's first row; none without samples
+  if (flags & HISTORY_MODES) {
+    int mode = 3;
+    while (!(flags & (1 << mode)))
+      mode--;
+    top = CHART_MODE_ROWS - 2 - 10 * mode;
+  }
+  for (int page = 0; page < CHART_MODE_ROWS / 8; page++) {
+    int first = top - 8 * page;
+    _bitmap[page][x] = first <= 0 ? 0xff : first >= 8 ? 0 : uint8_t(0xff << first);
+  }
+  _bitmap[CHART_MODE_ROWS / 8][x] = liveness(flags, HISTORY_WIFI_UP, HISTORY_WIFI_DOWN) |
+                                    uint8_t(liveness(flags, HISTORY_MQTT_UP, HISTORY_MQTT_DOWN) << 4);
+}
+
+DisplayPager::DisplayPager(uint32_t rotateMillis)
+  : _rotateMillis(rotateMillis), _page(DisplayPage::Status), _shownAt(0), _seen(false), _wakes(0) {
+}
+
+void DisplayPager::turn(DisplayPage page, uint32_t now) {
+  _page = page;
+  _shownAt = now;
+}
+
+DisplayPage DisplayPager::select(const DisplayView& v, uint32_t now, DisplayPanel panel) {
+  bool pressed = _seen && v.wakes != _wakes;
+  _seen = true;
+  _wakes = v.wakes;
+  DisplayPage next = DisplayPage((uint8_t(_page) + 1) % uint8_t(DisplayPage::Count));
+  if (panel != DisplayPanel::Bright) {
+    if (panel == DisplayPanel::Off || pressed)
+      turn(DisplayPage::Status, now);  // whatever wakes the panel, it comes back on the status page
+  }
+  else if (pressed || (_rotateMillis && now - _shownAt >= _rotateMillis))
+    turn(next, now);
+  return _page;
+}
+
+const char* DisplayPager::pageName(DisplayPage page) {
+  switch (page) {
+    case DisplayPage::Status:  return "status";
+    case DisplayPage::Health:  return "health";
+    case DisplayPage::History: return "history";
+    case DisplayPage::Count:   break;
+  }
+  return "?";
+}
@@ -0,0 +1,183 @@
+/*
+  The pages of the OLED: status (display_ui.h), network health, and a 24 h chart of the SG Ready
+  mode and of WiFi and MQTT liveness.
+
+  Each page starts its frame from a copy of its fixed labels, drawn once by begin(), and fills in
+  glyph fields as the status page does. The chart is kept as a bitmap in the panel's page layout,
+  one byte per column and page. When a column's time is up, sample() shifts each chart row left by
+  one byte and draws only the new column; while a column is open, it redraws only that column.
+  Rendering the page is then a copy of the labels and of the bitmap. rebuild() draws all columns
+  again, which is what a chart without the bitmap would do every frame.
+
+  The history is sampled from the views, on uptime, so it keeps up whatever page is shown and
+  whether the panel is lit or not. It lives in RAM and starts empty after a reboot.
+
+  DisplayPager picks the page: one press of the wake button turns to the next page, and with a
+  rotation period the pages also turn on their own while the panel is bright. A press that wakes a
+  dimmed or blanked panel only wakes it, and a wake always shows the status page first.
+
+  Portable and not thread-safe; the firmware drives all of it from its display task.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "display_ui.h"
+#include "display_power.h"
+
+#define DISPLAY_HISTORY_COLUMNS DISPLAY_WIDTH
+#define DISPLAY_HISTORY_COLUMN_SECONDS (86400 / DISPLAY_HISTORY_COLUMNS)  // 675 s, 24 h across the panel
+#define DISPLAY_CHART_FIRST_PAGE 2  // the chart takes rows 16 to 55
+#define DISPLAY_CHART_PAGES 5
+
+// what one chart column saw
+#define HISTORY_MODES 0x0f      // bit n: SG Ready mode n
+#define HISTORY_WIFI_UP 0x10
+#define HISTORY_WIFI_DOWN 0x20
+#define HISTORY_MQTT_UP 0x40
+#define HISTORY_MQTT_DOWN 0x80
+
+enum class DisplayPage : uint8_t { Status, Health, History, Count };
+
+class HistoryChart {
+ public:
+  HistoryChart();
+
+  void clear();
+  bool sample(const DisplayView& v);  // true if the chart changed
+  void rebuild();
+  uint8_t column(uint8_t x) const { return _columns[(_newest + 1 + x) % DISPLAY_HISTORY_COLUMNS]; }  // oldest first
+  const uint8_t* row(uint8_t page) const { return _bitmap[page]; }
+
+ private:
+  void draw(uint8_t x, uint8_t flags);
+
+  uint8_t _columns[DISPLAY_HISTORY_COLUMNS];  // ring of flags
+  uint8_t _newest;                            // the open column in the ring
+  uint32_t _period;                           // uptime / DISPLAY_HISTORY_COLUMN_SECONDS of the open column
+  bool _started;
+  uint8_t _bitmap[DISPLAY_CHART_PAGES][DISPLAY_WIDTH];
+};
+
+class DisplayPager {
+ public:
+  explicit DisplayPager(uint32_t rotateMillis = 0);
+
+  DisplayPage select(const DisplayView& v, uint32_t now, DisplayPanel panel);  // the page to show for this view
+  DisplayPage page() const { return _page; }
+  static const char* pageName(DisplayPage page);
+
+ private:
+  void turn(DisplayPage page, uint32_t now);
+
+  uint32_t _rotateMillis;  // 0 = only on a press
+  DisplayPage _page;
+  uint32_t _shownAt;
+  bool _seen;
+  uint32_t _wakes;
+};
+
+template <class Display>
+class HealthScreen {
+ public:
+  void begin(Display& display);
+  void render(Display& display, const DisplayView& v);
+
+ private:
+  uint8_t width(Display& display, const char* text) { return uint8_t(display.getStringWidth(text, strlen(text))); }
+
+  uint8_t _labels[DISPLAY_BUFFER_SIZE];
+  int16_t _valueX[DISPLAY_LINES];
+  int16_t _stateX;  // after the broker number
+  int16_t _avgX;    // after the latest RTT
+};
+
+template <class Display>
+class DisplayPages {
+ public:
+  void begin(Display& display);
+  void render(Display& display, DisplayPage page, const DisplayView& v);
+  void renderText(Display& display, DisplayPage page, const DisplayView& v);  // the printf renderer on the status page
+  HistoryChart& chart() { return _chart; }
+
+ private:
+  void renderHistory(Display& display);
+
+  StatusScreen<Display> _status;
+  HealthScreen<Display> _health;
+  HistoryChart _chart;
+  uint8_t _historyLabels[DISPLAY_BUFFER_SIZE];
+};
+
+template <class Display>
+void HealthScreen<Display>::begin(Display& display) {
+  static const char* const labels[DISPLAY_LINES] = { "RSSI:", "Broker:", "RTT ms:", "Drops:", "Uptime:" };
+  display.clear();
+  display.drawString(0, 0, "Network");
+  for (int i = 0; i < DISPLAY_LINES; i++) {
+    display.drawString(0, DISPLAY_LINE_HEIGHT * (i + 1), labels[i]);
+    _valueX[i] = width(display, labels[i]) + width(display, " ");
+  }
+  display.drawString(_valueX[0] + 4 * GLYPH_WIDTH + width(display, " "), DISPLAY_LINE_HEIGHT, "dBm");
+  _stateX = _valueX[1] + 2 * GLYPH_WIDTH + width(display, " ");
+  int16_t avg = _valueX[2] + 4 * GLYPH_WIDTH + width(display, " ");
+  display.drawString(avg, 3 * DISPLAY_LINE_HEIGHT, "avg");
+  _avgX = avg + width(display, "avg ");
+  memcpy(_labels, display.buffer, sizeof(_labels));
+}
+
+template <class Display>
+void HealthScreen<Display>::render(Display& display, const DisplayView& v) {
+  char field[16];
+  memcpy(display.buffer, _labels, sizeof(_labels));
+  drawGlyphs(display, _valueX[0], 10 + DISPLAY_GLYPH_DY, v.ip ? formatSigned(field, v.rssi, 4) : "   -");
+  drawGlyphs(display, _valueX[1], 20 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.broker + 1u, 2));
+  display.drawString(_stateX, 20, v.mqttConnected ? "connected" : "down");
+  drawGlyphs(display, _valueX[2], 30 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.rttMicros / 1000, 4));
+  drawGlyphs(display, _avgX, 30 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.rttAvgMicros / 1000, 4));
+  drawGlyphs(display, _valueX[3], 40 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.mqttDrops, 0));
+  uint32_t minutes = v.uptime / 60;
+  int16_t x = drawGlyphs(display, _valueX[4], 50 + DISPLAY_GLYPH_DY, formatUnsigned(field, minutes / 60, 0));
+  const char clock[] = { ':', char('0' + minutes % 60 / 10), char('0' + minutes % 10), '\0' };
+  drawGlyphs(display, x, 50 + DISPLAY_GLYPH_DY, clock);
+}
+
+// once, after the display's init()
+template <class Display>
+void DisplayPages<Display>::begin(Display& display) {
+  display.clear();
+  display.drawString(0, 0, "24 h mode WiFi MQTT");
+  for (int16_t x = 0; x < DISPLAY_WIDTH; x += DISPLAY_WIDTH / 4)  // a tick every 6 h below the chart
+    display.drawVerticalLine(x, 8 * (DISPLAY_CHART_FIRST_PAGE + DISPLAY_CHART_PAGES), 3);
+  display.drawVerticalLine(DISPLAY_WIDTH - 1, 8 * (DISPLAY_CHART_FIRST_PAGE + DISPLAY_CHART_PAGES), 3);
+  memcpy(_historyLabels, display.buffer, sizeof(_historyLabels));
+  _health.begin(display);
+  _status.begin(display);  // last, it leaves its labels in the buffer
+}
+
+template <class Display>
+void DisplayPages<Display>::render(Display& display, DisplayPage page, const DisplayView& v) {
+  if (page == DisplayPage::Health)
+    _health.render(display, v);
+  else if (page == DisplayPage::History)
+    renderHistory(display);
+  else
+    _status.render(display, v);
+}
+
+template <class Display>
+void DisplayPages<Display>::renderText(Display& display, DisplayPage page, const DisplayView& v) {
+  if (page == DisplayPage::Status)
+    _status.renderText(display, v);
+  else
+    render(display, page, v);
+}
+
+template <class Display>
+void DisplayPages<Display>::renderHistory(Display& display) {
+  memcpy(display.buffer, _historyLabels, sizeof(_historyLabels));
+  for (uint8_t page = 0; page < DISPLAY_CHART_PAGES; page++)
+    memcpy(display.buffer + (DISPLAY_CHART_FIRST_PAGE + page) * DISPLAY_WIDTH, _chart.row(page), DISPLAY_WIDTH);
+}
@@ -0,0 +1,114 @@
+#include "display_power.h"
+
+#define SSD1306_SETCONTRAST 0x81
+#define SSD1306_DISPLAYOFF 0xae
+#define SSD1306_DISPLAYON 0xaf
+
+DisplayPower::DisplayPower(DisplayPowerMode mode, uint32_t blankMillis, uint32_t dimMillis, uint8_t contrast, uint8_t dimContrast)
+  : _mode(mode), _blankMillis(blankMillis), _dimMillis(dimMillis), _contrast(contrast), _dimContrast(dimContrast),
+    _activeAt(0), _panel(DisplayPanel::Bright), _panelSince(0), _seen(false), _last(), _sent(false), _shown(), _stats() {
+}
+
+void DisplayPower::begin(uint32_t now) {
+  _activeAt = now;
+  _panel = DisplayPanel::Bright;
+  _panelSince = now;
+  _seen = false;
+  _sent = false;
+}
+
+// what the panel shows, leaving out the counters that tick every second
+bool DisplayPower::sameScreen(const DisplayView& a, const DisplayView& b) {
+  return a.ip == b.ip && a.mqttConnected == b.mqttConnected && a.role == b.role && a.mode == b.mode &&
+         a.excess == b.excess && a.source == b.source && (a.lease > 0) == (b.lease > 0) &&
+         (a.stateSeconds >= a.dwellSeconds) == (b.stateSeconds >= b.dwellSeconds);
+}
+
+bool DisplayPower::view(const DisplayView& v, uint32_t now) {
+  _stats.views++;
+  bool wake = _seen && (v.wakes != _last.wakes || v.mode != _last.mode);
+  _last = v;
+  _seen = true;
+  if (wake)
+    _activeAt = now;
+
+  bool send = target(now) != DisplayPanel::Off;
+  if (send && _mode == DisplayPowerMode::OnChange)
+    send = wake || !_sent || !sameScreen(v, _shown);  // a button press refreshes the counters
+  if (!send) {
+    _stats.skipped++;
+    return false;
+  }
+  _shown = v;
+  _sent = true;
+  return true;
+}
+
+DisplayPanel DisplayPower::target(uint32_t now) const {
+  uint32_t quiet = now - _activeAt;
+  if (_mode == DisplayPowerMode::Blank && quiet >= _blankMillis)
+    return DisplayPanel::Off;
+  if (_dimMillis && quiet >= _dimMillis)
+    return DisplayPanel::Dim;
+  return DisplayPanel::Bright;
+}
+
+DisplayPanel DisplayPower::panel(uint32_t now) {
+  uint32_t elapsed = now - _panelSince;
+  _panelSince = now;
+  if (_panel == DisplayPanel::Bright)
+    _stats.brightMillis += elapsed;
+  else if (_panel == DisplayPanel::Dim)
+    _stats.dimMillis += elapsed;
+  else
+    _stats.offMillis += elapsed;
+
+  DisplayPanel next = target(now);
+  if (next != _panel) {
+    if (next == DisplayPanel::Off)
+      _stats.blanks++;
+    else if (next == DisplayPanel::Bright)
+      _stats.wakes++;
+    _panel = next;
+  }
+  return _panel;
+}
+
+uint32_t DisplayPower::idle(uint32_t now) const {
+  uint32_t quiet = now - _activeAt;
+  if (_dimMillis && quiet < _dimMillis && (_mode != DisplayPowerMode::Blank || _dimMillis < _blankMillis))
+    return _dimMillis - quiet;
+  if (_mode == DisplayPowerMode::Blank && quiet < _blankMillis)
+    return _blankMillis - quiet;
+  return DISPLAY_POWER_NEVER;
+}
+
+size_t DisplayPower::command(DisplayPanel panel, uint8_t* out) const {
+  out[0] = 0x00;  // control byte: commands follow
+  if (panel == DisplayPanel::Off) {
+    out[1] = SSD1306_DISPLAYOFF;
+    return 2;
+  }
+  out[1] = SSD1306_SETCONTRAST;
+  out[2] = panel == DisplayPanel::Dim ? _dimContrast : _contrast;
+  out[3] = SSD1306_DISPLAYON;
+  return 4;
+}
+
+const char* DisplayPower::modeName(DisplayPowerMode mode) {
+  switch (mode) {
+    case DisplayPowerMode::AlwaysOn: return "always on";
+    case DisplayPowerMode::OnChange: return "on change";
+    case DisplayPowerMode::Blank:    return "blank";
+  }
+  return "?";
+}
+
+const char* DisplayPower::panelName(DisplayPanel panel) {
+  switch (panel) {
+    case DisplayPanel::Bright: return "bright";
+    case DisplayPanel::Dim:    return "dim";
+    case DisplayPanel::Off:    return "off";
+  }
+  return "?";
+}
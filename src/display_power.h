@@ -0,0 +1,75 @@
+/*
+  When the OLED is lit, dimmed or blanked, and which views are worth sending to it.
+
+  AlwaysOn sends every view. OnChange skips views that differ from the one on the panel only in
+  the running counters (state time, lease), so the panel holds still between real changes. Blank
+  turns the panel off after blankMillis without activity. Activity is a press of the wake button,
+  counted in DisplayView::wakes, or a change of the SG Ready mode; either wakes the panel and
+  restarts the countdown. With dimMillis set, the panel drops to the dim contrast that long after
+  the last activity, in any mode.
+
+  While the panel is off, view() returns false and nothing needs to go on the bus. The panel keeps
+  its memory, so a wake only sends what changed meanwhile. command() gives the one I2C transaction
+  that moves the panel to a new state, in the same raw form as display_flush.h.
+
+  Portable and not thread-safe; the firmware drives it from its display task only. Times are
+  millis() and may wrap.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "display_ui.h"
+
+#define DISPLAY_POWER_NEVER 0xffffffffu
+#define DISPLAY_POWER_MAX_COMMAND 4
+
+enum class DisplayPowerMode : uint8_t { AlwaysOn, OnChange, Blank };
+enum class DisplayPanel : uint8_t { Bright, Dim, Off };
+
+struct DisplayPowerStats {
+  uint32_t views;
+  uint32_t skipped;      // views not sent: unchanged in OnChange, or the panel was off
+  uint32_t wakes;        // back to bright from dim or off
+  uint32_t blanks;
+  uint64_t brightMillis;
+  uint64_t dimMillis;
+  uint64_t offMillis;
+};
+
+class DisplayPower {
+ public:
+  DisplayPower(DisplayPowerMode mode = DisplayPowerMode::AlwaysOn, uint32_t blankMillis = 0, uint32_t dimMillis = 0,
+               uint8_t contrast = 0xcf, uint8_t dimContrast = 0x08);
+
+  void begin(uint32_t now);                        // the panel was just switched on, bright
+  bool view(const DisplayView& v, uint32_t now);   // true if this view should be rendered and sent
+  DisplayPanel panel(uint32_t now);                // the state the panel should be in now
+  uint32_t idle(uint32_t now) const;               // ms until panel() changes on its own, or DISPLAY_POWER_NEVER
+  size_t command(DisplayPanel panel, uint8_t* out) const;
+
+  DisplayPowerMode mode() const { return _mode; }
+  const DisplayPowerStats& stats() const { return _stats; }
+  static const char* modeName(DisplayPowerMode mode);
+  static const char* panelName(DisplayPanel panel);
+
+ private:
+  DisplayPanel target(uint32_t now) const;
+  static bool sameScreen(const DisplayView& a, const DisplayView& b);
+
+  DisplayPowerMode _mode;
+  uint32_t _blankMillis;
+  uint32_t _dimMillis;   // 0 = never dim
+  uint8_t _contrast;
+  uint8_t _dimContrast;
+  uint32_t _activeAt;    // the last wake
+  DisplayPanel _panel;
+  uint32_t _panelSince;
+  bool _seen;            // _last is valid
+  DisplayView _last;     // the latest view, for spotting wakes
+  bool _sent;            // _shown is valid
+  DisplayView _shown;    // the latest view sent
+  DisplayPowerStats _stats;
+};
@@ -0,0 +1,140 @@
+/*
+  The status screen, rendered into any display with the SSD1306 driver's drawing API.
+
+  The firmware renders into the real SSD1306; the native build renders the same code into the
+  emulator in native/oled_emulator.h, to measure render cost and I2C traffic and to take PNG
+  snapshots. Everything the screen shows comes in a DisplayView, so the renderer needs no
+  globals. The other pages are in display_pages.h.
+
+  render() starts each frame from a copy of the fixed labels, which begin() drew once, and writes
+  the numbers as fixed-width glyph fields (display_glyphs.h). begin() also measures the label and
+  word widths, so a frame does no font lookups beyond the few status words. renderText() is the
+  original printf-and-font renderer, kept so the two can be compared.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "arbiter.h"
+#include "display_glyphs.h"
+
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_BUFFER_SIZE (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8)
+#define DISPLAY_LINES 5
+#define DISPLAY_LINE_HEIGHT 10
+#define DISPLAY_GLYPH_DY 2  // puts a glyph on the digits of the 10 px font
+
+struct DisplayView {
+  uint32_t ip;             // network order, 0 = no WiFi
+  bool mqttConnected;
+  const char* role;        // leadership role of a standby pair, or null
+  uint8_t mode;
+  bool excess;
+  CommandSource source;    // Count = none
+  uint32_t lease;          // seconds left on the winning request, 0 = none
+  uint32_t stateSeconds;
+  uint32_t dwellSeconds;   // the minimum time in a state
+  uint32_t wakes;          // presses of the display's wake button so far (display_power.h)
+  // for the health and history pages (display_pages.h)
+  int8_t rssi;             // dBm, 0 = no WiFi
+  uint8_t broker;          // index into the broker list
+  uint32_t rttMicros;      // the latest publish-to-ack time, 0 = none yet
+  uint32_t rttAvgMicros;
+  uint32_t mqttDrops;      // disconnects since boot
+  uint32_t uptime;         // seconds since boot
+};
+
+template <class Display>
+class StatusScreen {
+ public:
+  void begin(Display& display);
+  void render(Display& display, const DisplayView& v);
+  void renderText(Display& display, const DisplayView& v);
+
+ private:
+  uint8_t width(Display& display, const char* text) { return uint8_t(display.getStringWidth(text, strlen(text))); }
+
+  uint8_t _labels[DISPLAY_BUFFER_SIZE];  // the fixed labels; every frame starts from a copy
+  int16_t _valueX[DISPLAY_LINES];        // where each line's value starts
+  int16_t _readyX;                       // the last line's value after "Ready for:"
+  int16_t _roleX;
+  uint8_t _excessWidth[2];
+  uint8_t _sourceWidth[uint8_t(CommandSource::Count) + 1];
+};
+
+// once, after the display's init()
+template <class Display>
+void StatusScreen<Display>::begin(Display& display) {
+  static const char* const labels[DISPLAY_LINES] = { "WiFi:", "MQTT:", "SG Mode:", "Excess:", "Remaining:" };
+  display.clear();
+  for (int i = 0; i < DISPLAY_LINES; i++) {
+    if (i < DISPLAY_LINES - 1)
+      display.drawString(0, DISPLAY_LINE_HEIGHT * (i + 1), labels[i]);  // the last label changes with the dwell
+    _valueX[i] = width(display, labels[i]) + width(display, " ");
+  }
+  _readyX = width(display, "Ready for: ");
+  _roleX = _valueX[1] + width(display, "down ");
+  _excessWidth[0] = width(display, "false ");
+  _excessWidth[1] = width(display, "true ");
+  for (uint8_t i = 0; i <= uint8_t(CommandSource::Count); i++)
+    _sourceWidth[i] = width(display, Arbiter::sourceName(CommandSource(i))) + width(display, " ");
+  memcpy(_labels, display.buffer, sizeof(_labels));
+}
+
+template <class Display>
+void StatusScreen<Display>::render(Display& display, const DisplayView& v) {
+  char field[16];
+  memcpy(display.buffer, _labels, sizeof(_labels));
+  if (v.source == CommandSource::Manual)
+    display.drawString(0, 0, "MANUAL OVERRIDE");
+  drawGlyphs(display, _valueX[0], 10 + DISPLAY_GLYPH_DY, formatIp(field, v.ip));
+  if (v.role) {
+    display.drawString(_valueX[1], 20, v.mqttConnected ? "up" : "down");
+    display.drawString(_roleX, 20, v.role);
+  }
+  else
+    display.drawString(_valueX[1], 20, v.mqttConnected ? "connected" : "disconnected");
+  drawGlyphs(display, _valueX[2], 30 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.mode, 1));
+  display.drawString(_valueX[3], 40, v.excess ? "true" : "false");
+  int16_t x = _valueX[3] + _excessWidth[v.excess];
+  display.drawString(x, 40, Arbiter::sourceName(v.source));
+  if (v.lease) {
+    x = drawGlyphs(display, x + _sourceWidth[uint8_t(v.source)], 40 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.lease, 0));
+    drawGlyphs(display, x, 40 + DISPLAY_GLYPH_DY, "s");
+  }
+  if (v.stateSeconds < v.dwellSeconds) {
+    display.drawString(0, 50, "Remaining:");
+    drawGlyphs(display, _valueX[4], 50 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.dwellSeconds - v.stateSeconds, 3));
+  }
+  else {  // unsigned; show how long a transition has been possible instead of wrapping
+    display.drawString(0, 50, "Ready for:");
+    drawGlyphs(display, _readyX, 50 + DISPLAY_GLYPH_DY, formatUnsigned(field, v.stateSeconds - v.dwellSeconds, 0));
+  }
+}
+
+template <class Display>
+void StatusScreen<Display>::renderText(Display& display, const DisplayView& v) {
+  char buf[100];
+  char ip[16];
+  display.clear();
+  int y = 0;
+  if (v.source == CommandSource::Manual)
+    display.drawString(0, y, "MANUAL OVERRIDE");
+  display.drawStringf(0, y+=10, buf, "WiFi: %s", formatIp(ip, v.ip));
+  if (v.role)
+    display.drawStringf(0, y+=10, buf, "MQTT: %s %s", v.mqttConnected ? "up" : "down", v.role);
+  else
+    display.drawStringf(0, y+=10, buf, "MQTT: %s", v.mqttConnected ? "connected" : "disconnected");
+  display.drawStringf(0, y+=10, buf, "SG Mode: %i", v.mode);
+  if (v.lease)
+    display.drawStringf(0, y+=10, buf, "Excess: %s %s %us", v.excess ? "true" : "false", Arbiter::sourceName(v.source), v.lease);
+  else
+    display.drawStringf(0, y+=10, buf, "Excess: %s %s", v.excess ? "true" : "false", Arbiter::sourceName(v.source));
+  if (v.stateSeconds < v.dwellSeconds)
+    display.drawStringf(0, y+=10, buf, "Remaining: %u", v.dwellSeconds - v.stateSeconds);
+  else
+    display.drawStringf(0, y+=10, buf, "Ready for: %u", v.stateSeconds - v.dwellSeconds);
+}
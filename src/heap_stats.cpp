@@ -0,0 +1,113 @@
+#include "heap_stats.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#define allocatedSize(p) heap_caps_get_allocated_size(p)
+#else
+#include <malloc.h>
+#define allocatedSize(p) malloc_usable_size(p)
+#endif
+
+static uint32_t s_allocations;
+static uint64_t s_allocatedBytes;
+
+// net bytes allocated through the wrappers, and its high-water mark since heapPeakReset()
+static int64_t s_live;
+static int64_t s_livePeak;
+static int64_t s_liveAtReset;
+static size_t s_inUseAtReset;
+static size_t s_samplePeak;
+
+void heapStatsGet(HeapStats& stats) {
+  stats.allocations = __atomic_load_n(&s_allocations, __ATOMIC_RELAXED);
+  stats.allocatedBytes = __atomic_load_n(&s_allocatedBytes, __ATOMIC_RELAXED);
+}
+
+void heapStatsReset() {
+  __atomic_store_n(&s_allocations, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&s_allocatedBytes, 0, __ATOMIC_RELAXED);
+}
+
+size_t heapInUse() {
+#ifdef ARDUINO
+  return ESP.getHeapSize() - ESP.getFreeHeap();
+#else
+  return mallinfo2().uordblks;
+#endif
+}
+
+void heapPeakReset() {
+  s_inUseAtReset = heapInUse();
+  s_samplePeak = s_inUseAtReset;
+  s_liveAtReset = __atomic_load_n(&s_live, __ATOMIC_RELAXED);
+  __atomic_store_n(&s_livePeak, s_liveAtReset, __ATOMIC_RELAXED);
+}
+
+void heapPeakSample() {
+  size_t inUse = heapInUse();
+  if (inUse > s_samplePeak)
+    s_samplePeak = inUse;
+}
+
+size_t heapPeak() {
+  int64_t livePeak = __atomic_load_n(&s_livePeak, __ATOMIC_RELAXED) - s_liveAtReset;
+  size_t tracked = s_inUseAtReset + size_t(livePeak > 0 ? livePeak : 0);
+  return tracked > s_samplePeak ? tracked : s_samplePeak;
+}
+
+#if HEAP_STATS
+
+static inline void countAllocation(size_t requested) {
+  __atomic_fetch_add(&s_allocations, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s_allocatedBytes, uint64_t(requested), __ATOMIC_RELAXED);
+}
+
+static inline void trackLive(int64_t delta) {
+  int64_t live = __atomic_add_fetch(&s_live, delta, __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&s_livePeak, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&s_livePeak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+extern "C" {
+  void* __real_malloc(size_t size);
+  void* __real_calloc(size_t n, size_t size);
+  void* __real_realloc(void* p, size_t size);
+  void __real_free(void* p);
+
+  void* __wrap_malloc(size_t size) {
+    countAllocation(size);
+    void* p = __real_malloc(size);
+    if (p)
+      trackLive(int64_t(allocatedSize(p)));
+    return p;
+  }
+
+  void* __wrap_calloc(size_t n, size_t size) {
+    countAllocation(n * size);
+    void* p = __real_calloc(n, size);
+    if (p)
+      trackLive(int64_t(allocatedSize(p)));
+    return p;
+  }
+
+  void* __wrap_realloc(void* p, size_t size) {
+    countAllocation(size);
+    int64_t before = p ? int64_t(allocatedSize(p)) : 0;
+    void* q = __real_realloc(p, size);
+    if (q)
+      trackLive(int64_t(allocatedSize(q)) - before);
+    else if (!size)
+      trackLive(-before);  // realloc(p, 0) freed p
+    return q;
+  }
+
+  void __wrap_free(void* p) {
+    if (p)
+      trackLive(-int64_t(allocatedSize(p)));
+    __real_free(p);
+  }
+}
+
+#endif
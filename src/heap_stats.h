@@ -0,0 +1,31 @@
+/*
+  Heap instrumentation for measurements.
+
+  Built with -DHEAP_STATS=1 and linked with -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+  -Wl,--wrap=free, the calls to those four functions that the final link resolves are counted:
+  the sketch, the MQTT libraries, operator new, and the parts of the Arduino core and of lwIP that
+  use the plain libc names. Allocations made with heap_caps_malloc() and friends never pass the
+  wrappers. IDF's mbedTLS port allocates that way, and so do much of IDF itself and the WiFi
+  driver. So do calls made from inside the ROM's newlib. For those, the high-water mark falls
+  back on heapInUse() and is only as good as the heapPeakSample() calls made while the measured
+  operation runs. Without HEAP_STATS the allocation counters stay at zero, and the high-water
+  mark comes from the samples alone.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct HeapStats {
+  uint32_t allocations;
+  uint64_t allocatedBytes;
+};
+
+void heapStatsGet(HeapStats& stats);
+void heapStatsReset();
+
+size_t heapInUse();     // bytes currently allocated from the default heap
+void heapPeakReset();   // start a new high-water mark at the current heapInUse()
+void heapPeakSample();  // fold the current heapInUse() into the high-water mark
+size_t heapPeak();      // highest heapInUse() since heapPeakReset()
@@ -0,0 +1,124 @@
+#include "leadership.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Leadership::Leadership()
+  : _node(), _role(LeaderRole::Starting), _changed(false), _term(0), _heard(false), _last(), _lastHeard(0),
+    _lastAck(0), _ackLost(false), _steppedDown(0), _lastSent(0), _connected(false), _connectedSince(0), _failoverMs(0) {
+}
+
+void Leadership::begin(const char* node, uint32_t now) {
+  strncpy(_node, node, sizeof(_node) - 1);
+  _role = LeaderRole::Starting;
+  _lastAck = now;
+}
+
+void Leadership::become(LeaderRole role) {
+  if (role != _role)
+    _changed = true;
+  _role = role;
+}
+
+void Leadership::receive(const LeaderHeartbeat& heartbeat, uint32_t now) {
+  if (!strcmp(heartbeat.node, _node)) {
+    // our own echo, or retained from before a restart: only its term matters
+    _term = heartbeat.term > _term ? heartbeat.term : _term;
+    return;
+  }
+
+  if (heartbeat.term < _term && _role == LeaderRole::Leader)
+    return;  // a deposed leader that has not heard us yet; it will step down when it does
+
+  if (_role == LeaderRole::Leader && heartbeat.term == _term && strcmp(heartbeat.node, _node) < 0)
+    return;  // we won the tie
+
+  _term = heartbeat.term > _term ? heartbeat.term : _term;
+  _last = heartbeat;
+  _heard = true;
+  _lastHeard = now;
+  become(LeaderRole::Standby);
+}
+
+void Leadership::acked(uint32_t at) {
+  _lastAck = at;
+  if (_ackLost && int32_t(at - _steppedDown) > 0)
+    _ackLost = false;  // the broker hears us again
+}
+
+bool Leadership::poll(uint32_t now, bool connected) {
+  if (connected && !_connected) {
+    _connectedSince = now;
+    _ackLost = false;  // a new session; the listen time below applies before any claim
+  }
+  _connected = connected;
+
+  if (_role == LeaderRole::Leader) {
+    if (now - _lastAck > LEADER_LEASE_MS - LEADER_HEARTBEAT_MS) {
+      _ackLost = true;
+      _steppedDown = now;
+      become(LeaderRole::Standby);  // the broker no longer hears us; let the other node take over
+    }
+  }
+  else if (connected && !_ackLost && now - _connectedSince >= LEADER_LISTEN_MS && (!_heard || now - _lastHeard > LEADER_LEASE_MS)) {
+    _failoverMs = _heard ? now - _lastHeard : 0;
+    _term++;
+    _lastAck = now;
+    _lastSent = now - LEADER_HEARTBEAT_MS;  // announce at once
+    become(LeaderRole::Leader);
+  }
+
+  bool changed = _changed;
+  _changed = false;
+  return changed;
+}
+
+void Leadership::heartbeat(uint8_t mode, uint32_t stateTime, LeaderHeartbeat& out, uint32_t now) {
+  memcpy(out.node, _node, sizeof(out.node));
+  out.term = _term;
+  out.mode = mode;
+  out.stateTime = stateTime;
+  _lastSent = now;
+}
+
+bool Leadership::inherited(uint32_t now, uint8_t& mode, uint32_t& stateTime) const {
+  if (!_heard)
+    return false;
+  mode = _last.mode;
+  stateTime = _last.stateTime + (now - _lastHeard) / 1000;
+  return true;
+}
+
+const char* Leadership::roleName(LeaderRole role) {
+  switch (role) {
+    case LeaderRole::Starting: return "starting";
+    case LeaderRole::Standby: return "standby";
+    case LeaderRole::Leader: return "leader";
+  }
+  return "?";
+}
+
+// "<node> <term> <mode> <state time>"
+size_t Leadership::format(const LeaderHeartbeat& heartbeat, char* buf, size_t size) {
+  int n = snprintf(buf, size, "%s %u %u %u", heartbeat.node, unsigned(heartbeat.term), unsigned(heartbeat.mode), unsigned(heartbeat.stateTime));
+  return n < 0 ? 0 : size_t(n);
+}
+
+bool Leadership::parse(const char* payload, size_t length, LeaderHeartbeat& heartbeat) {
+  char text[LEADER_HEARTBEAT_SIZE];
+  if (!length || length >= sizeof(text))
+    return false;  // an empty retained payload clears the lease topic
+  memcpy(text, payload, length);
+  text[length] = 0;
+
+  unsigned term, mode, stateTime;
+  char node[LEADER_NODE_SIZE];
+  if (sscanf(text, "%23s %u %u %u", node, &term, &mode, &stateTime) != 4 || mode > 3)
+    return false;
+  memcpy(heartbeat.node, node, sizeof(node));
+  heartbeat.term = term;
+  heartbeat.mode = mode;
+  heartbeat.stateTime = stateTime;
+  return true;
+}
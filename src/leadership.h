@@ -0,0 +1,90 @@
+/*
+  Leadership of a hot-standby pair of controllers wired to the same SG Ready input.
+
+  The leader publishes a retained heartbeat on a shared lease topic: its node id, its term, its mode
+  and the seconds it has spent in that mode. A node that hears no heartbeat from another node for
+  LEADER_LEASE_MS claims the lease with the next term, and takes over the mode and dwell of the last
+  heartbeat, so the 10 minute rule holds across a failover. When two nodes claim at once, the higher
+  term wins, then the higher node id, and the other steps down on the next heartbeat it hears.
+
+  A leader that has had none of its publishes acknowledged for LEADER_LEASE_MS - LEADER_HEARTBEAT_MS
+  releases the lease on its own. That is a heartbeat interval before the standby can take over, so
+  the two never drive the input at the same time; in between, nobody drives it. It does not claim
+  again until a publish is acknowledged after it let go or the connection is made anew: a link that
+  stays up but loses our publishes would otherwise have it claim, unheard, while the standby drives.
+
+  Portable and not thread-safe; times are milliseconds on any monotonic clock.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef LEADER_LEASE_MS
+#define LEADER_LEASE_MS 15000      // silence after which the standby takes over
+#endif
+#ifndef LEADER_HEARTBEAT_MS
+#define LEADER_HEARTBEAT_MS 3000
+#endif
+#define LEADER_LISTEN_MS (2 * LEADER_HEARTBEAT_MS)  // connected this long before a first claim, for the retained heartbeat
+#define LEADER_NODE_SIZE 24
+#define LEADER_HEARTBEAT_SIZE 64
+
+enum class LeaderRole : uint8_t {
+  Starting,  // listening for a leader
+  Standby,
+  Leader
+};
+
+struct LeaderHeartbeat {
+  char node[LEADER_NODE_SIZE];
+  uint32_t term;
+  uint8_t mode;
+  uint32_t stateTime;  // seconds in the mode when it was sent
+};
+
+class Leadership {
+ public:
+  Leadership();
+
+  void begin(const char* node, uint32_t now);
+  // a heartbeat from the lease topic, our own included
+  void receive(const LeaderHeartbeat& heartbeat, uint32_t now);
+  // the broker acknowledged one of our publishes at 'at'
+  void acked(uint32_t at);
+  // run the timeouts; true when the role changed since the last call
+  bool poll(uint32_t now, bool connected);
+
+  bool heartbeatDue(uint32_t now) const { return _role == LeaderRole::Leader && now - _lastSent >= LEADER_HEARTBEAT_MS; }
+  void heartbeat(uint8_t mode, uint32_t stateTime, LeaderHeartbeat& out, uint32_t now);
+  // the last foreign leader's mode and dwell, extrapolated to 'now'; false if none was heard
+  bool inherited(uint32_t now, uint8_t& mode, uint32_t& stateTime) const;
+
+  LeaderRole role() const { return _role; }
+  uint32_t term() const { return _term; }
+  const char* leader() const { return _role == LeaderRole::Leader ? _node : _heard ? _last.node : ""; }
+  uint32_t lastFailoverMs() const { return _failoverMs; }  // silence before our latest claim
+
+  static const char* roleName(LeaderRole role);
+  static size_t format(const LeaderHeartbeat& heartbeat, char* buf, size_t size);
+  static bool parse(const char* payload, size_t length, LeaderHeartbeat& heartbeat);
+
+ private:
+  void become(LeaderRole role);
+
+  char _node[LEADER_NODE_SIZE];
+  LeaderRole _role;
+  bool _changed;
+  uint32_t _term;          // highest term seen or claimed
+  bool _heard;             // _last is valid
+  LeaderHeartbeat _last;   // latest heartbeat of another leader
+  uint32_t _lastHeard;
+  uint32_t _lastAck;
+  bool _ackLost;           // stepped down for want of acks; no claim until one arrives or we reconnect
+  uint32_t _steppedDown;
+  uint32_t _lastSent;
+  bool _connected;
+  uint32_t _connectedSince;
+  uint32_t _failoverMs;
+};
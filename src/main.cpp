@@ -1,36 +1,89 @@
 /*
   NOTE: You must rename 'credentials_template.h' to 'credentials.h' and put in your own network credentials!
 
-  This ESP32 code controls a heat pump that supports the "Smart Grid Ready" (SG Ready) feature.
-  We only support two of the SG Ready modes:
+  This ESP32 code controls a heat pump that supports the "Smart Grid Ready" (SG Ready) feature. The
+  mode is a two bit value on two pins:
 
     mode 0: normal operation
     mode 1: electricity is free or inexpensive, use is encouraged
-
-  The SG Ready standard requires that we not change the state of the switch more often than every
-  10 minutes. In order to clearly show what is going on with the controller at any given moment,
-  we implement a device with two entities:
-
-    - A switch that controls the desired mode ("Excess": boolean, true when electricity is free/inexpensive, false otherwise)
-    - A sensor that reflects the current mode ("Mode": integer, 0 = normal operation, 1 = excess mode)
-
-  We periodically publish the sensor state in order to solicit an MQTT ACK. We use the presence of this ACK as proof
-  that the MQTT broker is still available and functioning. If we receive no ACKs after threee publishes, we consider
-  the MQTT broker offline and we:
-    - Revert the heat pump to Normal mode, obeying the state transition time requirement
-    - Ensure that the pump is in normal mode every so often as an added precaution
-  
-   This device is published to the Home Assistant MQTT discovery topic.
+    mode 2: blocked by the utility
+    mode 3: forced run
+
+  SG_PIN_LSB carries the low bit. Modes 2 and 3 need the high bit wired to SG_PIN_MSB; without it
+  the board drives modes 0 and 1 only. The SG Ready standard requires that the mode change no more
+  often than every 10 minutes (MIN_STATE_SECONDS), so a new mode waits until the dwell has passed.
+
+  Requests for a mode come from several command sources: MQTT (Home Assistant), the tariff calendar
+  (tariff.h), which turns cheap local hours into Excess requests, and the override button on the
+  board. An Arbiter (arbiter.h) picks the winner by priority. A request may carry a lease and lapses
+  on its own unless renewed, so a dead automation behind a live broker can't hold the pump. A
+  ModeQuota (mode_quota.h) then caps how long and how often a mode may be held, Block above all; a
+  verdict it turns down leaves the pump in Normal.
+
+  The pins are driven from the very first C++ constructor, before app_main() and setup(). The mode,
+  its dwell and the winning request survive warm resets in RTC memory, and OTA restarts in NVS, so
+  a crash or an update neither ends a mode early nor shortens the dwell. Display and network
+  start-up run in a background task; boot-phase timestamps are printed and published (boot_profile.h).
+
+  All of the mode state belongs to the timer task, which ticks once a second. The MQTT, HTTP, OTA
+  and button handlers hand their work to it with xTimerPendFunctionCall().
+
+  Home Assistant finds the board through MQTT discovery: the Excess switch and the Mode, Pending,
+  Transition, Source, Override and Quota sensors, plus diagnostic sensors from a TelemetryRegistry
+  (telemetry.h). A retained "offline" Last Will marks them unavailable when the board dies. States
+  are published only when they change, the mode also every keepalive interval to solicit an ack.
+  With no acks for the dead time the broker counts as lost: the MQTT request is dropped, the local
+  sources stay in force, and with none left the pins return to Normal and are re-set now and then.
+
+  The broker and up to two fallbacks form a BrokerPool (broker_pool.h); the board moves to the next
+  healthy broker when one fails and returns to the primary once it has recovered. WiFi and broker
+  settings live in NVS (config.h) and can be changed by signed updates on the config topic; firmware
+  updates come the same way on the OTA topic (ota.h).
+
+  Two boards can drive the same SG input as a hot-standby pair (SGREADY_STANDBY, leadership.h). Only
+  the leader drives its pins and publishes; the standby keeps its pins high-Z, mirrors the leader's
+  mode and dwell, and takes over with them when the heartbeats stop.
+
+  The OLED shows the state in pages (display_pages.h) under a power policy (display_power.h). The
+  same state is served over HTTP as /status.json and /metrics, and pushed over a WebSocket on /ws
+  (status_server.h).
 */
 
 #include <WiFi.h>
 extern "C" {
 	#include "freertos/FreeRTOS.h"
 	#include "freertos/timers.h"
+	#include "freertos/queue.h"
+	#include "freertos/semphr.h"
 }
+#include <driver/gpio.h>
+#include <esp_rom_gpio.h>
 
 #include <limits.h>
-#include <AsyncMqttClient.h>
+#if defined(MQTT_BACKEND_ESP_MQTT)
+#include "mqtt_esp_transport.h"
+#elif defined(MQTT_BACKEND_SOCKET)
+#include "mqtt_socket_transport.h"
+#else
+#include "mqtt_async_transport.h"
+#endif
+#include "mqtt_bench.h"
+#include "boot_profile.h"
+#include "telemetry.h"
+#include "config.h"
+#include "ota.h"
+#include "arbiter.h"
+#include "status_server.h"
+#include "leadership.h"
+#include "broker_pool.h"
+#include "wifi_roam.h"
+#include "tariff.h"
+#include "display_pages.h"
+#include "display_flush.h"
+#include "display_power.h"
+#include "override_button.h"
+#include "mode_quota.h"
+#include <Preferences.h>
 #include <ArduinoJson.h>
 
 #include <Wire.h>
@@ -40,12 +93,133 @@ extern "C" {
 
 #define REMOVE_HA_DEVICE 0  // set to 1 to erase the device added to Home Assistant
 
+#ifndef SGREADY_STANDBY
+#define SGREADY_STANDBY 0  // 1 = one board of a hot-standby pair sharing the SG input through diodes or a relay
+#endif
+
+#ifndef HA_DEVICE_DISCOVERY
+#define HA_DEVICE_DISCOVERY 1  // one device-level discovery message (HA 2024.11+); 0 = one config per entity
+#endif
+#ifndef DISCOVERY_SIZE_LOG
+#define DISCOVERY_SIZE_LOG 0   // 1 = also serialize the other discovery form on connect and log both sizes
+#endif
+
 // the defines below are not user-configurable
 #define MIN_STATE_SECONDS 600  // update the 'SG Ready' mode no more often than every 10 minutes
-#define MQTT_KEEPALIVE_INTERVAL uint32_t(MIN_STATE_SECONDS/10) // how often we send keepalive messages to the mqtt server
-#define MQTT_DEAD_TIME uint32_t(MQTT_KEEPALIVE_INTERVAL*3) // how long we go without an mqtt response before considering it offline
+#define MQTT_KEEPALIVE_INTERVAL uint32_t(MIN_STATE_SECONDS/10) // default for how often we send keepalive messages to the mqtt server
+#define MQTT_DEAD_TIME uint32_t(MQTT_KEEPALIVE_INTERVAL*3) // default for how long we go without an mqtt response before considering it offline
+
+#define MQTT_MAX_COMMAND_LENGTH 32  // longest command payload we accept
+#define MQTT_POLL_INTERVAL_MS 5     // socket backend only, it has no network task of its own
+#define STARTUP_TASK_STACK 4096     // display and network start-up
+#define DISPLAY_TASK_STACK 3072
+#define DISPLAY_I2C_ADDRESS 0x3c
+#define DISPLAY_CONTRAST 0xcf         // what the driver's init() sets
+#define DISPLAY_WAKE_PIN 0            // the BOOT button
+#define DISPLAY_WAKE_DEBOUNCE_MS 200
+#define DISCOVERY_ENTITY_DOC_SIZE 600
+#define DISCOVERY_DEVICE_DOC_SIZE 3072
+#define TELEMETRY_INTERVAL_MS 1000  // how often the telemetry sensors are evaluated
+#define MIN_VALID_EPOCH 1700000000  // anything earlier means SNTP has not synced yet
+
+#ifndef CONFIG_SECRET
+#define CONFIG_SECRET ""  // no secret, no remote configuration
+#endif
+
+#ifndef MQTT_FALLBACK
+#define MQTT_FALLBACK ""  // "host[:port],..." standby brokers
+#endif
 
-#define SG_PIN_LSB 25  // the low bit of the two digit SG Ready mode value; we never alter the high bit (pin is ok while using wifi if not software-connected to internal ADC2 circuit)
+#define WIFI_ROAM_CHECK_MS 1000
+#define WIFI_ROAM_TIMEOUT_MS 10000     // a roam that has no IP by then is abandoned
+#define WIFI_ROAM_MQTT_WINDOW_MS 5000  // an MQTT disconnect this soon after a roam counts against it
+#define WIFI_SCAN_DWELL_MS 120         // passive listen per channel
+#define CONFIG_WIFI_TRIAL_MS 120000    // WiFi settings from an update must give an IP this soon, or the old ones return
+#define CONFIG_BROKER_TRIAL_MS 180000  // broker settings from an update must get a CONNACK this long after an IP, or the old ones return
+#define OTA_PERSIST_TIMEOUT_MS 3000    // how long the OTA task waits for the timer task's state snapshot
+
+#ifndef SNTP_SERVER
+#define SNTP_SERVER "pool.ntp.org"
+#endif
+#ifndef DISPLAY_FAST_DIGITS
+#define DISPLAY_FAST_DIGITS 1  // 0 = the printf and font renderer, to compare the render cost
+#endif
+#ifndef OVERRIDE_PIN
+#define OVERRIDE_PIN 27        // override button to GND; each press: Excess, Normal, off
+#endif
+#ifndef OVERRIDE_SECONDS
+#define OVERRIDE_SECONDS 3600  // how long a manual override lasts
+#endif
+#ifndef DISPLAY_POWER_MODE
+#define DISPLAY_POWER_MODE 0  // 0 always on, 1 only redraw on change, 2 blank after DISPLAY_BLANK_SECONDS (display_power.h)
+#endif
+#ifndef DISPLAY_BLANK_SECONDS
+#define DISPLAY_BLANK_SECONDS 120  // after the last button press or mode change
+#endif
+#ifndef DISPLAY_DIM_SECONDS
+#define DISPLAY_DIM_SECONDS 0  // dim this long after the last button press or mode change, 0 = never
+#endif
+#ifndef DISPLAY_PAGE_SECONDS
+#define DISPLAY_PAGE_SECONDS 0  // turn the pages every so many seconds; 0 = only on a press of the BOOT button
+#endif
+#ifndef DISPLAY_DIM_CONTRAST
+#define DISPLAY_DIM_CONTRAST 0x08
+#endif
+#ifndef TARIFF_TZ
+#define TARIFF_TZ "UTC0"      // POSIX TZ the tariff hours are in, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+#endif
+#ifndef TARIFF_WEEK
+#define TARIFF_WEEK ""        // cheap hours (tariff.h), e.g. "Mo-Fr 0-6,22-24; Sa,Su,Ho 0-24"; empty = none
+#endif
+#ifndef TARIFF_HOLIDAYS
+#define TARIFF_HOLIDAYS ""    // "MM-DD,YYYY-MM-DD,..."
+#endif
+#define TARIFF_LEASE_GRACE 120  // seconds a cheap hour's request outlives the hour, renewed by the next one
+#define PERSISTED_STATE_MAGIC 0x53475247  // "SGRG"; change it when PersistedState changes
+
+#ifndef EXCESS_DEFAULT_LEASE
+#define EXCESS_DEFAULT_LEASE 0  // seconds an "ON" without a lease lasts; 0 = until "OFF"
+#endif
+#define EXCESS_MAX_LEASE 0x7fffffff
+#define SOURCE_PRIORITY_MQTT 50
+#define SOURCE_PRIORITY_SCHEDULE 30
+#define SOURCE_PRIORITY_MANUAL 90   // a technician on site outranks everything remote
+#define EXCESS_COMMAND_ON 0x80000000  // packs a command into the uint32_t of xTimerPendFunctionCall
+
+#ifndef BLOCK_MAX_SECONDS
+#define BLOCK_MAX_SECONDS 7200  // longest Block (mode 2), 0 = no limit
+#endif
+#ifndef BLOCK_MAX_PER_DAY
+#define BLOCK_MAX_PER_DAY 3     // Blocks started per 24 h, 0 = no limit
+#endif
+#ifndef FORCE_MAX_SECONDS
+#define FORCE_MAX_SECONDS 0     // longest forced run (mode 3), 0 = no limit
+#endif
+#ifndef FORCE_MAX_PER_DAY
+#define FORCE_MAX_PER_DAY 0
+#endif
+
+
+#if MQTT_TLS
+#if !defined(MQTT_BACKEND_SOCKET)
+#error "MQTT_TLS requires MQTT_BACKEND_SOCKET"
+#endif
+#if !defined(MQTT_TLS_PIN_SHA256) && !defined(MQTT_TLS_CA_PEM)
+#error "MQTT_TLS needs MQTT_TLS_PIN_SHA256 and/or MQTT_TLS_CA_PEM in credentials.h"
+#endif
+#ifndef MQTT_TLS_PIN_SHA256
+#define MQTT_TLS_PIN_SHA256 nullptr
+#endif
+#ifndef MQTT_TLS_CA_PEM
+#define MQTT_TLS_CA_PEM nullptr
+#endif
+#endif
+
+#define SG_PIN_LSB 25  // the low bit of the two digit SG Ready mode value (pin is ok while using wifi if not software-connected to internal ADC2 circuit)
+#ifndef SG_PIN_MSB
+#define SG_PIN_MSB -1  // the high bit, for Block (2) and forced run (3); -1 = not wired, only modes 0 and 1
+#endif
+#define SG_DRIVEN_MODES (SG_PIN_MSB >= 0 ? 4 : 2)
 
 #define OLED_HEIGHT 64
 #define OLED_WIDTH 128
@@ -57,48 +231,606 @@ const char*         g_manufacturer = "Bud Millwood";    // Manufacturer Name
 const char*         g_deviceName = "SGReady";           // Device Name
 const char*         g_excessName = "Excess";            // Excess entity switch
 const char*         g_modeName = "Mode";                // SG Ready mode state
-bool                g_excess = false;                   // true = electricity overproduction / use encouraged, false = normal operation
+const char*         g_pendingName = "Pending";          // mode waiting for the dwell time to pass
+const char*         g_transitionName = "Transition";    // when the next transition becomes possible
+const char*         g_sourceName = "Source";            // command source currently deciding the mode
+const char*         g_overrideName = "Override";        // the manual override: off, excess or normal
+const char*         g_quotaName = "Quota";              // why the pins don't follow the arbiter, or "none"
+Arbiter             g_arbiter;                          // requests from all command sources; timer task only
+TariffCalendar      g_tariff;                           // timer task only, after setup()
+bool                g_tariffCheap = false;
+int                 g_tariffHour = -1;                  // local hour of the latest Schedule request
+bool                g_excess = false;                   // the arbiter's verdict: true = electricity overproduction / use encouraged, false = normal operation
+int                 g_targetMode = 0;                   // where the pins go once the dwell allows: the arbiter's mode if the quota admits it, else Normal
+ModeQuota           g_quota(SG_DRIVEN_MODES);           // timer task only
+QuotaVerdict        g_quotaVerdict = QuotaVerdict::Allowed;
+uint8_t             g_quotaMode = 0;                    // the mode g_quotaVerdict is about
+CommandSource       g_restoredSource = CommandSource::Count;  // the winning request when the state was restored, handed to the arbiter by setup()
+uint8_t             g_restoredRequest = 0;              // its mode
+uint32_t            g_restoredLease = 0;                // and the lease it had left, 0 = none
+bool                g_restoredLeader = false;           // the board drove the pins before the reset; a standby must not
+CommandSource       g_publishedSource = CommandSource::Count;
+bool                g_sourcePublished = false;          // g_publishedSource is valid on this connection
 int                 g_currentMode = 0;                  // current SG Ready mode
 uint32_t            g_mqttLastResponseTime = 0;             // set to g_currentStateTime when mqtt responds
 uint32_t            g_currentStateTime = 0;          // number of seconds we have been in the current state; unsigned is very important for wrap-around behavior!
-
-AsyncMqttClient mqttClient;
+uint32_t            g_uptimeSeconds = 0;                // seconds since boot, counted by the countdown timer
+uint32_t            g_pinsSetMicros = 0;                // micros() of the latest pin change by setPins()
+volatile bool       g_displayReady = false;             // set by the startup task once the display is initialized
+int                 g_publishedPending = INT_MIN;       // last published pending mode, INT_MIN = nothing published on this connection
+int                 g_publishedOverride = -1;           // last published override state, -1 = nothing published on this connection
+int                 g_publishedQuota = -1;              // last published refusal, mode << 4 | verdict, -1 = nothing published on this connection
+time_t              g_publishedTransition = 0;          // last published transition time, 0 = nothing published on this connection
+
+// survives warm resets (software, panic, watchdog); garbage after power-on, which the check catches
+struct PersistedState {
+  uint32_t magic;
+  uint32_t mode;
+  uint32_t stateTime;
+  uint32_t source;          // the winning CommandSource, Count = no live request
+  uint32_t request;         // its mode, which the pins may not have reached yet
+  uint32_t leaseRemaining;  // seconds left on its lease, 0 = none
+  uint32_t leader;          // 1 if this board drove the pins, 0 for a standby mirroring the leader
+  uint32_t check;  // ~(magic ^ mode ^ stateTime ^ source ^ request ^ leaseRemaining ^ leader)
+};
+RTC_NOINIT_ATTR PersistedState g_persisted;
+bool                g_stateRestored = false;            // mode and dwell came from before the reset
+
+#if defined(MQTT_BACKEND_ESP_MQTT)
+MqttEspTransport mqttTransport;
+#elif defined(MQTT_BACKEND_SOCKET)
+MqttSocketTransport mqttTransport;
+#else
+MqttAsyncTransport mqttTransport;
+#endif
+MqttTransport& mqttClient = mqttTransport;  // all MQTT traffic goes through the transport interface
 TimerHandle_t mqttReconnectTimer;
 TimerHandle_t wifiReconnectTimer;
 TimerHandle_t countdownTimer;
+TimerHandle_t telemetryTimer;
+TimerHandle_t mqttConnectTimer;  // one connect timeout, then the next broker
+TimerHandle_t wifiRoamTimer;
+
+#ifdef WIFI_ROAM_NETWORKS
+struct RoamNetwork { const char* ssid; const char* pass; const char* bssid; };
+const RoamNetwork g_roamNetworks[] = { WIFI_ROAM_NETWORKS };
+#endif
 
-SSD1306  display(0x3c, 5, 4);
-static char display_buf[100];
+struct RoamStats {
+  uint32_t roams;
+  uint32_t failures;
+  uint32_t lastMillis;   // begin() to IP
+  uint32_t totalMillis;
+  uint32_t mqttDrops;    // MQTT disconnects during or shortly after a roam
+};
+WifiRoamer g_roamer;             // timer task only, after setup()
+RoamStats g_roamStats;
+volatile bool g_roaming = false;  // between WiFi.begin() on the new AP and its IP
+uint32_t g_roamStart = 0;
+volatile uint32_t g_roamEnd = 0;  // millis() of the latest roam's IP
+uint8_t g_joinBssid[6];           // the AP of the latest join or roam by BSSID
+bool g_joinTargeted = false;      // g_joinBssid is valid
+uint32_t g_joinStart = 0;
+uint8_t g_avoidBssid[6];          // an AP whose join gave no IP, skipped until one does
+bool g_avoid = false;
+
+BrokerPool g_brokers;            // timer task only
+size_t g_broker = 0;             // the broker of the current or latest connection
+bool g_mqttConnecting = false;   // a connect is in flight
+bool g_mqttWaited = false;       // the reconnect timer already waited out a backoff
+bool g_mqttSessionUp = false;
+uint32_t g_mqttSessionStart = 0;
+uint32_t g_mqttLostAt = 0;       // millis() when the last healthy broker went away, 0 = never
+
+TelemetryRegistry g_telemetry;
+StatusServer g_statusServer;  // /metrics and /status.json, rendered by the timer task
+
+volatile uint32_t g_lastAckMillis = 0;  // millis() of the latest PUBACK
+
+#if SGREADY_STANDBY
+struct ReceivedHeartbeat {
+  LeaderHeartbeat heartbeat;
+  uint32_t at;  // millis() on arrival
+};
+Leadership g_leadership;       // timer task only
+QueueHandle_t g_heartbeats;    // ReceivedHeartbeat, from the MQTT task to the timer task
+#endif
 
+// whether this board publishes the device's state; only the leader of a standby pair does
+bool leading() {
+#if SGREADY_STANDBY
+  return g_leadership.role() == LeaderRole::Leader;
+#else
+  return true;
+#endif
+}
+SgConfig g_config;  // loaded from NVS in setup(), fallback from credentials.h; written by the timer task only
+bool g_configFromNvs = false;
+SgConfig g_wifiPrevious;          // the settings an update replaced, while its WiFi settings are on trial
+bool g_wifiTrial = false;
+uint32_t g_wifiTrialStart = 0;
+uint32_t g_wifiRevertedSeq = 0;   // the update whose WiFi settings were rolled back, 0 = none
+SgConfig g_brokerPrevious;        // likewise for broker settings, on trial until a CONNACK
+bool g_brokerTrial = false;
+uint32_t g_brokerTrialStart = 0;
+uint32_t g_brokerRevertedSeq = 0;
+volatile uint32_t g_wifiIpAt = 0; // millis() of the latest IP
+
+float sampleRssi() { return WiFi.isConnected() ? float(WiFi.RSSI()) : NAN; }
+float sampleFreeHeap() { return float(ESP.getFreeHeap()); }
+float sampleUptime() { return float(g_uptimeSeconds); }
+
+//                                 key        name         unit   device class        state class         diag  prec  deadband  min ms   max ms
+const TelemetrySensor g_telemetrySensors[] = {
+  { "rssi",   "WiFi signal", "dBm", "signal_strength", "measurement",      true, 0,    3,        10000,   600000,  sampleRssi },
+  { "heap",   "Free heap",   "B",   nullptr,           "measurement",      true, 0,    4096,     30000,   600000,  sampleFreeHeap },
+  { "uptime", "Uptime",      "s",   "duration",        "total_increasing", true, 0,    3600,     60000,   0,       sampleUptime },
+};
+
+struct OverrideStats {
+  uint32_t lastDispatchMicros;  // edge to the debounced press in the timer task
+  uint32_t maxDispatchMicros;
+  uint32_t switches;            // presses that moved the pins at once; the rest waited for the dwell
+  uint32_t lastPinMicros;       // edge to the pin change
+  uint32_t minPinMicros;
+  uint32_t maxPinMicros;
+};
+OverrideStats g_overrideStats;
+EdgeQueue g_overrideQueue;         // override ISR to timer task
+ButtonDebouncer g_overrideButton;  // timer task only
+
+SSD1306  display(DISPLAY_I2C_ADDRESS, 5, 4);  // drawn into by the display task only
+
+struct DisplayStats {
+  uint32_t frames;
+  uint32_t lastRenderMicros;       // building the frame in RAM
+  uint32_t maxRenderMicros;
+  uint64_t totalRenderMicros;
+  uint32_t lastFlushMicros;        // first to last transaction of a frame
+  uint32_t maxFlushMicros;
+  uint32_t maxTransactionMicros;   // the longest the display task held the bus at once
+  uint32_t lastCallerMicros;       // DrawDisplay(), on the caller's task
+  uint32_t maxCallerMicros;
+  uint64_t busBytes;               // everything sent to the panel, address bytes included
+};
+DisplayStats g_displayStats;
+
+DisplayPages<SSD1306> g_displayPages;  // display task only
+DisplayPager g_displayPager(DISPLAY_PAGE_SECONDS * 1000);  // display task only
+DisplayPage g_displayPage = DisplayPage::Status;           // the page of the latest frame
+DisplayFlush g_displayFlush;           // display task only
+QueueHandle_t g_displayViews;          // the newest DisplayView, for the display task
+DisplayPower g_displayPower(DisplayPowerMode(DISPLAY_POWER_MODE), DISPLAY_BLANK_SECONDS * 1000, DISPLAY_DIM_SECONDS * 1000,
+  DISPLAY_CONTRAST, DISPLAY_DIM_CONTRAST);  // display task only
+volatile uint32_t g_displayWakes;      // presses of the wake button, counted by its ISR
+volatile uint32_t g_displayWakeMillis;
+
+/* Timer task only, as the view reads the arbiter and the broker list. Takes a snapshot of what
+   the screen shows and leaves the rendering and the I2C transfer to the display task, so the
+   caller never waits for the bus and never shares it.
+*/
 void DrawDisplay() {
-  display.clear();
-  int y = 0;
-  display.drawStringf(0, y+=10, display_buf, "WiFi: %s", WiFi.isConnected() ? WiFi.localIP().toString().c_str() : "0.0.0.0");
-  display.drawStringf(0, y+=10, display_buf, "MQTT: %s", mqttClient.connected() ? "connected" : "disconnected");
-  display.drawStringf(0, y+=10, display_buf, "SG Mode: %i",g_currentMode);
-  display.drawStringf(0, y+=10, display_buf, "Excess: %s",g_excess ? "true" : "false");
-  display.drawStringf(0, y+=10, display_buf, "Remaining: %i",MIN_STATE_SECONDS-g_currentStateTime);
-  display.display();
+  if (!g_displayReady)
+    return;
+
+  uint32_t start = micros();
+  DisplayView v;
+  v.ip = WiFi.isConnected() ? uint32_t(WiFi.localIP()) : 0;
+  v.mqttConnected = mqttClient.connected();
+#if SGREADY_STANDBY
+  v.role = Leadership::roleName(g_leadership.role());
+#else
+  v.role = nullptr;
+#endif
+  v.mode = g_currentMode;
+  v.excess = g_excess;
+  v.source = g_arbiter.winner();
+  v.lease = g_arbiter.hasWinner() ? g_arbiter.remaining(g_arbiter.winner(), g_uptimeSeconds) : 0;
+  v.stateSeconds = g_currentStateTime;
+  v.dwellSeconds = MIN_STATE_SECONDS;
+  v.wakes = g_displayWakes;
+  v.rssi = v.ip ? int8_t(WiFi.RSSI()) : 0;
+  v.broker = uint8_t(g_broker);
+  const MqttStats& m = mqttClient.stats();
+  v.rttMicros = m.lastRttMicros;
+  v.rttAvgMicros = m.acks ? uint32_t(m.totalRttMicros / m.acks) : 0;
+  v.mqttDrops = m.disconnects;
+  v.uptime = g_uptimeSeconds;
+  xQueueOverwrite(g_displayViews, &v);  // a view the task hasn't picked up yet is out of date anyway
+
+  DisplayStats& d = g_displayStats;
+  d.lastCallerMicros = micros() - start;
+  d.maxCallerMicros = max(d.maxCallerMicros, d.lastCallerMicros);
 }
 
+// timer task, pended by the wake button's ISR: a fresh view carries the press to the display task
+void displayWoken(void*, uint32_t) {
+  DrawDisplay();
+}
+
+void IRAM_ATTR displayWakeISR() {
+  uint32_t now = millis();
+  if (now - g_displayWakeMillis < DISPLAY_WAKE_DEBOUNCE_MS)
+    return;
+  g_displayWakeMillis = now;
+  g_displayWakes = g_displayWakes + 1;
+  BaseType_t woken = pdFALSE;
+  xTimerPendFunctionCallFromISR(displayWoken, nullptr, 0, &woken);
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+// display task only
+void displaySend(const uint8_t* transaction, size_t length) {
+  uint32_t start = micros();
+  Wire.beginTransmission(DISPLAY_I2C_ADDRESS);
+  Wire.write(transaction, length);
+  Wire.endTransmission();
+  DisplayStats& d = g_displayStats;
+  d.maxTransactionMicros = max(d.maxTransactionMicros, uint32_t(micros() - start));
+  d.busBytes += 1 + length;
+}
+
+// display task: samples the history and picks the page; true if the view should be rendered
+bool displayWanted(const DisplayView& v, DisplayPanel panel) {
+  uint32_t now = millis();
+  bool charted = g_displayPages.chart().sample(v);
+  DisplayPage page = g_displayPager.select(v, now, panel);
+  bool wanted = g_displayPower.view(v, now);
+  if (!wanted && (page != g_displayPage || (charted && page == DisplayPage::History)))
+    wanted = g_displayPower.panel(now) != DisplayPanel::Off;  // a new page or chart column is a change too
+  if (wanted)
+    g_displayPage = page;
+  return wanted;
+}
+
+/* Renders the newest view and sends what changed, one short transaction at a time (display_flush.h).
+   Between transactions it picks up a newer view, so a burst of updates costs one transfer. The
+   power policy (display_power.h) decides which views are sent and dims or blanks the panel; while
+   it is off, the task sleeps on the queue and the bus stays quiet.
+*/
+void displayTask(void*) {
+  DisplayStats& d = g_displayStats;
+  DisplayView v;
+  uint8_t transaction[DISPLAY_FLUSH_MAX_TRANSACTION];
+  uint32_t frameStart = 0;
+  DisplayPanel panel = DisplayPanel::Bright;  // as init() left it
+  g_displayPower.begin(millis());
+  for (;;) {
+    TickType_t wait = portMAX_DELAY;
+    uint32_t idle = g_displayPower.idle(millis());
+    if (g_displayFlush.busy() && panel != DisplayPanel::Off)
+      wait = 0;
+    else if (idle != DISPLAY_POWER_NEVER)
+      wait = pdMS_TO_TICKS(idle) + 1;
+    if (xQueueReceive(g_displayViews, &v, wait) == pdTRUE && displayWanted(v, panel)) {
+      uint32_t start = micros();
+#if DISPLAY_FAST_DIGITS
+      g_displayPages.render(display, g_displayPage, v);
+#else
+      g_displayPages.renderText(display, g_displayPage, v);
+#endif
+      uint32_t rendered = micros();
+      d.frames++;
+      d.lastRenderMicros = rendered - start;
+      d.maxRenderMicros = max(d.maxRenderMicros, d.lastRenderMicros);
+      d.totalRenderMicros += d.lastRenderMicros;
+      if (!g_displayFlush.busy() || panel == DisplayPanel::Off)
+        frameStart = rendered;  // a superseded frame's time counts towards the one that replaces it
+      g_displayFlush.start(display.buffer);
+    }
+
+    DisplayPanel next = g_displayPower.panel(millis());
+    if (next != panel) {
+      displaySend(transaction, g_displayPower.command(next, transaction));
+      panel = next;
+    }
+    if (panel == DisplayPanel::Off)
+      continue;  // the panel keeps its memory; the rest of the frame goes out on the next wake
+
+    size_t n = g_displayFlush.next(transaction);
+    if (!n)
+      continue;
+    displaySend(transaction, n);
+    if (!g_displayFlush.busy()) {
+      uint32_t now = micros();
+      d.lastFlushMicros = now - frameStart;
+      d.maxFlushMicros = max(d.maxFlushMicros, d.lastFlushMicros);
+    }
+  }
+}
+
+// remember an AP we join by BSSID, so a join that gives no IP can be kept from repeating
+void joiningBssid(const uint8_t* bssid, uint32_t now) {
+  memcpy(g_joinBssid, bssid, sizeof(g_joinBssid));
+  g_joinTargeted = true;
+  g_joinStart = now;
+}
+
+/* The strongest AP of the latest scans, on its channel, or else the configured SSID wherever it
+   is. No scans run while disconnected, so an AP that died stays the strongest sighting until it
+   ages out; the AP of a join or roam that gave no IP is skipped until an IP comes from another.
+*/
 void connectToWifi() {
   Serial.println("Connecting to Wi-Fi...");
   DrawDisplay();
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  g_roaming = false;
+  uint32_t now = millis();
+  if (int32_t(g_wifiIpAt - g_joinStart) >= 0)
+    g_avoid = false;  // the latest join worked
+  else if (g_joinTargeted) {
+    memcpy(g_avoidBssid, g_joinBssid, sizeof(g_avoidBssid));
+    g_avoid = true;
+  }
+  g_joinTargeted = false;
+  g_joinStart = now;
+
+  const WifiSighting* ap = g_roamer.best(now, g_avoid ? g_avoidBssid : nullptr);
+  if (!ap) {
+    WiFi.begin(g_config.wifiSsid, g_config.wifiPass);  // the driver scans and picks an AP itself
+    return;
+  }
+  joiningBssid(ap->bssid, now);
+  const WifiNetwork& n = g_roamer.network(ap->network);
+  Serial.printf("Joining %s at %02x:%02x:%02x:%02x:%02x:%02x, channel %u, %d dBm.\n", n.ssid,
+    ap->bssid[0], ap->bssid[1], ap->bssid[2], ap->bssid[3], ap->bssid[4], ap->bssid[5], ap->channel, ap->rssi);
+  WiFi.begin(n.ssid, n.pass, ap->channel, ap->bssid);
+}
+
+// the configured SSID plus WIFI_ROAM_NETWORKS; the scan cache starts over
+void configureWifi() {
+  g_roamer.clear();
+  g_roamer.addNetwork(g_config.wifiSsid, g_config.wifiPass, nullptr);
+#ifdef WIFI_ROAM_NETWORKS
+  for (const RoamNetwork& n : g_roamNetworks)
+    if (!g_roamer.addNetwork(n.ssid, n.pass, n.bssid))
+      Serial.printf("Error: Invalid roaming network '%s'.\n", n.ssid);
+#endif
+}
+
+// timer task; the results of the background scan started by wifiRoamTick()
+void wifiScanDone(void*, uint32_t) {
+  int16_t count = WiFi.scanComplete();
+  if (count < 0)
+    return;
+  uint32_t now = millis();
+  for (int16_t i = 0; i < count; i++)
+    g_roamer.sighting(WiFi.SSID(i).c_str(), WiFi.BSSID(i), WiFi.RSSI(i), WiFi.channel(i), now);
+  WiFi.scanDelete();
+  Serial.printf("WiFi scan: %d access points, %u usable.\n", count, unsigned(g_roamer.fresh(now)));
+}
+
+// timer task, every WIFI_ROAM_CHECK_MS; scans in the background and roams away from a weak AP
+void wifiRoamTick() {
+  uint32_t now = millis();
+  if (g_roaming) {
+    if (now - g_roamStart >= WIFI_ROAM_TIMEOUT_MS) {
+      g_roamStats.failures++;
+      Serial.println("Error: Roam timed out, reconnecting.");
+      g_roaming = false;
+      WiFi.disconnect();  // the disconnect event starts over with the usual reconnect
+    }
+    return;
+  }
+  if (!WiFi.isConnected() || WiFi.scanComplete() == WIFI_SCAN_RUNNING)
+    return;
+
+  int rssi = WiFi.RSSI();
+  if (g_roamer.scanDue(now, rssi)) {
+    WiFi.scanNetworks(true, false, true, WIFI_SCAN_DWELL_MS);  // async and passive: no probe requests, no blocking
+    g_roamer.scanStarted(now);
+    return;
+  }
+
+  const WifiSighting* ap = g_roamer.poll(rssi, WiFi.BSSID(), now);
+  if (!ap)
+    return;
+  const WifiNetwork& n = g_roamer.network(ap->network);
+  Serial.printf("Roaming from %d dBm to %s at %02x:%02x:%02x:%02x:%02x:%02x, channel %u, %d dBm.\n", rssi, n.ssid,
+    ap->bssid[0], ap->bssid[1], ap->bssid[2], ap->bssid[3], ap->bssid[4], ap->bssid[5], ap->channel, ap->rssi);
+  g_roaming = true;
+  g_roamStart = now;
+  joiningBssid(ap->bssid, now);
+  WiFi.begin(n.ssid, n.pass, ap->channel, ap->bssid);  // leaves the current AP without the usual disconnect handling
 }
 
+// timer task; picks the broker, or waits for the first one out of its backoff
 void connectToMqtt() {
-  Serial.println("Connecting to MQTT...");
+  if (g_mqttConnecting || mqttClient.connected())
+    return;
+
+  uint32_t now = millis();
+  g_broker = g_brokers.select(now);
+  uint32_t wait = g_brokers.wait(g_broker, now);
+  if (wait && !g_mqttWaited) {
+    g_mqttWaited = true;
+    xTimerChangePeriod(mqttReconnectTimer, pdMS_TO_TICKS(wait), 0);  // also starts it
+    return;
+  }
+  g_mqttWaited = false;
+
+  const BrokerHealth& broker = g_brokers.broker(g_broker);
+  Serial.printf("Connecting to MQTT %s:%u (score %u)...\n", broker.host, broker.port, g_brokers.health(g_broker, now));
   DrawDisplay();
+  g_brokers.attempt(g_broker);
+  g_mqttConnecting = true;
+  mqttClient.setServer(broker.host, broker.port);
+  mqttBenchBeforeConnect();
+  xTimerStart(mqttConnectTimer, 0);
   mqttClient.connect();
 }
 
+// no CONNACK within one timeout: give up on this broker and try the next
+void mqttConnectTimeout() {
+  if (!g_mqttConnecting || mqttClient.connected())
+    return;
+  Serial.printf("Error: MQTT broker %s did not answer within %u ms.\n", g_brokers.broker(g_broker).host, BROKER_CONNECT_TIMEOUT_MS);
+  if (WiFi.isConnected())
+    g_brokers.failed(g_broker, millis());
+  if (!g_mqttLostAt)
+    g_mqttLostAt = millis();
+  g_mqttConnecting = false;  // the disconnect this causes is already accounted for
+  mqttClient.disconnect();
+  connectToMqtt();
+}
+
+// leave a broker that takes our publishes but no longer acknowledges them
+void mqttAbandonBroker(const char* why) {
+  Serial.printf("Leaving MQTT broker %s: %s.\n", g_brokers.broker(g_broker).host, why);
+  g_mqttSessionUp = false;  // the disconnect this causes is already accounted for
+  g_mqttLostAt = millis();
+  mqttClient.disconnect();
+  xTimerChangePeriod(mqttReconnectTimer, pdMS_TO_TICKS(100), 0);
+}
+
+void connectToMqttPended(void*, uint32_t) {
+  connectToMqtt();
+}
+
+void connectToWifiPended(void*, uint32_t) {
+  connectToWifi();
+}
+
+/* Clear before set, and the high bit last: a switch between modes 1 and 2, or to and from 3,
+   passes through Normal or Excess for the microsecond between the writes, never through Block.
+*/
+void writeModePins(int mode) {
+#if SG_PIN_MSB >= 0
+  if (!(mode & 2))
+    digitalWrite(SG_PIN_MSB, LOW);
+#endif
+  digitalWrite(SG_PIN_LSB, mode & 1 ? HIGH : LOW);
+#if SG_PIN_MSB >= 0
+  if (mode & 2)
+    digitalWrite(SG_PIN_MSB, HIGH);
+#endif
+}
+
 void setPins() {
+  writeModePins(g_currentMode);
+  g_pinsSetMicros = micros();
   Serial.printf("Setting pins for mode %i.\n",g_currentMode);
-  digitalWrite(SG_PIN_LSB, g_currentMode ? HIGH : LOW);
 }
 
-String uniqueID(AsyncMqttClient& c) {
+// the priority a source's requests are made with; 0 for the sources nothing feeds yet
+uint8_t sourcePriority(CommandSource source) {
+  switch (source) {
+    case CommandSource::Mqtt:     return SOURCE_PRIORITY_MQTT;
+    case CommandSource::Schedule: return SOURCE_PRIORITY_SCHEDULE;
+    case CommandSource::Manual:   return SOURCE_PRIORITY_MANUAL;
+    default:                      return 0;
+  }
+}
+
+/* Keeps the winning request with its own source and lease, so a button override or a cheap hour is
+   restored as what it was, and lapses when it would have, rather than turning into an MQTT request.
+   A request whose lease ran out but that expire() has not yet dropped is not kept.
+*/
+void persistState() {
+  CommandSource source = g_arbiter.winner();
+  uint32_t lease = 0;
+  if (source != CommandSource::Count) {
+    lease = g_arbiter.remaining(source, g_uptimeSeconds);
+    if (!lease && g_arbiter.request(source).expiry != ARBITER_NO_EXPIRY)
+      source = CommandSource::Count;
+  }
+
+  PersistedState& p = g_persisted;
+  p.magic = PERSISTED_STATE_MAGIC;
+  p.mode = g_currentMode;
+  p.stateTime = g_currentStateTime;
+  p.source = uint32_t(source);
+  p.request = source != CommandSource::Count ? g_arbiter.request(source).mode : 0;
+  p.leaseRemaining = source != CommandSource::Count ? lease : 0;
+  p.leader = leading();
+  p.check = ~(p.magic ^ p.mode ^ p.stateTime ^ p.source ^ p.request ^ p.leaseRemaining ^ p.leader);
+}
+
+bool restoreState() {
+  const PersistedState& p = g_persisted;
+  if (p.magic != PERSISTED_STATE_MAGIC || p.check != ~(p.magic ^ p.mode ^ p.stateTime ^ p.source ^ p.request ^ p.leaseRemaining ^ p.leader) ||
+      p.mode >= SG_DRIVEN_MODES || p.source > uint32_t(CommandSource::Count) || p.request >= SG_DRIVEN_MODES || p.leader > 1)
+    return false;
+
+  g_currentMode = p.mode;
+  g_targetMode = p.mode;  // keep what was last asked for until the broker says otherwise, or the lease runs out
+  g_excess = p.mode == 1;
+  g_restoredSource = CommandSource(p.source);  // the arbiter may not be constructed yet
+  g_restoredRequest = p.request;
+  g_restoredLease = p.leaseRemaining;
+  g_restoredLeader = p.leader;
+  g_currentStateTime = p.stateTime;
+  g_mqttLastResponseTime = p.stateTime;  // the dead time counts from this boot
+  return true;
+}
+
+// for restarts into an image whose RTC layout may differ (OTA); read back once by setup(); timer task only
+void persistStateToNvs(void* done, uint32_t) {
+  persistState();
+  Preferences prefs;
+  if (prefs.begin("sgready", false)) {
+    prefs.putBytes("state", &g_persisted, sizeof(g_persisted));
+    prefs.end();
+  }
+  xSemaphoreGive(static_cast<SemaphoreHandle_t>(done));
+}
+
+/* The OTA task's hook before ESP.restart(): the state belongs to the timer task, so the snapshot is
+   taken there and the OTA task waits for it. After a timeout the semaphore is left alone, as the
+   pended call may still give it; the restart follows anyway.
+*/
+void persistStateBeforeRestart() {
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  if (!done || xTimerPendFunctionCall(persistStateToNvs, done, 0, pdMS_TO_TICKS(1000)) != pdPASS ||
+      xSemaphoreTake(done, pdMS_TO_TICKS(OTA_PERSIST_TIMEOUT_MS)) != pdTRUE) {
+    Serial.println("Error: State not saved to NVS before the restart.");
+    return;
+  }
+  vSemaphoreDelete(done);
+}
+
+// 'apply' is false when RTC memory already gave us the state, which is newer by the restart delay
+bool restoreStateFromNvs(bool apply) {
+  Preferences prefs;
+  if (!prefs.begin("sgready", false))
+    return false;
+  PersistedState saved;
+  bool found = prefs.getBytesLength("state") == sizeof(saved) && prefs.getBytes("state", &saved, sizeof(saved)) == sizeof(saved);
+  if (found)
+    prefs.remove("state");  // one-shot, a later power-on must start in Normal mode
+  prefs.end();
+
+  if (!found || !apply)
+    return false;
+  g_persisted = saved;
+  return restoreState();
+}
+
+/* Runs from the C++ constructors, before app_main() and long before setup(): only register writes,
+   so the pin floats for little more than the ROM and bootloader time. The output latch is written
+   before the driver is enabled so the pin never glitches to the wrong level.
+*/
+__attribute__((constructor(101))) static void earlyPinsSafe() {
+  bootMark(BootPhase::AppStart);
+  g_stateRestored = restoreState();
+#if SGREADY_STANDBY
+  if (!g_stateRestored || !g_restoredLeader) {  // stay high-Z until we know whether the other board leads
+    bootMark(BootPhase::PinsSafe);
+    return;
+  }
+#endif
+  gpio_set_level(gpio_num_t(SG_PIN_LSB), g_currentMode & 1);
+  esp_rom_gpio_pad_select_gpio(SG_PIN_LSB);
+  gpio_set_direction(gpio_num_t(SG_PIN_LSB), GPIO_MODE_OUTPUT);
+#if SG_PIN_MSB >= 0
+  gpio_set_level(gpio_num_t(SG_PIN_MSB), (g_currentMode >> 1) & 1);
+  esp_rom_gpio_pad_select_gpio(SG_PIN_MSB);
+  gpio_set_direction(gpio_num_t(SG_PIN_MSB), GPIO_MODE_OUTPUT);
+#endif
+  bootMark(BootPhase::PinsSafe);
+}
+
+String uniqueID(MqttTransport& c) {
 //  auto s = String(c.getClientId());
 //  s.replace('-','_');
 //  return s;
@@ -110,41 +842,464 @@ String entityTopic(String name)
   return uniqueID(mqttClient) + "_" + name;
 }
 
-// publish the control switch state
+// shared by all entities: "online" while connected, "offline" from the broker's Last Will
+String availabilityTopic()
+{
+  return uniqueID(mqttClient) + "/availability";
+}
+
+void mqttPublishOnline() {
+  mqttClient.publish(availabilityTopic().c_str(), 1, true, "online");
+}
+
+// publish the control switch state: what Home Assistant asked for, which another source may override
 void mqttPublishExcess() {
-  Serial.printf("Publishing excess '%s'.\n",g_excess ? "ON":"OFF");
+  if (!leading())
+    return;
+  const ArbiterRequest& r = g_arbiter.request(CommandSource::Mqtt);
+  bool on = r.active && r.mode == 1;
+  Serial.printf("Publishing excess '%s'.\n",on ? "ON":"OFF");
   auto topic = entityTopic(g_excessName) + "/state";
-  mqttClient.publish(topic.c_str(), 1, true, g_excess ? "ON" : "OFF");
+  mqttClient.publish(topic.c_str(), 1, true, on ? "ON" : "OFF");
+}
+
+// publish the winning command source if it changed
+void mqttPublishSource() {
+  if ((g_sourcePublished && g_arbiter.winner() == g_publishedSource) || !mqttClient.connected() || !leading())
+    return;
+
+  const char* name = Arbiter::sourceName(g_arbiter.winner());
+  Serial.printf("Publishing source '%s'.\n",name);
+  auto topic = entityTopic(g_sourceName) + "/state";
+  if (mqttClient.publish(topic.c_str(), 1, true, name)) {
+    g_publishedSource = g_arbiter.winner();
+    g_sourcePublished = true;
+  }
 }
 
 // publish the current SG Ready mode
 void mqttPublishMode() {
+  if (!leading())
+    return;
   Serial.printf("Publishing mode %i.\n",g_currentMode);
   auto topic = entityTopic(g_modeName) + "/state";
   mqttClient.publish(topic.c_str(), 1, true, String(g_currentMode).c_str());
 }
 
+// -1 while the requested mode is the current mode
+int pendingMode() {
+  return g_targetMode != g_currentMode ? g_targetMode : -1;
+}
+
+// publish the pending mode if it changed since the last publish
+void mqttPublishPending() {
+  int pending = pendingMode();
+  if (pending == g_publishedPending || !mqttClient.connected() || !leading())
+    return;
+
+  Serial.printf("Publishing pending mode %i.\n",pending);
+  auto topic = entityTopic(g_pendingName) + "/state";
+  if (mqttClient.publish(topic.c_str(), 1, true, pending < 0 ? "none" : String(pending).c_str()))
+    g_publishedPending = pending;
+}
+
+// 0 = no manual override, 1 = Excess, 2 = Normal
+int overrideState() {
+  const ArbiterRequest& r = g_arbiter.request(CommandSource::Manual);
+  return r.active ? (r.mode ? 1 : 2) : 0;
+}
+
+// publish the manual override if it changed since the last publish
+void mqttPublishOverride() {
+  int state = overrideState();
+  if (state == g_publishedOverride || !mqttClient.connected() || !leading())
+    return;
+
+  static const char* const names[] = { "off", "excess", "normal" };
+  Serial.printf("Publishing override '%s'.\n", names[state]);
+  auto topic = entityTopic(g_overrideName) + "/state";
+  if (mqttClient.publish(topic.c_str(), 1, true, names[state]))
+    g_publishedOverride = state;
+}
+
+// publish why the pins don't follow the arbiter, if that changed since the last publish
+void mqttPublishQuota() {
+  bool refused = g_quotaVerdict != QuotaVerdict::Allowed;
+  int state = refused ? g_quotaMode << 4 | int(g_quotaVerdict) : 0;
+  if (state == g_publishedQuota || !mqttClient.connected() || !leading())
+    return;
+
+  char reason[32];
+  if (refused)
+    snprintf(reason, sizeof(reason), "mode %u: %s", g_quotaMode, ModeQuota::verdictName(g_quotaVerdict));
+  else
+    strlcpy(reason, "none", sizeof(reason));
+  Serial.printf("Publishing quota '%s'.\n", reason);
+  auto topic = entityTopic(g_quotaName) + "/state";
+  if (mqttClient.publish(topic.c_str(), 1, true, reason))
+    g_publishedQuota = state;
+}
+
+// publish when the next transition becomes possible; constant between transitions, and needs SNTP time
+void mqttPublishTransition() {
+  time_t now = time(nullptr);
+  if (now < MIN_VALID_EPOCH || !mqttClient.connected() || !leading())
+    return;
+
+  time_t at = now - time_t(g_currentStateTime) + MIN_STATE_SECONDS;
+  if (g_publishedTransition && abs(long(at - g_publishedTransition)) <= 2)  // tick jitter, not a transition
+    return;
+
+  struct tm utc;
+  gmtime_r(&at, &utc);
+  char iso[32];
+  strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%S+00:00", &utc);
+  Serial.printf("Publishing transition possible at %s.\n",iso);
+  auto topic = entityTopic(g_transitionName) + "/state";
+  if (mqttClient.publish(topic.c_str(), 1, true, iso))
+    g_publishedTransition = at;
+}
+
+// what DrawDisplay() shows plus the counters, for the HTTP endpoints; they re-render if the state changed or were requested
+void updateStatus() {
+  StatusSnapshot s;
+  memset(&s, 0, sizeof(s));  // compared bytewise, padding included
+  const MqttStats& m = mqttClient.stats();
+  s.ip = WiFi.isConnected() ? uint32_t(WiFi.localIP()) : 0;
+  s.rssi = s.ip ? WiFi.RSSI() : 0;
+  s.wifiRoams = g_roamStats.roams;
+  s.wifiRoamMillis = g_roamStats.lastMillis;
+  s.wifiRoamMqttDrops = g_roamStats.mqttDrops;
+  s.mqttConnected = mqttClient.connected();
+  s.mqttAlive = s.mqttConnected && g_currentStateTime - g_mqttLastResponseTime <= g_config.deadTime;
+  s.mode = g_currentMode;
+  s.excess = g_excess;
+  s.pending = pendingMode();
+  s.source = uint8_t(g_arbiter.winner());
+  s.stateSeconds = g_currentStateTime;
+  s.remainingSeconds = g_currentStateTime < MIN_STATE_SECONDS ? MIN_STATE_SECONDS - g_currentStateTime : 0;
+  s.leaseSeconds = g_arbiter.hasWinner() ? g_arbiter.remaining(g_arbiter.winner(), g_uptimeSeconds) : 0;
+  s.mqttSilentSeconds = g_currentStateTime - g_mqttLastResponseTime;
+  s.uptimeSeconds = g_uptimeSeconds;
+  s.freeHeap = ESP.getFreeHeap();
+  s.mqttConnects = m.connects;
+  s.mqttDisconnects = m.disconnects;
+  s.mqttPublishes = m.publishes;
+  s.mqttAcks = m.acks;
+  s.mqttRttLastMicros = m.lastRttMicros;
+  s.mqttRttAvgMicros = m.acks ? uint32_t(m.totalRttMicros / m.acks) : 0;
+  s.mqttConnectMicros = m.lastConnectMicros;
+  s.telemetryPublished = g_telemetry.stats().published;
+  s.bootPinsMicros = bootMicros(BootPhase::PinsSafe);
+  s.bootWifiMicros = bootMicros(BootPhase::WifiUp);
+  s.bootMqttMicros = bootMicros(BootPhase::MqttUp);
+  g_statusServer.update(s);
+}
+
+/* Timer task, after every arbitration and on every tick: the arbiter's verdict becomes the target
+   mode if the quota admits it, and Normal otherwise. A refusal is logged and published once.
+*/
+void applyQuota() {
+  uint8_t mode = g_arbiter.mode();
+  QuotaVerdict verdict = g_quota.admit(mode, g_uptimeSeconds);
+  int target = verdict == QuotaVerdict::Allowed ? mode : 0;
+  if (verdict != QuotaVerdict::Allowed && (verdict != g_quotaVerdict || mode != g_quotaMode))
+    Serial.printf("Mode %u refused (%s): %u started in 24 h, %u s into the current run.\n", mode,
+      ModeQuota::verdictName(verdict), g_quota.starts(mode, g_uptimeSeconds), g_quota.running(g_uptimeSeconds));
+  g_quotaVerdict = verdict;
+  g_quotaMode = mode;
+  mqttPublishQuota();
+  if (target != g_targetMode) {
+    g_targetMode = target;
+    mqttPublishPending();
+  }
+}
+
+// take the arbiter's verdict after a request changed or expired; timer task only
+void arbitrate() {
+  g_excess = g_arbiter.mode() == 1;
+  applyQuota();
+  mqttPublishSource();
+  mqttPublishPending();
+  mqttPublishOverride();
+  DrawDisplay();
+  updateStatus();
+}
+
+/* Timer task, every tick. A cheap tariff hour is an Excess request from the Schedule source, made
+   the moment the hour starts and renewed by every further cheap hour. The lease runs out shortly
+   after the hour, so a clock that stops advancing cannot hold the request.
+*/
+void updateTariff() {
+  time_t now = time(nullptr);
+  if (now < MIN_VALID_EPOCH || g_tariff.empty())
+    return;
+
+  struct tm local;
+  localtime_r(&now, &local);
+  bool cheap = g_tariff.cheap(local);
+  if (cheap == g_tariffCheap && (!cheap || local.tm_hour == g_tariffHour))
+    return;
+
+  if (cheap != g_tariffCheap)
+    Serial.printf("Tariff %s from %02d:%02d:%02d%s.\n", cheap ? "cheap" : "normal", local.tm_hour, local.tm_min, local.tm_sec,
+      g_tariff.holiday(local) ? " (holiday)" : "");
+  g_tariffCheap = cheap;
+  g_tariffHour = local.tm_hour;
+  bool changed = cheap
+    ? g_arbiter.set(CommandSource::Schedule, 1, SOURCE_PRIORITY_SCHEDULE, 3600 - local.tm_min*60 - local.tm_sec + TARIFF_LEASE_GRACE, g_uptimeSeconds)
+    : g_arbiter.clear(CommandSource::Schedule, g_uptimeSeconds);
+  if (changed) {
+    arbitrate();
+    mqttPublishExcess();
+  }
+}
+
+String configTopic()
+{
+  return uniqueID(mqttClient) + "/config";
+}
+
+// the active configuration without the secrets, so the fleet can be audited
+void mqttPublishConfig() {
+  if (!leading())
+    return;
+  StaticJsonDocument<512> jdoc;
+  jdoc["seq"] = g_config.seq;
+  jdoc["source"] = g_configFromNvs ? "nvs" : "default";
+  jdoc["wifi_ssid"] = g_config.wifiSsid;
+  jdoc["mqtt_host"] = g_config.mqttHost;
+  jdoc["mqtt_port"] = g_config.mqttPort;
+  jdoc["mqtt_user"] = g_config.mqttUser;
+  jdoc["mqtt_fallback"] = g_config.mqttFallback;
+  jdoc["keepalive"] = g_config.keepAliveInterval;
+  jdoc["dead_time"] = g_config.deadTime;
+  if (g_wifiRevertedSeq)
+    jdoc["wifi_reverted"] = g_wifiRevertedSeq;
+  if (g_brokerRevertedSeq)
+    jdoc["broker_reverted"] = g_brokerRevertedSeq;
+  String payload;
+  serializeJson(jdoc, payload);
+  mqttClient.publish(configTopic().c_str(), 1, true, payload.c_str());
+}
+
+// boot phase timestamps, published once per boot
+void mqttPublishBootProfile() {
+  char json[192];
+  bootProfileJson(json, sizeof(json));
+  Serial.printf("Boot profile: %s\n", json);
+  auto topic = entityTopic("boot") + "/state";
+  mqttClient.publish(topic.c_str(), 1, true, json);
+}
+
+// one line of transport figures: connect time, publish-to-ack RTT and ack count; timer task only, as it reads the quota
+void mqttLogStats() {
+  const MqttStats& s = mqttClient.stats();
+  uint32_t avgRtt = s.acks ? uint32_t(s.totalRttMicros / s.acks) : 0;
+  Serial.printf("MQTT %s: connect %u ms, rtt last/min/avg/max %u/%u/%u/%u us, %u/%u acked, %u reconnects.\n",
+    mqttClient.name(), s.lastConnectMicros/1000, s.lastRttMicros, s.acks ? s.minRttMicros : 0, avgRtt, s.maxRttMicros,
+    s.acks, s.publishes, s.connects ? s.connects-1 : 0);
+  const RoamStats& r = g_roamStats;
+  Serial.printf("WiFi: %u roams, last/avg %u/%u ms, %u failed, %u MQTT disconnects while roaming.\n",
+    r.roams, r.lastMillis, r.roams ? r.totalMillis / r.roams : 0, r.failures, r.mqttDrops);
+  const ButtonStats& b = g_overrideButton.stats();
+  const OverrideStats& o = g_overrideStats;
+  Serial.printf("Override button: %u presses, %u edges (%u bounces, %u dropped), press to task last/max %u/%u us, "
+    "press to pin last/min/max %u/%u/%u us over %u switches.\n", b.presses, b.edges, b.bounces, g_overrideQueue.dropped(),
+    o.lastDispatchMicros, o.maxDispatchMicros, o.lastPinMicros, o.minPinMicros, o.maxPinMicros, o.switches);
+  const QuotaStats& q = g_quota.stats();
+  Serial.printf("Quota: Block %u of %u started in 24 h, %u runs, %u cut at their longest, %u refusals.\n",
+    g_quota.starts(2, g_uptimeSeconds), g_quota.limit(2).maxStarts, q.starts, q.cuts, q.refusals);
+  const DisplayStats& d = g_displayStats;
+  const DisplayFlushStats& f = g_displayFlush.stats();
+  Serial.printf("Display: %u frames (%u unchanged, %u superseded), render last/avg/max %u/%u/%u us, flush last/max %u/%u us, "
+    "I2C %u transactions %u B, bus held max %u us, callers blocked last/max %u/%u us.\n", d.frames, f.unchanged, f.superseded,
+    d.lastRenderMicros, d.frames ? uint32_t(d.totalRenderMicros / d.frames) : 0, d.maxRenderMicros, d.lastFlushMicros, d.maxFlushMicros,
+    f.transactions, f.bytes, d.maxTransactionMicros, d.lastCallerMicros, d.maxCallerMicros);
+  const DisplayPowerStats& p = g_displayPower.stats();
+  uint64_t panelMillis = max(uint64_t(1), p.brightMillis + p.dimMillis + p.offMillis);
+  Serial.printf("Display power: %s, bright/dim/off %u/%u/%u%%, %u wakes, %u blanks, %u of %u views skipped, I2C %u B/day.\n",
+    DisplayPower::modeName(g_displayPower.mode()), unsigned(p.brightMillis * 100 / panelMillis), unsigned(p.dimMillis * 100 / panelMillis),
+    unsigned(p.offMillis * 100 / panelMillis), p.wakes, p.blanks, p.skipped, p.views, unsigned(d.busBytes * 86400000 / max(1ul, millis())));
+  const TelemetryStats& ts = g_telemetry.stats();
+  Serial.printf("Telemetry: %u published, %u samples inside the deadband.\n", ts.published, ts.suppressed);
+  const StatusServerStats& h = g_statusServer.stats();
+  Serial.printf("Status server: %u requests, %u renders, render last/max %u/%u us, %u WebSocket clients, %u pushes.\n",
+    h.requests, h.renders, h.lastRenderMicros, h.maxRenderMicros, h.pushClients, h.pushes);
+#if MQTT_TLS
+  const MqttTlsStats& t = mqttTransport.tlsStats();
+  Serial.printf("MQTT TLS: last %s %u ms, full %u x avg %u ms peak %u B, resumed %u x avg %u ms peak %u B, %u failed.\n",
+    t.lastResumed ? "resumed" : "full", t.lastHandshakeMicros/1000,
+    t.fullHandshakes, t.fullHandshakes ? uint32_t(t.fullMicrosTotal/1000/t.fullHandshakes) : 0, t.fullPeakHeap,
+    t.resumedHandshakes, t.resumedHandshakes ? uint32_t(t.resumedMicrosTotal/1000/t.resumedHandshakes) : 0, t.resumedPeakHeap,
+    t.failedHandshakes);
+#endif
+}
+
+// every state topic, for a new connection or a new leader; timer task only
+void mqttPublishStates() {
+  mqttPublishExcess();
+  mqttPublishMode();
+  g_publishedPending = INT_MIN;  // publish again
+  mqttPublishPending();
+  g_publishedOverride = -1;
+  mqttPublishOverride();
+  g_publishedQuota = -1;
+  mqttPublishQuota();
+  g_publishedTransition = 0;
+  mqttPublishTransition();
+  g_sourcePublished = false;
+  mqttPublishSource();
+  g_telemetry.republishAll();  // states follow on the next telemetry poll
+}
+
+#if SGREADY_STANDBY
+String leaderTopic()
+{
+  return uniqueID(mqttClient) + "/leader";
+}
+
+// mode and dwell for the standby to take over, retained so a restarted standby sees them at once
+void mqttPublishHeartbeat() {
+  LeaderHeartbeat heartbeat;
+  char payload[LEADER_HEARTBEAT_SIZE];
+  g_leadership.heartbeat(g_currentMode, g_currentStateTime, heartbeat, millis());
+  Leadership::format(heartbeat, payload, sizeof(payload));
+  mqttClient.publish(leaderTopic().c_str(), 1, true, payload);
+}
+
+// take over the other board's mode and dwell, or hand the input to it
+void applyRole() {
+  LeaderRole role = g_leadership.role();
+  Serial.printf("Leadership: %s, term %u, leader '%s'.\n", Leadership::roleName(role), g_leadership.term(), g_leadership.leader());
+  if (role != LeaderRole::Leader) {
+    pinMode(SG_PIN_LSB, INPUT);  // high-Z, the leader drives the input
+#if SG_PIN_MSB >= 0
+    pinMode(SG_PIN_MSB, INPUT);
+#endif
+    return;
+  }
+
+  uint8_t mode;
+  uint32_t stateTime;
+  if (g_leadership.inherited(millis(), mode, stateTime)) {
+    g_currentMode = mode;
+    g_currentStateTime = stateTime;
+  }
+  g_mqttLastResponseTime = g_currentStateTime;  // the dead time counts from the takeover
+  Serial.printf("Took over after %u ms without a heartbeat: mode %i, %u s into the state.\n",
+    g_leadership.lastFailoverMs(), g_currentMode, g_currentStateTime);
+  g_quota.entered(g_currentMode, g_uptimeSeconds, g_currentStateTime);  // the other board's counts are lost; its run counts as a start
+  applyQuota();
+  persistState();
+  setPins();  // latch first, so enabling the output can't glitch
+  pinMode(SG_PIN_LSB, OUTPUT);
+#if SG_PIN_MSB >= 0
+  pinMode(SG_PIN_MSB, OUTPUT);
+#endif
+  mqttPublishOnline();
+  mqttPublishStates();
+}
+
+// run the lease; false while this board does not lead, and then only mirror the leader's state
+bool updateLeadership() {
+  ReceivedHeartbeat received;
+  while (xQueueReceive(g_heartbeats, &received, 0) == pdTRUE)
+    g_leadership.receive(received.heartbeat, received.at);
+  g_leadership.acked(g_lastAckMillis);
+
+  uint32_t now = millis();
+  if (g_leadership.poll(now, mqttClient.connected()))
+    applyRole();
+
+  if (g_leadership.role() == LeaderRole::Leader) {
+    if (g_leadership.heartbeatDue(now))
+      mqttPublishHeartbeat();
+    return true;
+  }
+
+  uint8_t mode;
+  uint32_t stateTime;
+  if (g_leadership.inherited(now, mode, stateTime)) {
+    g_currentMode = mode;
+    g_currentStateTime = stateTime;
+  }
+  else
+    ++g_currentStateTime;  // starting up; keep the dwell restored from RTC memory running
+  persistState();
+  DrawDisplay();
+  updateStatus();
+  return false;
+}
+#endif
+
+void switchMode();
+void overrideEdges(void*, uint32_t);
+void wifiTrialTick();
+void brokerTrialTick();
+void saveConfig();
+
 // auto-restarting countdown timer has expired
 void updateMode() {
+  overrideEdges(nullptr, 0);  // in case the ISR's pended call didn't fit in the timer queue
+  wifiTrialTick();
+  brokerTrialTick();
+
+  g_uptimeSeconds++;
+
+  // unrenewed leases lapse; one comparison per tick however many requests are outstanding
+  if (g_arbiter.expire(g_uptimeSeconds)) {
+    Serial.printf("Request expired, now mode %i from source '%s'.\n", g_arbiter.mode(), Arbiter::sourceName(g_arbiter.winner()));
+    arbitrate();
+    mqttPublishExcess();
+  }
+  updateTariff();
+  applyQuota();  // a run reaches its longest time, or the window forgets an old start
+
+#if SGREADY_STANDBY
+  if (!updateLeadership())
+    return;
+#endif
+
   DrawDisplay();
+  updateStatus();
 
   // solicit keep-alive by publishing our mode
-  if (g_currentStateTime % MQTT_KEEPALIVE_INTERVAL == 0)
+  if (g_currentStateTime % g_config.keepAliveInterval == 0) {
     mqttPublishMode();
+    mqttLogStats();
+
+    uint32_t now = millis();
+    uint32_t stall = 2000*g_config.keepAliveInterval;  // well before the dead time drops the MQTT request
+    if (g_mqttSessionUp && mqttClient.connected()) {
+      if (now - g_lastAckMillis > stall && now - g_mqttSessionStart > stall) {
+        g_brokers.failed(g_broker, now);
+        mqttAbandonBroker("no acknowledgements");
+      }
+      else if (g_brokers.preferred(g_broker, now) != g_broker)
+        mqttAbandonBroker("an earlier broker has recovered");
+    }
+  }
+
+  if (!g_publishedTransition)
+    mqttPublishTransition();  // SNTP may have synced since the last try
 
   // stay in the current state for at least 10 minutes
-  if (++g_currentStateTime < MIN_STATE_SECONDS)
+  ++g_currentStateTime;
+  persistState();
+  if (g_currentStateTime < MIN_STATE_SECONDS)
     return;
 
   // how long since we last heard an ACK from the MQTT server?
   uint32_t mqttDiff = g_currentStateTime - g_mqttLastResponseTime;
 
-  if (mqttDiff > MQTT_DEAD_TIME) {  // if no mqtt response for this long it's dead
-    if (g_excess) {
-      Serial.printf("No MQTT response received in %u seconds, reverting to normal mode.\n",mqttDiff);
-      g_excess = false;
+  if (mqttDiff > g_config.deadTime) {  // if no mqtt response for this long it's dead
+    if (g_arbiter.request(CommandSource::Mqtt).active) {  // local sources remain valid
+      Serial.printf("No MQTT response received in %u seconds, dropping the MQTT request.\n",mqttDiff);
+      g_arbiter.clear(CommandSource::Mqtt, g_uptimeSeconds);
+      arbitrate();
     }
-    else {  // ensure our pins are in normal mode every so often as an added precaution
+    else if (!g_targetMode) {  // ensure our pins are in normal mode every so often as an added precaution
       if (g_currentStateTime % 30 == 0) {
         Serial.print("Paranoid pin set: ");
         setPins();  // paranoid set pins
@@ -153,16 +1308,76 @@ void updateMode() {
     }
   }
 
-  // do nothing if no state change requested
-  if (g_currentMode == g_excess)
+  switchMode();
+}
+
+// move the pins to the arbiter's verdict; timer task only, once the dwell has passed
+void switchMode() {
+  if (g_currentMode == g_targetMode)
     return;
 
   g_currentStateTime = 0;
-  g_currentMode = g_excess;
+  g_currentMode = g_targetMode;
+  g_quota.entered(g_currentMode, g_uptimeSeconds);
+  persistState();
   setPins();
   mqttPublishMode();
   mqttPublishExcess();
+  mqttPublishPending();
+  mqttPublishTransition();
+#if SGREADY_STANDBY
+  mqttPublishHeartbeat();  // the standby mirrors the new mode at once
+#endif
   DrawDisplay();
+  updateStatus();
+}
+
+void IRAM_ATTR overrideISR() {
+  bool idle = g_overrideQueue.empty();
+  if (!g_overrideQueue.push({ uint32_t(micros()), gpio_get_level(gpio_num_t(OVERRIDE_PIN)) != 0 }) || !idle)
+    return;  // a call is already pending for the edges before this one
+  BaseType_t woken = pdFALSE;
+  xTimerPendFunctionCallFromISR(overrideEdges, nullptr, 0, &woken);
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+/* Timer task: debounce the queued edges. Each press moves the manual override on, from none to
+   Excess to Normal and back to none, and the pins follow at once unless the dwell holds them.
+*/
+void overrideEdges(void*, uint32_t) {
+  ButtonEdge edge;
+  while (g_overrideQueue.pop(edge)) {
+    if (!g_overrideButton.edge(edge))
+      continue;
+
+    OverrideStats& o = g_overrideStats;
+    o.lastDispatchMicros = micros() - edge.micros;
+    o.maxDispatchMicros = max(o.maxDispatchMicros, o.lastDispatchMicros);
+    int state = (overrideState() + 1) % 3;
+    Serial.printf("Override button: %s.\n", state == 1 ? "Excess" : state == 2 ? "Normal" : "off");
+    if (state)
+      g_arbiter.set(CommandSource::Manual, state == 1, SOURCE_PRIORITY_MANUAL, OVERRIDE_SECONDS, g_uptimeSeconds);
+    else
+      g_arbiter.clear(CommandSource::Manual, g_uptimeSeconds);
+    arbitrate();
+
+    int mode = g_currentMode;
+    if (leading() && g_currentStateTime >= MIN_STATE_SECONDS)
+      switchMode();
+    if (g_currentMode != mode) {
+      o.switches++;
+      o.lastPinMicros = g_pinsSetMicros - edge.micros;
+      o.minPinMicros = o.switches == 1 ? o.lastPinMicros : min(o.minPinMicros, o.lastPinMicros);
+      o.maxPinMicros = max(o.maxPinMicros, o.lastPinMicros);
+    }
+  }
+}
+
+// the one scheduler job for all telemetry sensors
+void pollTelemetry() {
+  if (leading())
+    g_telemetry.poll(mqttClient, millis());
 }
 
 void WiFiEvent(WiFiEvent_t event) {
@@ -170,18 +1385,35 @@ void WiFiEvent(WiFiEvent_t event) {
     case SYSTEM_EVENT_STA_GOT_IP:
       Serial.print("WiFi connected: ");
       Serial.println(WiFi.localIP());
-      connectToMqtt();
+      bootMark(BootPhase::WifiUp);
+      g_wifiIpAt = millis();
+      if (g_roaming) {
+        g_roamEnd = millis();
+        g_roamStats.lastMillis = g_roamEnd - g_roamStart;
+        g_roamStats.totalMillis += g_roamStats.lastMillis;
+        g_roamStats.roams++;
+        g_roaming = false;
+        Serial.printf("Roamed in %u ms.\n", g_roamStats.lastMillis);
+      }
+      xTimerPendFunctionCall(connectToMqttPended, nullptr, 0, pdMS_TO_TICKS(100));  // the broker list belongs to the timer task
     break;
 
     case SYSTEM_EVENT_STA_DISCONNECTED:
+      if (g_roaming) {  // leaving the old AP, or a failed attempt on the new one; wifiRoamTick() times it out
+        Serial.println("WiFi disconnected while roaming");
+        break;
+      }
       Serial.println("WiFi disconnected");
       WiFi.disconnect();  // clear everything, this is important because otherwise we can fail to reconnect using stale data
       xTimerStop(mqttReconnectTimer, 0); // ensure we don't reconnect to MQTT while reconnecting to Wi-Fi
       xTimerStart(wifiReconnectTimer, 0);
     break;
 
-    case SYSTEM_EVENT_WIFI_READY:
     case SYSTEM_EVENT_SCAN_DONE:
+      xTimerPendFunctionCall(wifiScanDone, nullptr, 0, pdMS_TO_TICKS(100));  // the scan cache belongs to the timer task
+    break;
+
+    case SYSTEM_EVENT_WIFI_READY:
     case SYSTEM_EVENT_STA_START:
     case SYSTEM_EVENT_STA_STOP:
     case SYSTEM_EVENT_AP_STA_GOT_IP6: // we don't yet require ipv6
@@ -201,7 +1433,100 @@ void WiFiEvent(WiFiEvent_t event) {
 /* Device: SG Ready
    Entities: Excess (Control switch)
              Mode (Heat Pump SG Mode)
+             Pending (mode waiting for the dwell time)
+             Source (command source that currently decides the mode)
+             Transition (timestamp at which a transition becomes possible)
+             Override (the manual override button)
+             Quota (why the quota keeps the pins from the requested mode)
+             telemetry sensors (g_telemetrySensors)
+
+   With HA_DEVICE_DISCOVERY the whole device goes out as one homeassistant/device/<id>/config
+   message; otherwise each entity gets its own config with a copy of the device block. Both are
+   generated from the same component list, using abbreviated keys.
 */
+struct DiscoveryComponent {
+  const char* platform;    // "switch", "sensor"
+  const char* name;
+  String objectId;         // legacy topic homeassistant/<platform>/<objectId>/config
+  int telemetry;           // index into g_telemetry, -1 for the built-in entities
+};
+
+void describeComponent(const DiscoveryComponent& c, JsonObject cfg) {
+  if (c.telemetry >= 0) {
+    g_telemetry.writeDiscovery(c.telemetry, cfg);
+    return;
+  }
+
+  const char* name = c.name;
+  cfg["name"] = name;
+  cfg["uniq_id"] = name == g_modeName ? String("enum") : entityTopic(name);  // keep the ids HA already knows
+  cfg["stat_t"] = entityTopic(name) + "/state";
+  if (name == g_excessName) {
+    cfg["dev_cla"] = "switch";
+    cfg["cmd_t"] = entityTopic(name) + "/set";
+  }
+  if (name == g_transitionName)
+    cfg["dev_cla"] = "timestamp";
+}
+
+void addDiscoveryDevice(JsonObject root) {
+  JsonObject device = root.createNestedObject("dev");
+  device["name"] = g_deviceName;
+  device["mdl"] = g_deviceModel;
+  device["sw"] = g_swVersion;
+  device["mf"] = g_manufacturer;
+  device.createNestedArray("ids").add(uniqueID(mqttClient));
+}
+
+size_t discoveryComponents(DiscoveryComponent* list, size_t max) {
+  size_t n = 0;
+  list[n++] = { "switch", g_excessName, entityTopic("excess"), -1 };
+  list[n++] = { "sensor", g_modeName, entityTopic("mode"), -1 };
+  list[n++] = { "sensor", g_pendingName, entityTopic("pending"), -1 };
+  list[n++] = { "sensor", g_transitionName, entityTopic("transition"), -1 };
+  list[n++] = { "sensor", g_sourceName, entityTopic("source"), -1 };
+  list[n++] = { "sensor", g_overrideName, entityTopic("override"), -1 };
+  list[n++] = { "sensor", g_quotaName, entityTopic("quota"), -1 };
+  for (size_t i = 0; i < g_telemetry.count() && n < max; i++)
+    list[n++] = { "sensor", g_telemetry.sensor(i).name, entityTopic(g_telemetry.sensor(i).key), int(i) };
+  return n;
+}
+
+String legacyDiscoveryTopic(const DiscoveryComponent& c) {
+  return String("homeassistant/") + c.platform + "/" + c.objectId + "/config";
+}
+
+// one retained config per entity, each with its own device block
+void serializeLegacyDiscovery(const DiscoveryComponent& c, String& payload) {
+  DynamicJsonDocument jdoc(DISCOVERY_ENTITY_DOC_SIZE);
+  JsonObject cfg = jdoc.to<JsonObject>();
+  describeComponent(c, cfg);
+  cfg["avty_t"] = availabilityTopic();
+  addDiscoveryDevice(cfg);
+  serializeJson(jdoc, payload);
+}
+
+// the device, its origin and all components in a single retained config
+void serializeDeviceDiscovery(const DiscoveryComponent* list, size_t n, String& payload) {
+  DynamicJsonDocument jdoc(DISCOVERY_DEVICE_DOC_SIZE);
+  JsonObject root = jdoc.to<JsonObject>();
+  addDiscoveryDevice(root);
+  JsonObject origin = root.createNestedObject("o");
+  origin["name"] = "sgready";
+  origin["sw"] = g_swVersion;
+  origin["url"] = "https://github.com/velvet-jones/sgready";
+  root["avty_t"] = availabilityTopic();  // shared by all components
+  JsonObject cmps = root.createNestedObject("cmps");
+  for (size_t i = 0; i < n; i++) {
+    JsonObject cfg = cmps.createNestedObject(list[i].objectId);
+    cfg["p"] = list[i].platform;
+    describeComponent(list[i], cfg);
+  }
+  if (jdoc.overflowed())
+    Serial.println("Error: Home Assistant discovery document too small.");
+  serializeJson(jdoc, payload);
+}
+
 void mqttHomeAssistantDiscovery()
 {
   if(!mqttClient.connected())
@@ -210,82 +1535,145 @@ void mqttHomeAssistantDiscovery()
     return;
   }
 
-  StaticJsonDocument<600> jdoc;
-  JsonObject device;
-  JsonArray identifiers;
-  String excessPayload,modePayload;
+  DiscoveryComponent list[7 + TELEMETRY_MAX_SENSORS];
+  size_t n = discoveryComponents(list, sizeof(list)/sizeof(list[0]));
 
-  // excess switch, json configuration
-  jdoc["name"] = g_excessName;
-  jdoc["uniq_id"] = entityTopic(g_excessName);
-  jdoc["dev_cla"] = "switch";
-  jdoc["state_topic"] = entityTopic(g_excessName) + "/state";
-  jdoc["command_topic"] = entityTopic(g_excessName) + "/set";
-//        jdoc["availability_topic"] = entityTopic(g_excessName) + "/available";
-  device = jdoc.createNestedObject("device");
-  device["name"] = g_deviceName;
-  device["model"] = g_deviceModel;
-  device["sw_version"] = g_swVersion;
-  device["manufacturer"] = g_manufacturer;
-  identifiers = device.createNestedArray("identifiers");
-  identifiers.add(uniqueID(mqttClient));
-
-//  Serial.println("Excess config");
-//  serializeJsonPretty(jdoc,Serial);
-  serializeJson(jdoc, excessPayload);
-
-  jdoc.clear();
-
-  // mode sensor, json configuration
-  jdoc["name"] = g_modeName;
-  jdoc["uniq_id"] = "enum";
-  jdoc["state_topic"] = entityTopic(g_modeName) + "/state";
-//        jdoc["availability_topic"] = entityTopic(g_modeName) + "/available";
-  device = jdoc.createNestedObject("device");
-  device["name"] = g_deviceName;
-  device["model"] = g_deviceModel;
-  device["sw_version"] = g_swVersion;
-  device["manufacturer"] = g_manufacturer;
-  identifiers = device.createNestedArray("identifiers");
-  identifiers.add(uniqueID(mqttClient));
+  String devicePayload;
+  String deviceTopic = String("homeassistant/device/") + uniqueID(mqttClient) + "/config";
+#if HA_DEVICE_DISCOVERY || DISCOVERY_SIZE_LOG
+  serializeDeviceDiscovery(list, n, devicePayload);
+#endif
+#if DISCOVERY_SIZE_LOG
+  // measure both forms so the saving is visible in the log
+  size_t legacyBytes = 0;
+  for (size_t i = 0; i < n; i++) {
+    String payload;
+    serializeLegacyDiscovery(list[i], payload);
+    legacyBytes += legacyDiscoveryTopic(list[i]).length() + payload.length();
+  }
+  Serial.printf("Discovery: %u components, per-entity %u bytes in %u messages, device %u bytes in 1 message.\n",
+    unsigned(n), unsigned(legacyBytes), unsigned(n), unsigned(deviceTopic.length() + devicePayload.length()));
+#endif
 
-//  Serial.println("Mode config");
-//  serializeJsonPretty(jdoc,Serial);
-  serializeJson(jdoc, modePayload);
+  Serial.println("Sending Home Assistant Discovery...");
 
+#if HA_DEVICE_DISCOVERY
+  /* Move entities created by per-entity discovery over to the device config without losing them:
+     HA's documented migration is "migrate_discovery" on the old topics, the new config, then empty
+     retained payloads on the old topics. Once per board: the flag in NVS survives reboots, and the
+     old topics stay empty afterwards.
+  */
+  Preferences prefs;
+  bool migrated = prefs.begin("sgready", false) && prefs.getBool("ha_migrated", false);
+  if (!migrated)
+    for (size_t i = 0; i < n; i++)
+      mqttClient.publish(legacyDiscoveryTopic(list[i]).c_str(), 1, true, "{\"migrate_discovery\":true}");
 #if REMOVE_HA_DEVICE
-  excessPayload = "";
-  modePayload = "";
+  devicePayload = "";
+#endif
+  mqttClient.publish(deviceTopic.c_str(), 1, true, devicePayload.c_str());
+  if (!migrated) {
+    for (size_t i = 0; i < n; i++)
+      mqttClient.publish(legacyDiscoveryTopic(list[i]).c_str(), 1, true, "");
+    prefs.putBool("ha_migrated", true);
+  }
+  prefs.end();
+#else
+  for (size_t i = 0; i < n; i++) {
+    String payload;
+#if !REMOVE_HA_DEVICE
+    serializeLegacyDiscovery(list[i], payload);
+#endif
+    mqttClient.publish(legacyDiscoveryTopic(list[i]).c_str(), 1, true, payload.c_str());
+  }
 #endif
 
-  Serial.println("Sending Home Assistant Discovery...");
+  mqttPublishStates();
 
-  auto topic = String("homeassistant/switch/") + entityTopic("excess") + "/config";
-  mqttClient.publish(topic.c_str(), 1, true, excessPayload.c_str());
-  mqttPublishExcess();
+  if (!bootComplete()) {
+    bootMark(BootPhase::DiscoveryDone);
+    mqttPublishBootProfile();
+  }
+}
 
-  topic = String("homeassistant/sensor/") + entityTopic("mode") + "/config";
-  mqttClient.publish(topic.c_str(), 1, true, modePayload.c_str());
-  mqttPublishMode();
+// timer task, like the rest of the broker bookkeeping
+void brokerConnected(void*, uint32_t) {
+  xTimerStop(mqttConnectTimer, 0);
+  uint32_t now = millis();
+  g_brokers.connected(g_broker, now);
+  g_mqttConnecting = false;
+  g_mqttSessionUp = true;
+  g_mqttSessionStart = now;
+  g_lastAckMillis = now;
+  const BrokerHealth& broker = g_brokers.broker(g_broker);
+  if (g_mqttLostAt)
+    Serial.printf("MQTT healthy on %s:%u %u ms after losing the previous broker.\n", broker.host, broker.port, now - g_mqttLostAt);
+  g_mqttLostAt = 0;
+  if (g_brokerTrial) {
+    g_brokerTrial = false;
+    saveConfig();
+    Serial.printf("Broker settings of update %u confirmed.\n", g_config.seq);
+  }
+
+  // discovery and the state replay read and reset state that belongs to this task
+  mqttLogStats();
+  if (leading()) {
+    mqttPublishOnline();
+    mqttHomeAssistantDiscovery();
+  }
+  mqttPublishConfig();
+  DrawDisplay();
+}
+
+void brokerDisconnected(void*, uint32_t) {
+  xTimerStop(mqttConnectTimer, 0);
+  uint32_t now = millis();
+  if (WiFi.isConnected()) {  // otherwise it's not the broker's fault
+    if (g_mqttSessionUp)
+      g_brokers.lost(g_broker, now, now - g_mqttSessionStart);
+    else if (g_mqttConnecting)
+      g_brokers.failed(g_broker, now);
+  }
+  if (g_mqttSessionUp || (g_mqttConnecting && !g_mqttLostAt))
+    g_mqttLostAt = now;
+  g_mqttSessionUp = false;
+  g_mqttConnecting = false;
+  if (WiFi.isConnected() && !mqttBenchActive())
+    connectToMqtt();
 }
 
 void onMqttConnect(bool sessionPresent) {
   Serial.println("MQTT connected.");
   Serial.print("Session present: ");
   Serial.println(sessionPresent);
+  bootMark(BootPhase::MqttUp);
 
-  mqttHomeAssistantDiscovery();
-
+#if SGREADY_STANDBY
+  mqttClient.subscribe(leaderTopic().c_str(), 1);
+  mqttClient.subscribe(availabilityTopic().c_str(), 1);  // the standby's Last Will must not mark us offline
+#endif
   String topic = entityTopic(g_excessName) + "/set";
   uint16_t packetIdSub = mqttClient.subscribe(topic.c_str(), 1);
-  DrawDisplay();
+  mqttClient.subscribe((entityTopic(g_modeName) + "/set").c_str(), 1);
+  mqttClient.subscribe((configTopic() + "/set").c_str(), 1);
+  mqttClient.subscribe((uniqueID(mqttClient) + "/ota/set").c_str(), 1);
+
+  // the broker bookkeeping, discovery and the states are the timer task's
+  if (xTimerPendFunctionCall(brokerConnected, nullptr, 0, pdMS_TO_TICKS(100)) != pdPASS) {
+    Serial.println("Error: Timer queue full, reconnecting to send discovery and states.");
+    mqttClient.disconnect();
+    return;
+  }
+
+  mqttBenchStart(mqttClient);  // no-op unless built with MQTT_BENCH
 }
 
-void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
-  Serial.println("MQTT disconnected.");
-  if (WiFi.isConnected()) {
-    xTimerStart(mqttReconnectTimer, 0);
-  }
+void onMqttDisconnect(MqttDisconnectReason reason) {
+  Serial.printf("MQTT disconnected, reason %u.\n", unsigned(reason));
+  if (g_roaming || (g_roamEnd && millis() - g_roamEnd < WIFI_ROAM_MQTT_WINDOW_MS))
+    g_roamStats.mqttDrops++;
+  if (xTimerPendFunctionCall(brokerDisconnected, nullptr, 0, pdMS_TO_TICKS(100)) != pdPASS && WiFi.isConnected() && !mqttBenchActive())
+    xTimerStart(mqttReconnectTimer, 0);  // the timer queue is full; at least come back
 }
 
 void onMqttSubscribe(uint16_t packetId, uint8_t qos) {
@@ -302,42 +1690,507 @@ void onMqttUnsubscribe(uint16_t packetId) {
   Serial.println(packetId);
 }
 
-void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
-  auto sTopic = String(topic);
-  auto sPayload = String(payload);
+// MQTT payloads are not null-terminated; anything longer than a command is truncated (and then rejected)
+String payloadString(const char* payload, size_t len) {
+  char buf[MQTT_MAX_COMMAND_LENGTH + 1];
+  len = min(len, sizeof(buf) - 1);
+  memcpy(buf, payload, len);
+  buf[len] = '\0';
+  return String(buf);
+}
+
+// MQTT_HOST may be given as an IPAddress or as a host name
+String hostString(const IPAddress& host) { return host.toString(); }
+String hostString(const char* host) { return host; }
+
+// credentials.h and the compile-time defaults, used when NVS holds no valid configuration
+void configDefaults(SgConfig& config) {
+  memset(&config, 0, sizeof(config));  // the CRC covers the padding too
+  strlcpy(config.wifiSsid, WIFI_SSID, sizeof(config.wifiSsid));
+  strlcpy(config.wifiPass, WIFI_PASSWORD, sizeof(config.wifiPass));
+  strlcpy(config.mqttHost, hostString(MQTT_HOST).c_str(), sizeof(config.mqttHost));
+  config.mqttPort = MQTT_PORT;
+  strlcpy(config.mqttFallback, MQTT_FALLBACK, sizeof(config.mqttFallback));
+  strlcpy(config.mqttUser, MQTT_USER, sizeof(config.mqttUser));
+  strlcpy(config.mqttPass, MQTT_PASS, sizeof(config.mqttPass));
+  config.keepAliveInterval = MQTT_KEEPALIVE_INTERVAL;
+  config.deadTime = MQTT_DEAD_TIME;
+}
+
+// the broker list; connectToMqtt() picks one of them for every connect
+void configureMqtt() {
+  g_brokers.clear();
+  g_brokers.add(g_config.mqttHost, g_config.mqttPort);
+  g_brokers.addList(g_config.mqttFallback, g_config.mqttPort);
+  g_broker = 0;
+  mqttClient.setCredentials(g_config.mqttUser, g_config.mqttPass);
+}
+
+// runs on the timer task, away from the MQTT callback that delivered the update
+void applyConfigChanges(void*, uint32_t changes) {
+  if (changes & CONFIG_CHANGED_TIMING)
+    Serial.printf("Keepalive %u s, dead time %u s.\n", g_config.keepAliveInterval, g_config.deadTime);
+
+  if (changes & CONFIG_CHANGED_BROKER) {
+    Serial.println("Broker settings changed, reconnecting MQTT.");
+    configureMqtt();
+    xTimerStop(mqttConnectTimer, 0);
+    g_mqttSessionUp = false;  // not the broker's fault
+    g_mqttConnecting = false;
+    mqttClient.disconnect();
+    if (!(changes & CONFIG_CHANGED_WIFI))
+      xTimerChangePeriod(mqttReconnectTimer, pdMS_TO_TICKS(100), 0);
+  }
+
+  if (changes & CONFIG_CHANGED_WIFI) {
+    Serial.println("WiFi settings changed, reconnecting.");
+    configureWifi();
+    WiFi.disconnect();  // the disconnect event reconnects with the new settings, MQTT follows the IP
+  }
+}
+
+// the broker fields of 'from', for a trial's save and its rollback
+void copyBrokerSettings(SgConfig& to, const SgConfig& from) {
+  strlcpy(to.mqttHost, from.mqttHost, sizeof(to.mqttHost));
+  to.mqttPort = from.mqttPort;
+  strlcpy(to.mqttFallback, from.mqttFallback, sizeof(to.mqttFallback));
+  strlcpy(to.mqttUser, from.mqttUser, sizeof(to.mqttUser));
+  strlcpy(to.mqttPass, from.mqttPass, sizeof(to.mqttPass));
+}
+
+// g_config to NVS, with the previous network and broker while new ones are on trial; timer task only
+void saveConfig() {
+  SgConfig saved = g_config;
+  if (g_wifiTrial) {
+    strlcpy(saved.wifiSsid, g_wifiPrevious.wifiSsid, sizeof(saved.wifiSsid));
+    strlcpy(saved.wifiPass, g_wifiPrevious.wifiPass, sizeof(saved.wifiPass));
+  }
+  if (g_brokerTrial)
+    copyBrokerSettings(saved, g_brokerPrevious);
+  if (!configSave(saved))
+    Serial.println("Error: Failed to save the configuration to NVS.");
+}
+
+/* Timer task: verify, apply and save a signed update; the payload was copied for us by
+   handleConfigUpdate(). New WiFi and broker settings are on trial: NVS keeps the old ones until
+   the new network has given an IP, or the new broker a CONNACK, and wifiTrialTick() and
+   brokerTrialTick() bring the old ones back if they don't. A second update during a trial keeps
+   the settings from before the first, the last ones known to work.
+*/
+void applyConfigUpdate(void* payload, uint32_t len) {
+  uint8_t changes;
+  const char* error;
+  String result;
+  SgConfig previous = g_config;
+  if (!configUpdate(g_config, CONFIG_SECRET, static_cast<const char*>(payload), len, changes, error)) {
+    Serial.printf("Error: Config update rejected: %s.\n", error);
+    result = String("error: ") + error;
+  }
+  else {
+    if (changes & CONFIG_CHANGED_WIFI) {
+      if (!g_wifiTrial)
+        g_wifiPrevious = previous;
+      g_wifiTrial = true;
+      g_wifiTrialStart = millis();
+    }
+    if (changes & CONFIG_CHANGED_BROKER) {
+      if (!g_brokerTrial)
+        g_brokerPrevious = previous;
+      g_brokerTrial = true;
+      g_brokerTrialStart = millis();
+    }
+    saveConfig();
+    g_configFromNvs = true;
+    Serial.printf("Config update %u accepted, changes 0x%02x.\n", g_config.seq, changes);
+    result = String("ok ") + g_config.seq;
+    if (changes)
+      applyConfigChanges(nullptr, changes);
+  }
+  free(payload);
+  mqttClient.publish((configTopic() + "/result").c_str(), 1, false, result.c_str());
+  mqttPublishConfig();
+}
+
+// MQTT task: g_config belongs to the timer task, so the update is handed over whole
+void handleConfigUpdate(const char* payload, size_t len) {
+  char* copy = len <= CONFIG_MAX_PAYLOAD ? static_cast<char*>(malloc(len)) : nullptr;
+  if (!copy) {
+    Serial.println("Error: Config update too long.");
+    mqttClient.publish((configTopic() + "/result").c_str(), 1, false, "error: payload too long");
+    return;
+  }
+  memcpy(copy, payload, len);
+  if (xTimerPendFunctionCall(applyConfigUpdate, copy, len, pdMS_TO_TICKS(100)) != pdPASS) {
+    free(copy);
+    Serial.println("Error: Timer queue full, config update dropped.");
+  }
+}
+
+/* Timer task, every tick while new WiFi settings are on trial: an IP after the update keeps them
+   and saves them; none within CONFIG_WIFI_TRIAL_MS brings back the previous network, so a wrong
+   password can't strand the board. The sequence number stays consumed either way.
+*/
+void wifiTrialTick() {
+  if (!g_wifiTrial)
+    return;
+  if (WiFi.isConnected() && int32_t(g_wifiIpAt - g_wifiTrialStart) >= 0) {
+    g_wifiTrial = false;
+    saveConfig();
+    Serial.printf("WiFi settings of update %u confirmed.\n", g_config.seq);
+    return;
+  }
+  if (millis() - g_wifiTrialStart < CONFIG_WIFI_TRIAL_MS)
+    return;
+
+  g_wifiTrial = false;
+  g_wifiRevertedSeq = g_config.seq;
+  Serial.printf("Error: No IP within %u s with the WiFi settings of update %u, reverting.\n", CONFIG_WIFI_TRIAL_MS/1000, g_config.seq);
+  strlcpy(g_config.wifiSsid, g_wifiPrevious.wifiSsid, sizeof(g_config.wifiSsid));
+  strlcpy(g_config.wifiPass, g_wifiPrevious.wifiPass, sizeof(g_config.wifiPass));
+  applyConfigChanges(nullptr, CONFIG_CHANGED_WIFI);
+}
+
+/* Timer task, every tick while new broker settings are on trial. Only a connected network can
+   prove a broker, so the CONFIG_BROKER_TRIAL_MS start from the update or the latest IP, whichever
+   is later; without a CONNACK by then the previous broker settings return. Config and OTA arrive
+   over MQTT only, so a wrong host or password would otherwise cut the board off for good.
+*/
+void brokerTrialTick() {
+  if (!g_brokerTrial || !WiFi.isConnected())
+    return;
+  uint32_t since = int32_t(g_wifiIpAt - g_brokerTrialStart) > 0 ? g_wifiIpAt : g_brokerTrialStart;
+  if (millis() - since < CONFIG_BROKER_TRIAL_MS)
+    return;
+
+  g_brokerTrial = false;
+  g_brokerRevertedSeq = g_config.seq;
+  Serial.printf("Error: No CONNACK within %u s with the broker settings of update %u, reverting.\n", CONFIG_BROKER_TRIAL_MS/1000, g_config.seq);
+  copyBrokerSettings(g_config, g_brokerPrevious);
+  applyConfigChanges(nullptr, CONFIG_CHANGED_BROKER);
+}
+
+void otaReport(const OtaResult& r) {
+  Serial.printf("OTA %s%s%s: %s image, %u bytes downloaded, %u bytes in %u flash sectors, %u ms total, %u ms flash, %u ms inflate.\n",
+    r.ok ? "succeeded" : "failed", r.error ? ": " : "", r.error ? r.error : "", r.compressed ? "gzip" : "raw",
+    r.downloadedBytes, r.writtenBytes, r.flashSectors, r.totalMillis, r.flashMillis, r.inflateMillis);
+
+  StaticJsonDocument<320> jdoc;
+  jdoc["ok"] = r.ok;
+  if (r.error)
+    jdoc["error"] = r.error;
+  jdoc["compressed"] = r.compressed;
+  jdoc["downloaded"] = r.downloadedBytes;
+  jdoc["written"] = r.writtenBytes;
+  jdoc["sectors"] = r.flashSectors;
+  jdoc["total_ms"] = r.totalMillis;
+  jdoc["flash_ms"] = r.flashMillis;
+  jdoc["inflate_ms"] = r.inflateMillis;
+  String payload;
+  serializeJson(jdoc, payload);
+  mqttClient.publish((uniqueID(mqttClient) + "/ota/result").c_str(), 1, false, payload.c_str());
+}
+
+// signed like a config update: <hmac> {"seq":9,"url":"http://host:8000/firmware.bin.gz","md5":"..."}
+// timer task: a signed OTA command, copied for us by handleOtaCommand()
+void applyOtaCommand(void* payload, uint32_t len) {
+  DynamicJsonDocument doc(CONFIG_MAX_PAYLOAD);
+  const char* error;
+  bool valid = configVerify(g_config, CONFIG_SECRET, static_cast<const char*>(payload), len, doc, error);
+  free(payload);
+  if (!valid) {
+    Serial.printf("Error: OTA command rejected: %s.\n", error);
+    return;
+  }
+  const char* url = doc["url"];
+  const char* md5 = doc["md5"];
+  if (!url || !md5 || strlen(md5) != 32) {
+    Serial.println("Error: OTA command needs a url and the md5 of the image.");
+    return;
+  }
+
+  g_config.seq = doc["seq"];  // consume the sequence number before anything else can fail
+  saveConfig();
+
+  Serial.printf("Starting OTA from %s.\n", url);
+  if (!otaStart(url, md5, otaReport, persistStateBeforeRestart))
+    Serial.println("Error: OTA already running.");
+}
 
-  g_excess = false;
+// MQTT task: the sequence number lives in g_config, which belongs to the timer task
+void handleOtaCommand(const char* payload, size_t len) {
+  char* copy = len <= CONFIG_MAX_PAYLOAD ? static_cast<char*>(malloc(len)) : nullptr;
+  if (!copy) {
+    Serial.println("Error: OTA command too long.");
+    return;
+  }
+  memcpy(copy, payload, len);
+  if (xTimerPendFunctionCall(applyOtaCommand, copy, len, pdMS_TO_TICKS(100)) != pdPASS) {
+    free(copy);
+    Serial.println("Error: Timer queue full, OTA command dropped.");
+  }
+}
 
-  if (sTopic == entityTopic(g_excessName) + "/set") { // correct topic?
-    if (sPayload == "ON")
-      g_excess = true;  // valid 'on' command received
-    else {
-      if (sPayload != "OFF")
-        Serial.printf("Error: Invalid MQTT payload '%s'.",payload);
+/* "ON", "OFF", "ON <seconds>" or {"state":"ON","lease":<seconds>}. A repeated ON renews the lease.
+   Returns false for anything else, which leaves on = false.
+*/
+bool parseExcessCommand(const String& payload, bool& on, uint32_t& lease) {
+  on = false;
+  lease = 0;
+  String state = payload;
+  if (payload.startsWith("{")) {
+    StaticJsonDocument<96> jdoc;
+    if (deserializeJson(jdoc, payload))
+      return false;
+    state = jdoc["state"] | "";
+    lease = jdoc["lease"] | 0u;
+  }
+  else {
+    int space = payload.indexOf(' ');
+    if (space > 0) {
+      state = payload.substring(0, space);
+      long seconds = payload.substring(space + 1).toInt();
+      if (seconds <= 0)
+        return false;
+      lease = uint32_t(seconds);
     }
   }
+
+  if (state == "OFF")
+    return lease == 0;
+  if (state != "ON")
+    return false;
+  on = true;
+  if (!lease)
+    lease = EXCESS_DEFAULT_LEASE;
+  lease = min(lease, uint32_t(EXCESS_MAX_LEASE));
+  return true;
+}
+
+/* Runs on the timer task, like updateMode(), so the two never race on the arbiter. ON is an Excess
+   request from the MQTT source; OFF withdraws it, leaving the decision to the other sources
+   (Normal if there are none).
+*/
+void applyExcessCommand(void*, uint32_t command) {
+  uint32_t lease = command & ~EXCESS_COMMAND_ON;
+  if (command & EXCESS_COMMAND_ON) {
+    g_arbiter.set(CommandSource::Mqtt, 1, SOURCE_PRIORITY_MQTT, lease, g_uptimeSeconds);
+    if (lease)
+      Serial.printf("Excess requested for %u s.\n", lease);
+  }
   else
-    Serial.printf("Error: MQTT message for unknown topic '%s'.",topic);
+    g_arbiter.clear(CommandSource::Mqtt, g_uptimeSeconds);
 
+  arbitrate();
   mqttPublishExcess();  // reflect the updated state back to HA
-  DrawDisplay();
+}
+
+/* "<mode>", "<mode> <seconds>" or {"mode":<mode>,"lease":<seconds>}, mode 0 to 3. 0 withdraws the
+   MQTT request, as "OFF" does on the Excess switch. Returns false for anything else.
+*/
+bool parseModeCommand(const String& payload, uint8_t& mode, uint32_t& lease) {
+  long value = -1;
+  lease = 0;
+  if (payload.startsWith("{")) {
+    StaticJsonDocument<96> jdoc;
+    if (deserializeJson(jdoc, payload) || !jdoc["mode"].is<int>())
+      return false;
+    value = jdoc["mode"];
+    lease = jdoc["lease"] | 0u;
+  }
+  else {
+    int space = payload.indexOf(' ');
+    String number = space > 0 ? payload.substring(0, space) : payload;
+    if (number.length() != 1 || number[0] < '0' || number[0] > '9')
+      return false;
+    value = number.toInt();
+    if (space > 0) {
+      long seconds = payload.substring(space + 1).toInt();
+      if (seconds <= 0)
+        return false;
+      lease = uint32_t(seconds);
+    }
+  }
+
+  if (value < 0 || value >= SG_MODES || (value == 0 && lease))
+    return false;
+  mode = uint8_t(value);
+  if (mode && !lease)
+    lease = EXCESS_DEFAULT_LEASE;
+  lease = min(lease, uint32_t(EXCESS_MAX_LEASE));
+  return true;
+}
+
+/* Timer task. A request for any mode from the MQTT source; it takes the place of an Excess request.
+   Whether the pins follow is up to the arbiter and then the quota, so a mode the wiring can't drive
+   is still taken and shows up as refused on the Quota sensor.
+*/
+void applyModeCommand(void* mode, uint32_t lease) {
+  uint8_t m = uint8_t(uintptr_t(mode));
+  if (m) {
+    g_arbiter.set(CommandSource::Mqtt, m, SOURCE_PRIORITY_MQTT, lease, g_uptimeSeconds);
+    if (lease)
+      Serial.printf("Mode %u requested for %u s.\n", m, lease);
+  }
+  else
+    g_arbiter.clear(CommandSource::Mqtt, g_uptimeSeconds);
+
+  arbitrate();
+  mqttPublishExcess();
+}
+
+void onMqttMessage(const char* topic, const char* payload, size_t len) {
+  if (configTopic() + "/set" == topic) {
+    handleConfigUpdate(payload, len);
+    return;
+  }
+  if (uniqueID(mqttClient) + "/ota/set" == topic) {
+    handleOtaCommand(payload, len);
+    return;
+  }
+#if SGREADY_STANDBY
+  if (leaderTopic() == topic) {
+    ReceivedHeartbeat received;
+    received.at = millis();
+    if (Leadership::parse(payload, len, received.heartbeat) && xQueueSend(g_heartbeats, &received, 0) != pdTRUE)
+      Serial.println("Error: Heartbeat queue full.");
+    return;
+  }
+  if (availabilityTopic() == topic) {
+    if (payloadString(payload, len) == "offline" && leading())
+      mqttPublishOnline();
+    return;
+  }
+#endif
+
+  if (entityTopic(g_modeName) + "/set" == topic) {
+    uint8_t mode = 0;
+    uint32_t lease = 0;
+    if (!parseModeCommand(payloadString(payload, len), mode, lease)) {
+      Serial.printf("Error: Invalid mode command '%s'.\n", payloadString(payload, len).c_str());
+      return;
+    }
+    if (xTimerPendFunctionCall(applyModeCommand, (void*)uintptr_t(mode), lease, pdMS_TO_TICKS(100)) != pdPASS)
+      Serial.println("Error: Timer queue full, mode command dropped.");
+    return;
+  }
+
+  if (entityTopic(g_excessName) + "/set" != topic) {
+    Serial.printf("Error: MQTT message for unknown topic '%s'.",topic);
+    return;
+  }
+
+  bool on = false;
+  uint32_t lease = 0;
+  if (!parseExcessCommand(payloadString(payload, len), on, lease))
+    Serial.printf("Error: Invalid MQTT payload '%s'.",payloadString(payload, len).c_str());  // and treated as OFF
+
+  // the arbiter belongs to the timer task
+  if (xTimerPendFunctionCall(applyExcessCommand, nullptr, (on ? EXCESS_COMMAND_ON : 0) | lease, pdMS_TO_TICKS(100)) != pdPASS)
+    Serial.println("Error: Timer queue full, excess command dropped.");
 }
 
 void onMqttPublish(uint16_t packetId) {
 //  Serial.print("MQTT alive, publish acknowledged for id: ");
 //  Serial.println(packetId);
   g_mqttLastResponseTime = g_currentStateTime;
+  g_lastAckMillis = millis();
 }
 
-void setup() {
-  Serial.begin(115200);
-  Serial.println();
+#if defined(MQTT_BACKEND_SOCKET)
+// the DNS lookup and the TLS handshake block here, not on the timer task that calls connect()
+void mqttPollTask(void*) {
+  for (;;) {
+    mqttTransport.poll();
+    vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_INTERVAL_MS));
+  }
+}
+#endif
 
+// everything that is slow to bring up; the pins are already safe and the countdown is running
+void startupTask(void*) {
   display.init();
   display.flipScreenVertically();
   display.setTextAlignment(TEXT_ALIGN_LEFT);
+  display.clear();
+  g_displayFlush.begin(display.buffer);  // init() left the panel blank
+  g_displayPages.begin(display);
+  g_displayViews = xQueueCreate(1, sizeof(DisplayView));
+  xTaskCreate(displayTask, "display", DISPLAY_TASK_STACK, nullptr, 1, nullptr);
+  pinMode(DISPLAY_WAKE_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(DISPLAY_WAKE_PIN), displayWakeISR, FALLING);
+  g_displayReady = true;
+
+  WiFi.onEvent(WiFiEvent);
+
+  mqttClient.onConnect(onMqttConnect);
+  mqttClient.onDisconnect(onMqttDisconnect);
+  mqttClient.onSubscribe(onMqttSubscribe);
+  mqttClient.onUnsubscribe(onMqttUnsubscribe);
+  mqttClient.onMessage(onMqttMessage);
+  mqttClient.onPublish(onMqttPublish);
+  configureMqtt();
+  mqttClient.setCleanSession(true);
+  mqttClient.setWill(availabilityTopic().c_str(), 1, true, "offline");
+  configTime(0, 0, SNTP_SERVER);  // the transition timestamp is UTC, the tariff is in local time
+  setenv("TZ", TARIFF_TZ, 1);
+  tzset();
+#if MQTT_TLS
+  if (!mqttTransport.setTls(MQTT_TLS_PIN_SHA256, MQTT_TLS_CA_PEM))
+    Serial.println("Error: Invalid MQTT TLS pin or CA certificate.");
+#endif
+#if defined(MQTT_BACKEND_SOCKET)
+  xTaskCreate(mqttPollTask, "mqttPoll", 8192, nullptr, 1, nullptr);  // room for the TLS handshake
+#endif
+
+  xTimerPendFunctionCall(connectToWifiPended, nullptr, 0, portMAX_DELAY);  // the scan cache and DrawDisplay() are the timer task's
+  g_statusServer.begin(STATUS_HTTP_PORT);  // lwIP is up once WiFi has started; clients come with the IP
+  vTaskDelete(nullptr);
+}
+
+void setup() {
+  // after an OTA the new image can't trust RTC memory; NVS holds the mode for this one boot
+  bool fromNvs = restoreStateFromNvs(!g_stateRestored);
+  g_stateRestored |= fromNvs;
+  g_quota.limit(2, { BLOCK_MAX_SECONDS, BLOCK_MAX_PER_DAY });
+  g_quota.limit(3, { FORCE_MAX_SECONDS, FORCE_MAX_PER_DAY });
+  if (g_stateRestored) {  // the timers aren't running yet, so no race
+    uint8_t priority = sourcePriority(g_restoredSource);
+    if (priority)
+      g_arbiter.set(g_restoredSource, g_restoredRequest, priority, g_restoredLease, g_uptimeSeconds);
+    g_excess = g_arbiter.mode() == 1;
+    if (g_currentMode)
+      g_quota.entered(g_currentMode, g_uptimeSeconds, g_currentStateTime);  // a restored Block keeps its length
+  }
+
+  // the pins were set by earlyPinsSafe(); this keeps the Arduino core's view of the pin consistent
+  // and applies a mode restored from NVS. A standby, or a board that was one, waits for poll() to
+  // make it the leader
+  if (!SGREADY_STANDBY || (g_stateRestored && g_restoredLeader)) {
+    pinMode(SG_PIN_LSB, OUTPUT);
+#if SG_PIN_MSB >= 0
+    pinMode(SG_PIN_MSB, OUTPUT);
+#endif
+    writeModePins(g_currentMode);
+  }
+
+  Serial.begin(115200);
+  Serial.println();
+  Serial.printf("Reset reason: %s, pins safe after %u us in mode %i, %u s into the current state (%s).\n",
+    bootResetReason(), bootMicros(BootPhase::PinsSafe), g_currentMode, g_currentStateTime,
+    fromNvs ? "restored from NVS" : g_stateRestored ? "restored from RTC" : "fresh start");
+
+  SgConfig defaults;
+  configDefaults(defaults);
+  g_configFromNvs = configLoad(g_config, defaults);
+  Serial.printf("Configuration %u from %s.\n", g_config.seq, g_configFromNvs ? "NVS" : "defaults");
+  configureWifi();
+  if (!g_tariff.setWeek(TARIFF_WEEK) || !g_tariff.setHolidays(TARIFF_HOLIDAYS))
+    Serial.println("Error: Invalid TARIFF_WEEK or TARIFF_HOLIDAYS.");
+  else if (!g_tariff.empty())
+    Serial.printf("Tariff calendar with %u holidays, %s.\n", unsigned(g_tariff.holidays()), TARIFF_TZ);
 
   mqttReconnectTimer = xTimerCreate("mqttTimer", pdMS_TO_TICKS(5000), pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToMqtt));
+  mqttConnectTimer = xTimerCreate("mqttConnectTimer", pdMS_TO_TICKS(BROKER_CONNECT_TIMEOUT_MS), pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(mqttConnectTimeout));
   wifiReconnectTimer = xTimerCreate("wifiTimer", pdMS_TO_TICKS(5000), pdFALSE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(connectToWifi));
 
   /* We start the countdown timer immediately, regardless of connection state. If no connection has been achieved by the time of expiration we will
@@ -349,22 +2202,26 @@ void setup() {
   countdownTimer = xTimerCreate("countdownTimer", pdMS_TO_TICKS(1000), pdTRUE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(updateMode));
   xTimerStart(countdownTimer, 0);
 
-  pinMode (SG_PIN_LSB,OUTPUT);
-  setPins();
+#if SGREADY_STANDBY
+  char node[LEADER_NODE_SIZE];
+  snprintf(node, sizeof(node), "%012llx", (unsigned long long)ESP.getEfuseMac());
+  g_heartbeats = xQueueCreate(4, sizeof(ReceivedHeartbeat));
+  g_leadership.begin(node, millis());
+  Serial.printf("Hot standby: node %s, lease %u ms.\n", node, LEADER_LEASE_MS);
+#endif
 
-  WiFi.onEvent(WiFiEvent);
+  g_telemetry.setTopicPrefix((uniqueID(mqttClient) + "_").c_str());
+  for (const TelemetrySensor& sensor : g_telemetrySensors)
+    g_telemetry.add(sensor);
+  wifiRoamTimer = xTimerCreate("wifiRoamTimer", pdMS_TO_TICKS(WIFI_ROAM_CHECK_MS), pdTRUE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(wifiRoamTick));
+  xTimerStart(wifiRoamTimer, 0);
+  telemetryTimer = xTimerCreate("telemetryTimer", pdMS_TO_TICKS(TELEMETRY_INTERVAL_MS), pdTRUE, (void*)0, reinterpret_cast<TimerCallbackFunction_t>(pollTelemetry));
+  xTimerStart(telemetryTimer, 0);
 
-  mqttClient.onConnect(onMqttConnect);
-  mqttClient.onDisconnect(onMqttDisconnect);
-  mqttClient.onSubscribe(onMqttSubscribe);
-  mqttClient.onUnsubscribe(onMqttUnsubscribe);
-  mqttClient.onMessage(onMqttMessage);
-  mqttClient.onPublish(onMqttPublish);
-  mqttClient.setServer(MQTT_HOST, MQTT_PORT);
-  mqttClient.setCleanSession(true);
-  mqttClient.setCredentials(MQTT_USER,MQTT_PASS);
+  pinMode(OVERRIDE_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(OVERRIDE_PIN), overrideISR, CHANGE);
 
-  connectToWifi();
+  xTaskCreate(startupTask, "startup", STARTUP_TASK_STACK, nullptr, 1, nullptr);
 }
 
 void loop() {
@@ -0,0 +1,99 @@
+#include "mode_quota.h"
+
+#include <string.h>
+
+ModeQuota::ModeQuota(uint8_t modes)
+  : _modes(modes > SG_MODES ? SG_MODES : modes), _totals(), _hour(0), _mode(0), _runStart(0), _cut(false), _cutMode(0),
+    _last(QuotaVerdict::Allowed), _lastMode(0), _stats() {
+  memset(_limits, 0, sizeof(_limits));
+  memset(_buckets, 0, sizeof(_buckets));
+}
+
+void ModeQuota::limit(uint8_t mode, const ModeLimit& limit) {
+  if (mode < SG_MODES)
+    _limits[mode] = limit;
+}
+
+// drop the hours that left the window; at most one pass over the ring however long the gap
+void ModeQuota::advance(uint32_t now) {
+  uint32_t hour = now / 3600;
+  if (hour == _hour)
+    return;
+  uint32_t steps = hour - _hour;
+  if (steps > QUOTA_BUCKETS)
+    steps = QUOTA_BUCKETS;
+  for (; steps; steps--) {
+    uint32_t slot = ++_hour % QUOTA_BUCKETS;
+    for (uint8_t mode = 0; mode < SG_MODES; mode++) {
+      _totals[mode] -= _buckets[mode][slot];
+      _buckets[mode][slot] = 0;
+    }
+  }
+  _hour = hour;
+}
+
+QuotaVerdict ModeQuota::decide(uint8_t mode, uint32_t now) {
+  if (_cut && mode != _cutMode)
+    _cut = false;  // the requests moved on; the next ask for the mode is a new run
+  if (mode >= _modes)
+    return QuotaVerdict::Unwired;
+  if (_cut)
+    return QuotaVerdict::Duration;
+
+  const ModeLimit& l = _limits[mode];
+  if (mode == _mode) {
+    if (!l.maxSeconds || now - _runStart < l.maxSeconds)
+      return QuotaVerdict::Allowed;
+    _cut = true;
+    _cutMode = mode;
+    _stats.cuts++;
+    return QuotaVerdict::Duration;
+  }
+  if (l.maxStarts && _totals[mode] >= l.maxStarts)
+    return QuotaVerdict::Starts;
+  return QuotaVerdict::Allowed;
+}
+
+QuotaVerdict ModeQuota::admit(uint8_t mode, uint32_t now) {
+  advance(now);
+  QuotaVerdict verdict = decide(mode, now);
+  if (verdict != QuotaVerdict::Allowed && (verdict != _last || mode != _lastMode))
+    _stats.refusals++;
+  _last = verdict;
+  _lastMode = mode;
+  return verdict;
+}
+
+void ModeQuota::entered(uint8_t mode, uint32_t now, uint32_t elapsed) {
+  advance(now);
+  if (mode >= SG_MODES)
+    return;
+  _mode = mode;
+  _runStart = now - elapsed;
+  if (_cut && mode == _cutMode)
+    _cut = false;
+  _buckets[mode][_hour % QUOTA_BUCKETS]++;
+  _totals[mode]++;
+  _stats.starts++;
+}
+
+// what advance(now) would leave in the total, without touching the ring
+uint16_t ModeQuota::starts(uint8_t mode, uint32_t now) const {
+  uint32_t steps = now / 3600 - _hour;
+  if (mode >= SG_MODES || steps >= QUOTA_BUCKETS)
+    return 0;
+  uint16_t total = _totals[mode];
+  for (uint32_t hour = _hour + 1; steps; steps--, hour++)
+    total -= _buckets[mode][hour % QUOTA_BUCKETS];
+  return total;
+}
+
+const char* ModeQuota::verdictName(QuotaVerdict verdict) {
+  switch (verdict) {
+    case QuotaVerdict::Allowed:  return "allowed";
+    case QuotaVerdict::Unwired:  return "not wired";
+    case QuotaVerdict::Starts:   return "daily count";
+    case QuotaVerdict::Duration: return "max duration";
+  }
+  return "?";
+}
@@ -0,0 +1,76 @@
+/*
+  Limits on how long and how often the controller may hold an SG Ready mode, for Block above all.
+
+  The utility may block the pump (mode 2), but the SG Ready rules and the supply contract cap the
+  length of a block and the number of blocks a day. A ModeLimit gives a mode its longest run and
+  the number of runs it may start per QUOTA_WINDOW_HOURS; 0 is no limit. admit() is asked for the
+  arbiter's verdict whenever it changes and on every tick, and turns down:
+
+    - a mode the wiring can't drive (modes 2 and 3 need the high bit, SG_PIN_MSB),
+    - a new run once the window holds the allowed number of starts,
+    - a run that has lasted its longest time. That refusal holds until the verdict asks for another
+      mode, so a stuck request, or one renewed by its lease, can't start the next run at once.
+
+  Starts are counted in a ring of hourly buckets with a running total per mode. Entering a new
+  hour zeroes the buckets that left the window, so admit() is O(1) however long the history. The
+  ring holds the current hour and the QUOTA_WINDOW_HOURS before it: any 24 h then hold no more
+  starts than the limit, at the cost of refusing up to an hour longer than an exact sliding window.
+
+  Times are seconds on a monotonic clock (the controller uses its uptime). The counts live in RAM,
+  so a reboot starts with an empty window; a run restored from before the reset counts as a start.
+
+  Portable and not thread-safe; the controller drives it from the timer task only.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define SG_MODES 4
+#define QUOTA_WINDOW_HOURS 24
+#define QUOTA_BUCKETS (QUOTA_WINDOW_HOURS + 1)
+
+struct ModeLimit {
+  uint32_t maxSeconds;  // longest run, 0 = no limit
+  uint16_t maxStarts;   // runs started per window, 0 = no limit
+};
+
+enum class QuotaVerdict : uint8_t { Allowed, Unwired, Starts, Duration };
+
+struct QuotaStats {
+  uint32_t starts;
+  uint32_t cuts;      // runs ended by their longest time
+  uint32_t refusals;  // verdicts turned down, counted once until the verdict or the reason changes
+};
+
+class ModeQuota {
+ public:
+  explicit ModeQuota(uint8_t modes = SG_MODES);  // modes the wiring can drive, 2 with the low bit only
+
+  void limit(uint8_t mode, const ModeLimit& limit);
+  QuotaVerdict admit(uint8_t mode, uint32_t now);
+  void entered(uint8_t mode, uint32_t now, uint32_t elapsed = 0);  // the pins moved to 'mode' 'elapsed' seconds ago
+  uint16_t starts(uint8_t mode, uint32_t now) const;  // in the window; reads only, the ring moves on in admit() and entered()
+  uint32_t running(uint32_t now) const { return now - _runStart; }
+  const ModeLimit& limit(uint8_t mode) const { return _limits[mode]; }
+  const QuotaStats& stats() const { return _stats; }
+
+  static const char* verdictName(QuotaVerdict verdict);
+
+ private:
+  void advance(uint32_t now);
+  QuotaVerdict decide(uint8_t mode, uint32_t now);
+
+  uint8_t _modes;
+  ModeLimit _limits[SG_MODES];
+  uint16_t _buckets[SG_MODES][QUOTA_BUCKETS];  // starts per hour, a ring
+  uint16_t _totals[SG_MODES];                  // the sum of each mode's buckets
+  uint32_t _hour;                              // now / 3600 of the newest bucket
+  uint8_t _mode;                               // of the current run
+  uint32_t _runStart;
+  bool _cut;                                   // _cutMode's last run was cut; refused until asked for another mode
+  uint8_t _cutMode;
+  QuotaVerdict _last;
+  uint8_t _lastMode;
+  QuotaStats _stats;
+};
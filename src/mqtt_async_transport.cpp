@@ -0,0 +1,98 @@
+#ifdef ARDUINO
+
+#include "mqtt_async_transport.h"
+
+MqttAsyncTransport::MqttAsyncTransport() {
+  _client.onConnect([this](bool sessionPresent) { notifyConnected(sessionPresent); });
+  _client.onDisconnect([this](AsyncMqttClientDisconnectReason reason) {
+    switch (reason) {
+      case AsyncMqttClientDisconnectReason::TLS_BAD_FINGERPRINT:
+        notifyDisconnected(MqttDisconnectReason::TLS_BAD_FINGERPRINT);
+      break;
+      case AsyncMqttClientDisconnectReason::ESP8266_NOT_ENOUGH_SPACE:
+        notifyDisconnected(MqttDisconnectReason::TCP_DISCONNECTED);
+      break;
+      default:  // TCP_DISCONNECTED and the CONNACK codes line up
+        notifyDisconnected(static_cast<MqttDisconnectReason>(reason));
+      break;
+    }
+  });
+  _client.onSubscribe([this](uint16_t packetId, uint8_t qos) { notifySubscribed(packetId, qos); });
+  _client.onUnsubscribe([this](uint16_t packetId) { notifyUnsubscribed(packetId); });
+  _client.onPublish([this](uint16_t packetId) { notifyPublishAcked(packetId); });
+  _client.onMessage([this](char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+    if (index != 0 || len != total) {  // our payloads are tiny; a fragmented message is not for us
+      Serial.printf("Error: Ignoring fragmented MQTT message on '%s' (%u bytes).\n", topic, unsigned(total));
+      return;
+    }
+    notifyMessage(topic, payload, len);
+  });
+}
+
+void MqttAsyncTransport::setServer(const char* host, uint16_t port) {
+  _host = host;
+
+  IPAddress ip;
+  if (ip.fromString(_host.c_str()))
+    _client.setServer(ip, port);  // skip the DNS lookup on every connect
+  else
+    _client.setServer(_host.c_str(), port);
+}
+
+void MqttAsyncTransport::setCredentials(const char* user, const char* pass) {
+  _user = user;
+  _pass = pass;
+  _client.setCredentials(_user.c_str(), _pass.c_str());
+}
+
+void MqttAsyncTransport::setClientId(const char* clientId) {
+  _clientId = clientId;
+  _client.setClientId(_clientId.c_str());
+}
+
+void MqttAsyncTransport::setKeepAlive(uint16_t seconds) {
+  _client.setKeepAlive(seconds);
+}
+
+void MqttAsyncTransport::setCleanSession(bool cleanSession) {
+  _client.setCleanSession(cleanSession);
+}
+
+void MqttAsyncTransport::setWill(const char* topic, uint8_t qos, bool retain, const char* payload) {
+  _willTopic = topic;
+  _willPayload = payload;
+  _client.setWill(_willTopic.c_str(), qos, retain, _willPayload.c_str(), _willPayload.length());
+}
+
+void MqttAsyncTransport::connect() {
+  notifyConnecting();
+  _client.connect();
+}
+
+void MqttAsyncTransport::disconnect() {
+  _client.disconnect();
+}
+
+bool MqttAsyncTransport::connected() const {
+  return _client.connected();
+}
+
+uint16_t MqttAsyncTransport::publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length) {
+  if (payload && !length)
+    length = strlen(payload);
+
+  uint16_t packetId = _client.publish(topic, qos, retain, payload, length);
+  if (packetId)
+    notifyPublishSent(packetId, qos, length);
+  return packetId;
+}
+
+uint16_t MqttAsyncTransport::subscribe(const char* topic, uint8_t qos) {
+  return _client.subscribe(topic, qos);
+}
+
+uint16_t MqttAsyncTransport::unsubscribe(const char* topic) {
+  return _client.unsubscribe(topic);
+}
+
+#endif
@@ -0,0 +1,47 @@
+/*
+  MqttTransport backed by AsyncMqttClient. Runs entirely in the AsyncTCP task, so poll() is not needed.
+*/
+
+#pragma once
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+
+#include "mqtt_transport.h"
+
+class MqttAsyncTransport : public MqttTransport {
+ public:
+  MqttAsyncTransport();
+
+  const char* name() const override { return "AsyncMqttClient"; }
+
+  void setServer(const char* host, uint16_t port) override;
+  void setCredentials(const char* user, const char* pass) override;
+  void setClientId(const char* clientId) override;
+  void setKeepAlive(uint16_t seconds) override;
+  void setCleanSession(bool cleanSession) override;
+  void setWill(const char* topic, uint8_t qos, bool retain, const char* payload) override;
+
+  void connect() override;
+  void disconnect() override;
+  bool connected() const override;
+
+  uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length = 0) override;
+  uint16_t subscribe(const char* topic, uint8_t qos) override;
+  uint16_t unsubscribe(const char* topic) override;
+
+ private:
+  AsyncMqttClient _client;
+
+  // AsyncMqttClient keeps the raw pointers, so the strings must outlive it
+  String _host;
+  String _user;
+  String _pass;
+  String _clientId;
+  String _willTopic;
+  String _willPayload;
+};
+
+#endif
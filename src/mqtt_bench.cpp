@@ -0,0 +1,101 @@
+#if defined(ARDUINO) && MQTT_BENCH
+
+#include <Arduino.h>
+
+#include "heap_stats.h"
+#include "mqtt_bench.h"
+
+#define MQTT_BENCH_TIMEOUT_MS 30000
+
+static uint32_t s_freeHeapBeforeConnect;
+static bool s_started;
+static volatile bool s_active;
+
+void mqttBenchBeforeConnect() {
+  if (!s_freeHeapBeforeConnect)
+    s_freeHeapBeforeConnect = ESP.getFreeHeap();
+}
+
+bool mqttBenchActive() {
+  return s_active;
+}
+
+static bool waitFor(std::function<bool()> condition) {
+  uint32_t start = millis();
+  while (!condition()) {
+    if (millis() - start > MQTT_BENCH_TIMEOUT_MS)
+      return false;
+    vTaskDelay(1);
+  }
+  return true;
+}
+
+static void benchTask(void* arg) {
+  MqttTransport& mqtt = *static_cast<MqttTransport*>(arg);
+  const MqttStats& s = mqtt.stats();
+
+  vTaskDelay(pdMS_TO_TICKS(3000));  // let discovery and the first state publishes settle
+  uint32_t resident = s_freeHeapBeforeConnect - ESP.getFreeHeap();
+
+  // throughput and churn
+  static char payload[64];
+  memset(payload, 'x', sizeof(payload) - 1);
+  uint32_t acksBefore = s.acks;
+  uint64_t rttBefore = s.totalRttMicros;
+  heapStatsReset();
+  uint32_t start = micros();
+  uint32_t sent = 0;
+  waitFor([&] {
+    while (sent < MQTT_BENCH_MESSAGES && sent - (s.acks - acksBefore) < MQTT_BENCH_WINDOW && mqtt.publish("sgready_board_bench", 1, false, payload))
+      sent++;
+    return sent == MQTT_BENCH_MESSAGES;
+  });
+  bool acked = waitFor([&] { return s.acks - acksBefore >= MQTT_BENCH_MESSAGES; });
+  uint32_t elapsed = micros() - start;
+  HeapStats heap;
+  heapStatsGet(heap);
+  uint32_t acks = s.acks - acksBefore;
+  uint32_t avgRtt = acks ? uint32_t((s.totalRttMicros - rttBefore) / acks) : 0;
+
+  // reconnect time
+  s_active = true;
+  uint64_t reconnectMicros = 0;
+  uint32_t reconnects = 0;
+  for (int i = 0; i < MQTT_BENCH_RECONNECTS; i++) {
+    mqtt.disconnect();
+    if (!waitFor([&] { return !mqtt.connected(); }))
+      break;
+    mqtt.connect();
+    if (!waitFor([&] { return mqtt.connected(); }))
+      break;
+    reconnectMicros += s.lastConnectMicros;
+    reconnects++;
+  }
+  s_active = false;
+
+  Serial.printf("BENCH backend=%s resident=%u min_free=%u allocs_per_msg=%.2f bytes_per_msg=%.1f throughput=%.1f rtt_avg_us=%u reconnect_ms=%.1f acked=%u/%u\n",
+    mqtt.name(), resident, ESP.getMinFreeHeap(),
+    double(heap.allocations) / MQTT_BENCH_MESSAGES, double(heap.allocatedBytes) / MQTT_BENCH_MESSAGES,
+    elapsed ? MQTT_BENCH_MESSAGES * 1e6 / elapsed : 0.0, avgRtt,
+    reconnects ? reconnectMicros / 1000.0 / reconnects : -1.0,
+    acked ? acks : 0, MQTT_BENCH_MESSAGES);
+
+  vTaskDelete(nullptr);
+}
+
+void mqttBenchStart(MqttTransport& mqtt) {
+  if (s_started)
+    return;
+  s_started = true;
+  xTaskCreate(benchTask, "mqttBench", 4096, &mqtt, 1, nullptr);
+}
+
+#else
+
+#include "mqtt_bench.h"
+
+void mqttBenchBeforeConnect() {}
+void mqttBenchStart(MqttTransport&) {}
+bool mqttBenchActive() { return false; }
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  On-target MQTT backend benchmark, built into the bench_* environments (-DMQTT_BENCH=1).
+
+  Once the first connection is up it measures, for whichever backend the image was built with:
+    - resident heap held by the connected client
+    - heap churn (allocations and bytes per published message)
+    - QoS 1 publish throughput and RTT
+    - reconnect time (connect() to CONNACK, averaged)
+  and prints a single "BENCH ..." line. Feed the serial logs of both backends to
+  tools/compare_mqtt_backends.py to pick the winner.
+*/
+
+#pragma once
+
+#include "mqtt_transport.h"
+
+#ifndef MQTT_BENCH_MESSAGES
+#define MQTT_BENCH_MESSAGES 500
+#endif
+
+#ifndef MQTT_BENCH_RECONNECTS
+#define MQTT_BENCH_RECONNECTS 5
+#endif
+
+#ifndef MQTT_BENCH_WINDOW
+#define MQTT_BENCH_WINDOW 8
+#endif
+
+void mqttBenchBeforeConnect();          // snapshot free heap before the client allocates anything
+void mqttBenchStart(MqttTransport& mqtt);  // call from onConnect; starts the benchmark task once
+bool mqttBenchActive();                 // true while the benchmark drives the connection itself
@@ -0,0 +1,179 @@
+#if defined(ARDUINO) && defined(MQTT_BACKEND_ESP_MQTT)
+
+#include "mqtt_esp_transport.h"
+
+#define ESP_MQTT_MAX_TOPIC 128
+
+MqttEspTransport::MqttEspTransport()
+  : _client(nullptr), _configDirty(true), _started(false), _connected(false),
+    _pendingReason(MqttDisconnectReason::TCP_DISCONNECTED) {
+  memset(&_config, 0, sizeof(_config));
+  _config.transport = MQTT_TRANSPORT_OVER_TCP;
+  _config.port = 1883;
+  _config.keepalive = 15;
+  _config.disable_auto_reconnect = true;  // the controller's reconnect timer decides when to retry
+  _config.buffer_size = ESP_MQTT_BUFFER_SIZE;
+  _config.task_stack = ESP_MQTT_TASK_STACK;
+}
+
+MqttEspTransport::~MqttEspTransport() {
+  if (_client)
+    esp_mqtt_client_destroy(_client);
+}
+
+void MqttEspTransport::setServer(const char* host, uint16_t port) {
+  _host = host;
+  _config.host = _host.c_str();
+  _config.port = port;
+  _configDirty = true;
+}
+
+void MqttEspTransport::setCredentials(const char* user, const char* pass) {
+  _user = user;
+  _pass = pass;
+  _config.username = _user.c_str();
+  _config.password = _pass.c_str();
+  _configDirty = true;
+}
+
+void MqttEspTransport::setClientId(const char* clientId) {
+  _clientId = clientId;
+  _config.client_id = _clientId.c_str();
+  _configDirty = true;
+}
+
+void MqttEspTransport::setKeepAlive(uint16_t seconds) {
+  _config.keepalive = seconds;
+  _configDirty = true;
+}
+
+void MqttEspTransport::setCleanSession(bool cleanSession) {
+  _config.disable_clean_session = !cleanSession;
+  _configDirty = true;
+}
+
+void MqttEspTransport::setWill(const char* topic, uint8_t qos, bool retain, const char* payload) {
+  _willTopic = topic;
+  _willPayload = payload;
+  _config.lwt_topic = _willTopic.c_str();
+  _config.lwt_msg = _willPayload.c_str();
+  _config.lwt_msg_len = int(_willPayload.length());
+  _config.lwt_qos = qos;
+  _config.lwt_retain = retain;
+  _configDirty = true;
+}
+
+void MqttEspTransport::connect() {
+  if (_connected)
+    return;
+
+  notifyConnecting();
+  if (!_client) {
+    _client = esp_mqtt_client_init(&_config);
+    if (!_client) {
+      notifyDisconnected(MqttDisconnectReason::TCP_DISCONNECTED);
+      return;
+    }
+    esp_mqtt_client_register_event(_client, MQTT_EVENT_ANY, eventHandler, this);
+    _configDirty = false;
+  }
+  else if (_configDirty) {
+    esp_mqtt_set_config(_client, &_config);
+    _configDirty = false;
+  }
+
+  esp_err_t err = _started ? esp_mqtt_client_reconnect(_client) : esp_mqtt_client_start(_client);
+  if (err == ESP_OK)
+    _started = true;
+  else
+    notifyDisconnected(MqttDisconnectReason::TCP_DISCONNECTED);
+}
+
+void MqttEspTransport::disconnect() {
+  if (_client && _started)
+    esp_mqtt_client_disconnect(_client);
+}
+
+uint16_t MqttEspTransport::publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length) {
+  if (!_connected)
+    return 0;
+  if (payload && !length)
+    length = strlen(payload);
+
+  int msgId = esp_mqtt_client_publish(_client, topic, payload, int(length), qos, retain);
+  if (msgId < 0)
+    return 0;
+
+  uint16_t packetId = qos > 0 ? uint16_t(msgId) : 1;  // esp-mqtt reports 0 for QoS 0
+  notifyPublishSent(packetId, qos, length);
+  return packetId;
+}
+
+uint16_t MqttEspTransport::subscribe(const char* topic, uint8_t qos) {
+  if (!_connected)
+    return 0;
+  int msgId = esp_mqtt_client_subscribe(_client, topic, qos);
+  return msgId < 0 ? 0 : uint16_t(msgId);
+}
+
+uint16_t MqttEspTransport::unsubscribe(const char* topic) {
+  if (!_connected)
+    return 0;
+  int msgId = esp_mqtt_client_unsubscribe(_client, topic);
+  return msgId < 0 ? 0 : uint16_t(msgId);
+}
+
+void MqttEspTransport::eventHandler(void* arg, esp_event_base_t base, int32_t eventId, void* eventData) {
+  static_cast<MqttEspTransport*>(arg)->handleEvent(static_cast<esp_mqtt_event_handle_t>(eventData));
+}
+
+// runs in the esp-mqtt task
+void MqttEspTransport::handleEvent(esp_mqtt_event_handle_t event) {
+  switch (event->event_id) {
+    case MQTT_EVENT_CONNECTED:
+      _connected = true;
+      _pendingReason = MqttDisconnectReason::TCP_DISCONNECTED;
+      notifyConnected(event->session_present);
+    break;
+
+    case MQTT_EVENT_DISCONNECTED:
+      _connected = false;
+      notifyDisconnected(_pendingReason);
+      _pendingReason = MqttDisconnectReason::TCP_DISCONNECTED;
+    break;
+
+    case MQTT_EVENT_ERROR:
+      if (event->error_handle && event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED)
+        _pendingReason = static_cast<MqttDisconnectReason>(event->error_handle->connect_return_code);
+    break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+      notifySubscribed(uint16_t(event->msg_id), event->data_len > 0 ? uint8_t(event->data[0]) : 0);
+    break;
+
+    case MQTT_EVENT_UNSUBSCRIBED:
+      notifyUnsubscribed(uint16_t(event->msg_id));
+    break;
+
+    case MQTT_EVENT_PUBLISHED:
+      notifyPublishAcked(uint16_t(event->msg_id));
+    break;
+
+    case MQTT_EVENT_DATA: {
+      if (event->current_data_offset != 0 || event->data_len != event->total_data_len || event->topic_len >= ESP_MQTT_MAX_TOPIC) {
+        Serial.printf("Error: Ignoring fragmented MQTT message (%d bytes).\n", event->total_data_len);
+        break;
+      }
+      char topic[ESP_MQTT_MAX_TOPIC];  // not null-terminated in the event
+      memcpy(topic, event->topic, event->topic_len);
+      topic[event->topic_len] = '\0';
+      notifyMessage(topic, event->data, size_t(event->data_len));
+    }
+    break;
+
+    default:
+    break;
+  }
+}
+
+#endif
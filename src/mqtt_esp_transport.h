@@ -0,0 +1,70 @@
+/*
+  MqttTransport backed by ESP-IDF's native esp-mqtt client (mqtt_client.h), selected with
+  -DMQTT_BACKEND_ESP_MQTT (see the 'espmqtt' environment in platformio.ini).
+
+  esp-mqtt runs its own task with preallocated buffers instead of allocating per packet in the
+  AsyncTCP task. Its automatic reconnect is disabled so that the controller's reconnect timer stays
+  in charge, exactly as with the other backends. Written against the IDF 4.4 configuration struct
+  shipped with arduino-esp32 2.x.
+*/
+
+#pragma once
+
+#if defined(ARDUINO) && defined(MQTT_BACKEND_ESP_MQTT)
+
+#include <Arduino.h>
+#include <mqtt_client.h>
+
+#include "mqtt_transport.h"
+
+#ifndef ESP_MQTT_BUFFER_SIZE
+#define ESP_MQTT_BUFFER_SIZE 1024  // each of the rx and tx buffers; larger publishes are sent in pieces
+#endif
+
+#ifndef ESP_MQTT_TASK_STACK
+#define ESP_MQTT_TASK_STACK 6144
+#endif
+
+class MqttEspTransport : public MqttTransport {
+ public:
+  MqttEspTransport();
+  ~MqttEspTransport() override;
+
+  const char* name() const override { return "esp-mqtt"; }
+
+  void setServer(const char* host, uint16_t port) override;
+  void setCredentials(const char* user, const char* pass) override;
+  void setClientId(const char* clientId) override;
+  void setKeepAlive(uint16_t seconds) override;
+  void setCleanSession(bool cleanSession) override;
+  void setWill(const char* topic, uint8_t qos, bool retain, const char* payload) override;
+
+  void connect() override;
+  void disconnect() override;
+  bool connected() const override { return _connected; }
+
+  uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length = 0) override;
+  uint16_t subscribe(const char* topic, uint8_t qos) override;
+  uint16_t unsubscribe(const char* topic) override;
+
+ private:
+  static void eventHandler(void* arg, esp_event_base_t base, int32_t eventId, void* eventData);
+  void handleEvent(esp_mqtt_event_handle_t event);
+
+  esp_mqtt_client_handle_t _client;
+  esp_mqtt_client_config_t _config;
+  bool _configDirty;  // settings changed since the client was created/updated
+  bool _started;
+  volatile bool _connected;
+  MqttDisconnectReason _pendingReason;  // reported by MQTT_EVENT_ERROR, delivered with MQTT_EVENT_DISCONNECTED
+
+  // the config struct keeps raw pointers
+  String _host;
+  String _user;
+  String _pass;
+  String _clientId;
+  String _willTopic;
+  String _willPayload;
+};
+
+#endif
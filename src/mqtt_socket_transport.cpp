@@ -0,0 +1,863 @@
+#include "mqtt_socket_transport.h"
+#include "heap_stats.h"
+#include "sg_clock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#if __has_include(<netinet/tcp.h>)
+#include <netinet/tcp.h>  // lwIP may declare TCP_NODELAY in sys/socket.h instead
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if MQTT_TLS
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define SESSION_MASTER(s) ((s).MBEDTLS_PRIVATE(master))
+#define sha256(input, length, output) mbedtls_sha256(input, length, output, 0)
+#else
+#define SESSION_MASTER(s) ((s).master)
+#define sha256(input, length, output) mbedtls_sha256_ret(input, length, output, 0)
+#endif
+#endif
+
+// MQTT 3.1.1 control packet types (high nibble of the fixed header)
+enum : uint8_t {
+  MQTT_CONNECT = 0x10,
+  MQTT_CONNACK = 0x20,
+  MQTT_PUBLISH = 0x30,
+  MQTT_PUBACK = 0x40,
+  MQTT_PUBREC = 0x50,
+  MQTT_PUBREL = 0x60,
+  MQTT_PUBCOMP = 0x70,
+  MQTT_SUBSCRIBE = 0x80,
+  MQTT_SUBACK = 0x90,
+  MQTT_UNSUBSCRIBE = 0xA0,
+  MQTT_UNSUBACK = 0xB0,
+  MQTT_PINGREQ = 0xC0,
+  MQTT_PINGRESP = 0xD0,
+  MQTT_DISCONNECT = 0xE0
+};
+
+static size_t varintSize(size_t value) {
+  return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+MqttSocketTransport::MqttSocketTransport()
+  : _port(1883), _keepAlive(15), _cleanSession(true), _willQos(0), _willRetain(false), _fd(-1), _state(State::DISCONNECTED),
+    _up(false), _unlocked(false), _abort(false), _reconnect(false), _stateSinceMillis(0), _lastTxMillis(0), _pingSentMillis(0), _pingOutstanding(false), _lastPacketId(0), _generation(0),
+    _txLen(0), _rxLen(0) {
+#if MQTT_TLS
+  _tls = false;
+  _tlsConfigured = false;
+  _tlsPinned = false;
+  _sslActive = false;
+  _haveSession = false;
+  mbedtls_ssl_session_init(&_session);
+  memset(&_tlsStats, 0, sizeof(_tlsStats));
+#endif
+}
+
+MqttSocketTransport::~MqttSocketTransport() {
+  closeSocket();
+#if MQTT_TLS
+  setTls(nullptr, nullptr);  // releases the TLS configuration and the saved session
+#endif
+}
+
+void MqttSocketTransport::setServer(const char* host, uint16_t port) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _host = host;
+  _port = port;
+}
+
+void MqttSocketTransport::setCredentials(const char* user, const char* pass) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _user = user ? user : "";
+  _pass = pass ? pass : "";
+}
+
+void MqttSocketTransport::setClientId(const char* clientId) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _clientId = clientId;
+}
+
+void MqttSocketTransport::setKeepAlive(uint16_t seconds) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _keepAlive = seconds;
+}
+
+void MqttSocketTransport::setCleanSession(bool cleanSession) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _cleanSession = cleanSession;
+}
+
+void MqttSocketTransport::setWill(const char* topic, uint8_t qos, bool retain, const char* payload) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  _willTopic = topic ? topic : "";
+  _willPayload = payload ? payload : "";
+  _willQos = qos;
+  _willRetain = retain;
+}
+
+bool MqttSocketTransport::connected() const {
+  return __atomic_load_n(&_up, __ATOMIC_ACQUIRE);
+}
+
+void MqttSocketTransport::connect() {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  if (_unlocked && _abort) {
+    _reconnect = true;  // after the pending disconnect
+    return;
+  }
+  if (_state != State::DISCONNECTED)
+    return;
+
+  notifyConnecting();
+  _state = State::RESOLVING;
+  _stateSinceMillis = sgMillis();
+}
+
+void MqttSocketTransport::disconnect() {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  if (_state == State::DISCONNECTED)
+    return;
+  if (_unlocked) {
+    _abort = true;  // poll() is using the socket; it closes it when the step returns
+    _reconnect = false;
+    return;
+  }
+
+  if (_state == State::CONNECTED && beginPacket(MQTT_DISCONNECT, 0))
+    flushTx();
+#if MQTT_TLS
+  if (_sslActive && _state == State::CONNECTED)
+    mbedtls_ssl_close_notify(&_ssl);
+#endif
+  fail(MqttDisconnectReason::TCP_DISCONNECTED);
+}
+
+// poll() only, with the lock held once: the lookup runs without it
+bool MqttSocketTransport::openSocket() {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port[6];
+  snprintf(port, sizeof(port), "%u", unsigned(_port));
+  std::string host = _host;
+
+  addrinfo* result = nullptr;
+  _unlocked = true;
+  _lock.unlock();
+  int rc = getaddrinfo(host.c_str(), port, &hints, &result);
+  _lock.lock();
+  if (!resume()) {
+    if (result)
+      freeaddrinfo(result);
+    return true;  // resume() has closed the connect
+  }
+  if (rc != 0 || !result)
+    return false;
+
+  _fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (_fd < 0) {
+    freeaddrinfo(result);
+    return false;
+  }
+
+  int one = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // our packets are small and latency matters
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  rc = ::connect(_fd, result->ai_addr, result->ai_addrlen);
+  freeaddrinfo(result);
+  if (rc != 0 && errno != EINPROGRESS)
+    return false;
+
+  _txLen = 0;
+  _rxLen = 0;
+  _pingOutstanding = false;
+  _generation++;
+  _state = State::TCP_CONNECTING;
+  _stateSinceMillis = sgMillis();
+  return true;
+}
+
+void MqttSocketTransport::closeSocket() {
+#if MQTT_TLS
+  tlsEnd();
+#endif
+  if (_fd >= 0)
+    close(_fd);
+  _fd = -1;
+  _txLen = 0;
+  _rxLen = 0;
+  _state = State::DISCONNECTED;
+  __atomic_store_n(&_up, false, __ATOMIC_RELEASE);
+}
+
+// after a step without the lock: false if a disconnect() came meanwhile, which is carried out now
+bool MqttSocketTransport::resume() {
+  _unlocked = false;
+  if (!_abort)
+    return true;
+  _abort = false;
+  bool reconnect = _reconnect;
+  _reconnect = false;
+  fail(MqttDisconnectReason::TCP_DISCONNECTED);
+  if (reconnect)
+    connect();
+  return false;
+}
+
+void MqttSocketTransport::fail(MqttDisconnectReason reason) {
+  closeSocket();
+  notifyDisconnected(reason);
+}
+
+void MqttSocketTransport::poll() {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  uint32_t now = sgMillis();
+
+  switch (_state) {
+    case State::DISCONNECTED:
+      return;
+
+    case State::RESOLVING:
+      if (!openSocket())
+        fail(MqttDisconnectReason::TCP_DISCONNECTED);
+      return;
+
+    case State::TCP_CONNECTING: {
+      pollfd pfd = { _fd, POLLOUT, 0 };
+      if (::poll(&pfd, 1, 0) <= 0) {
+        if (now - _stateSinceMillis > MQTT_SOCKET_CONNECT_TIMEOUT_MS)
+          fail(MqttDisconnectReason::CONNECT_TIMEOUT);
+        return;
+      }
+
+      int error = 0;
+      socklen_t errorLength = sizeof(error);
+      getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+      if (error != 0) {
+        fail(MqttDisconnectReason::TCP_DISCONNECTED);
+        return;
+      }
+
+#if MQTT_TLS
+      if (_tls) {
+        _state = State::TLS_HANDSHAKE;
+        _stateSinceMillis = now;
+        if (!tlsBegin()) {
+          fail(MqttDisconnectReason::TLS_HANDSHAKE_FAILED);
+          return;
+        }
+        tlsHandshake();
+        if (_state != State::MQTT_CONNECTING)
+          return;
+        break;
+      }
+#endif
+      sendConnect();
+      _state = State::MQTT_CONNECTING;
+      _stateSinceMillis = now;
+    }
+    break;
+
+    case State::TLS_HANDSHAKE:
+#if MQTT_TLS
+      tlsHandshake();
+#endif
+      if (_state != State::MQTT_CONNECTING)
+        return;  // still shaking hands, or failed
+    break;
+
+    case State::MQTT_CONNECTING:
+      if (now - _stateSinceMillis > MQTT_SOCKET_CONNECT_TIMEOUT_MS) {
+        fail(MqttDisconnectReason::CONNECT_TIMEOUT);
+        return;
+      }
+    break;
+
+    case State::CONNECTED:
+      if (_keepAlive) {
+        uint32_t keepAliveMillis = uint32_t(_keepAlive) * 1000;
+        if (_pingOutstanding) {
+          if (now - _pingSentMillis > keepAliveMillis) {
+            fail(MqttDisconnectReason::KEEPALIVE_TIMEOUT);
+            return;
+          }
+        }
+        else if (now - _lastTxMillis >= keepAliveMillis && beginPacket(MQTT_PINGREQ, 0)) {
+          _pingOutstanding = true;
+          _pingSentMillis = now;
+        }
+      }
+    break;
+  }
+
+  if (!flushTx() || !readRx())
+    return;
+  processRx();
+}
+
+void MqttSocketTransport::sendConnect() {
+  bool hasUser = !_user.empty();
+  bool hasPass = hasUser && !_pass.empty();
+  bool hasWill = !_willTopic.empty();
+
+  size_t length = 10 + 2 + _clientId.size();
+  if (hasWill)
+    length += 2 + _willTopic.size() + 2 + _willPayload.size();
+  if (hasUser)
+    length += 2 + _user.size();
+  if (hasPass)
+    length += 2 + _pass.size();
+
+  uint8_t flags = 0;
+  if (hasUser)
+    flags |= 0x80;
+  if (hasPass)
+    flags |= 0x40;
+  if (hasWill)
+    flags |= 0x04 | (_willQos << 3) | (_willRetain ? 0x20 : 0);
+  if (_cleanSession)
+    flags |= 0x02;
+
+  if (!beginPacket(MQTT_CONNECT, length))
+    return;
+  putString("MQTT", 4);
+  putByte(4);  // protocol level 3.1.1
+  putByte(flags);
+  putU16(_keepAlive);
+  putString(_clientId.c_str(), _clientId.size());
+  if (hasWill) {
+    putString(_willTopic.c_str(), _willTopic.size());
+    putString(_willPayload.c_str(), _willPayload.size());
+  }
+  if (hasUser)
+    putString(_user.c_str(), _user.size());
+  if (hasPass)
+    putString(_pass.c_str(), _pass.size());
+}
+
+// bytes written, 0 if the socket would block, -1 once the connection is gone
+ssize_t MqttSocketTransport::ioSend(const uint8_t* data, size_t length) {
+#if MQTT_TLS
+  if (_sslActive) {
+    int n = mbedtls_ssl_write(&_ssl, data, length);
+    if (n >= 0)
+      return n;
+    return n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE ? 0 : -1;
+  }
+#endif
+  ssize_t n = send(_fd, data, length, MSG_NOSIGNAL);
+  if (n >= 0)
+    return n;
+  return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+// bytes read, 0 if nothing is available yet, -1 once the connection is closed or broken
+ssize_t MqttSocketTransport::ioRecv(uint8_t* data, size_t length) {
+#if MQTT_TLS
+  if (_sslActive) {
+    int n = mbedtls_ssl_read(&_ssl, data, length);
+    if (n > 0)
+      return n;
+    if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE)
+      return 0;
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+    if (n == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+      return 0;
+#endif
+    return -1;  // EOF, close_notify or a TLS error
+  }
+#endif
+  ssize_t n = recv(_fd, data, length, 0);
+  if (n > 0)
+    return n;
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+bool MqttSocketTransport::flushTx() {
+  size_t sent = 0;
+  while (sent < _txLen) {
+    ssize_t n = ioSend(_tx + sent, _txLen - sent);
+    if (n > 0) {
+      sent += size_t(n);
+      continue;
+    }
+    if (n == 0)
+      break;
+    fail(MqttDisconnectReason::TCP_DISCONNECTED);
+    return false;
+  }
+
+  if (sent) {
+    memmove(_tx, _tx + sent, _txLen - sent);
+    _txLen -= sent;
+    _lastTxMillis = sgMillis();
+  }
+  return true;
+}
+
+bool MqttSocketTransport::readRx() {
+  while (_rxLen < sizeof(_rx)) {
+    ssize_t n = ioRecv(_rx + _rxLen, sizeof(_rx) - _rxLen);
+    if (n > 0) {
+      _rxLen += size_t(n);
+      continue;
+    }
+    if (n == 0)
+      return true;
+    fail(MqttDisconnectReason::TCP_DISCONNECTED);
+    return false;
+  }
+  return true;
+}
+
+void MqttSocketTransport::processRx() {
+  size_t offset = 0;
+  uint32_t generation = _generation;
+
+  while (_rxLen - offset >= 2) {
+    const uint8_t* p = _rx + offset;
+    size_t available = _rxLen - offset;
+
+    // decode the remaining length (1-4 bytes, 7 bits each)
+    size_t remaining = 0;
+    size_t headerLength = 1;
+    bool complete = false;
+    for (int shift = 0; headerLength < available && shift <= 21; shift += 7) {
+      uint8_t b = p[headerLength++];
+      remaining |= size_t(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (headerLength > 4) {
+        fail(MqttDisconnectReason::PROTOCOL_ERROR);
+        return;
+      }
+      break;  // wait for more of the header
+    }
+
+    if (headerLength + remaining > sizeof(_rx)) {
+      fail(MqttDisconnectReason::PROTOCOL_ERROR);  // would never fit the buffer
+      return;
+    }
+    if (headerLength + remaining > available)
+      break;  // wait for the rest of the packet
+
+    handlePacket(p[0], p + headerLength, remaining);
+    if (_state == State::DISCONNECTED || _generation != generation)
+      return;  // a callback or the packet itself closed the connection and reset the buffers
+    offset += headerLength + remaining;
+  }
+
+  memmove(_rx, _rx + offset, _rxLen - offset);
+  _rxLen -= offset;
+  flushTx();  // acks queued while handling packets
+}
+
+void MqttSocketTransport::handlePacket(uint8_t header, const uint8_t* body, size_t length) {
+  uint8_t type = header & 0xF0;
+  uint16_t packetId = length >= 2 ? uint16_t(body[0] << 8 | body[1]) : 0;
+
+  switch (type) {
+    case MQTT_CONNACK:
+      if (_state != State::MQTT_CONNECTING || length < 2) {
+        fail(MqttDisconnectReason::PROTOCOL_ERROR);
+        return;
+      }
+      if (body[1] != 0) {
+        fail(body[1] <= 5 ? static_cast<MqttDisconnectReason>(body[1]) : MqttDisconnectReason::PROTOCOL_ERROR);
+        return;
+      }
+      _state = State::CONNECTED;
+      __atomic_store_n(&_up, true, __ATOMIC_RELEASE);
+      notifyConnected(body[0] & 0x01);
+    break;
+
+    case MQTT_PUBLISH:
+      handlePublish(header & 0x0F, body, length);
+    break;
+
+    case MQTT_PUBACK:
+      notifyPublishAcked(packetId);
+    break;
+
+    case MQTT_PUBREL:  // only seen if the broker delivers QoS 2 despite our QoS 1 subscriptions
+      queueAck(MQTT_PUBCOMP, packetId);
+    break;
+
+    case MQTT_SUBACK:
+      notifySubscribed(packetId, length >= 3 ? body[2] : 0x80);
+    break;
+
+    case MQTT_UNSUBACK:
+      notifyUnsubscribed(packetId);
+    break;
+
+    case MQTT_PINGRESP:
+      _pingOutstanding = false;
+    break;
+
+    default:  // PUBREC/PUBCOMP can't happen, we never publish at QoS 2
+    break;
+  }
+}
+
+void MqttSocketTransport::handlePublish(uint8_t flags, const uint8_t* body, size_t length) {
+  uint8_t qos = (flags >> 1) & 0x03;
+  if (length < 2) {
+    fail(MqttDisconnectReason::PROTOCOL_ERROR);
+    return;
+  }
+
+  size_t topicLength = size_t(body[0] << 8 | body[1]);
+  size_t offset = 2 + topicLength;
+  uint16_t packetId = 0;
+  if (qos) {
+    if (offset + 2 > length) {
+      fail(MqttDisconnectReason::PROTOCOL_ERROR);
+      return;
+    }
+    packetId = uint16_t(body[offset] << 8 | body[offset + 1]);
+    offset += 2;
+  }
+  if (offset > length) {
+    fail(MqttDisconnectReason::PROTOCOL_ERROR);
+    return;
+  }
+
+  // acknowledge first so the broker sees the ack even if the callback takes a while
+  if (qos == 1)
+    queueAck(MQTT_PUBACK, packetId);
+  else if (qos == 2)
+    queueAck(MQTT_PUBREC, packetId);
+
+  if (topicLength >= MQTT_SOCKET_MAX_TOPIC)
+    return;  // not one of ours
+
+  char topic[MQTT_SOCKET_MAX_TOPIC];
+  memcpy(topic, body + 2, topicLength);
+  topic[topicLength] = '\0';
+  notifyMessage(topic, reinterpret_cast<const char*>(body + offset), length - offset);
+}
+
+uint16_t MqttSocketTransport::publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  if (_state != State::CONNECTED)
+    return 0;
+
+  if (payload && !length)
+    length = strlen(payload);
+  size_t topicLength = strlen(topic);
+
+  uint8_t header = MQTT_PUBLISH | (qos > 0 ? 0x02 : 0x00) | (retain ? 0x01 : 0x00);
+  if (!beginPacket(header, 2 + topicLength + (qos > 0 ? 2 : 0) + length))
+    return 0;
+
+  uint16_t packetId = qos > 0 ? nextPacketId() : 1;
+  putString(topic, topicLength);
+  if (qos > 0)
+    putU16(packetId);
+  putBytes(payload, length);
+
+  notifyPublishSent(packetId, qos, length);
+  flushTx();
+  return packetId;
+}
+
+uint16_t MqttSocketTransport::subscribe(const char* topic, uint8_t qos) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  if (_state != State::CONNECTED)
+    return 0;
+
+  size_t topicLength = strlen(topic);
+  if (!beginPacket(MQTT_SUBSCRIBE | 0x02, 2 + 2 + topicLength + 1))
+    return 0;
+
+  uint16_t packetId = nextPacketId();
+  putU16(packetId);
+  putString(topic, topicLength);
+  putByte(qos);
+  flushTx();
+  return packetId;
+}
+
+uint16_t MqttSocketTransport::unsubscribe(const char* topic) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  if (_state != State::CONNECTED)
+    return 0;
+
+  size_t topicLength = strlen(topic);
+  if (!beginPacket(MQTT_UNSUBSCRIBE | 0x02, 2 + 2 + topicLength))
+    return 0;
+
+  uint16_t packetId = nextPacketId();
+  putU16(packetId);
+  putString(topic, topicLength);
+  flushTx();
+  return packetId;
+}
+
+bool MqttSocketTransport::beginPacket(uint8_t header, size_t remainingLength) {
+  if (remainingLength > 268435455 || _txLen + 1 + varintSize(remainingLength) + remainingLength > sizeof(_tx))
+    return false;
+
+  putByte(header);
+  do {
+    uint8_t b = remainingLength & 0x7F;
+    remainingLength >>= 7;
+    putByte(remainingLength ? (b | 0x80) : b);
+  } while (remainingLength);
+  return true;
+}
+
+void MqttSocketTransport::putU16(uint16_t v) {
+  putByte(uint8_t(v >> 8));
+  putByte(uint8_t(v));
+}
+
+void MqttSocketTransport::putBytes(const void* data, size_t length) {
+  if (length)
+    memcpy(_tx + _txLen, data, length);
+  _txLen += length;
+}
+
+void MqttSocketTransport::putString(const char* s, size_t length) {
+  putU16(uint16_t(length));
+  putBytes(s, length);
+}
+
+bool MqttSocketTransport::queueAck(uint8_t header, uint16_t packetId) {
+  if (!beginPacket(header, 2))
+    return false;
+  putU16(packetId);
+  return true;
+}
+
+uint16_t MqttSocketTransport::nextPacketId() {
+  if (++_lastPacketId == 0)
+    _lastPacketId = 1;
+  return _lastPacketId;
+}
+
+#if MQTT_TLS
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool MqttSocketTransport::setTls(const char* pinSha256, const char* caPem) {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+
+  // start from scratch; a new server identity invalidates the saved session
+  forgetTlsSession();
+  if (_tlsConfigured) {
+    mbedtls_ssl_config_free(&_tlsConfig);
+    mbedtls_x509_crt_free(&_tlsCa);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+    _tlsConfigured = false;
+  }
+  _tls = false;
+  _tlsPinned = false;
+  if (!pinSha256 && !caPem)
+    return false;
+
+  if (pinSha256) {
+    if (strlen(pinSha256) != 2 * sizeof(_tlsPin))
+      return false;
+    for (size_t i = 0; i < sizeof(_tlsPin); i++) {
+      int hi = hexDigit(pinSha256[2 * i]);
+      int lo = hexDigit(pinSha256[2 * i + 1]);
+      if (hi < 0 || lo < 0)
+        return false;
+      _tlsPin[i] = uint8_t(hi << 4 | lo);
+    }
+    _tlsPinned = true;
+  }
+
+  mbedtls_entropy_init(&_entropy);
+  mbedtls_ctr_drbg_init(&_drbg);
+  mbedtls_x509_crt_init(&_tlsCa);
+  mbedtls_ssl_config_init(&_tlsConfig);
+  _tlsConfigured = true;
+
+  if (caPem) {
+    _tlsCaPem = caPem;
+    if (mbedtls_x509_crt_parse(&_tlsCa, reinterpret_cast<const unsigned char*>(_tlsCaPem.c_str()), _tlsCaPem.size() + 1) != 0)
+      return false;
+  }
+
+  static const char personalization[] = "sgready-mqtt";
+  if (mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, reinterpret_cast<const unsigned char*>(personalization), sizeof(personalization) - 1) != 0)
+    return false;
+  if (mbedtls_ssl_config_defaults(&_tlsConfig, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+    return false;
+
+  // with only a pin the chain can't be verified; tlsPinMatches() authenticates the server instead
+  mbedtls_ssl_conf_authmode(&_tlsConfig, caPem ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_OPTIONAL);
+  if (caPem)
+    mbedtls_ssl_conf_ca_chain(&_tlsConfig, &_tlsCa, nullptr);
+  mbedtls_ssl_conf_rng(&_tlsConfig, mbedtls_ctr_drbg_random, &_drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&_tlsConfig, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+  _tls = true;
+  return true;
+}
+
+void MqttSocketTransport::forgetTlsSession() {
+  std::lock_guard<std::recursive_mutex> guard(_lock);
+  mbedtls_ssl_session_free(&_session);
+  mbedtls_ssl_session_init(&_session);
+  _haveSession = false;
+}
+
+bool MqttSocketTransport::tlsBegin() {
+  // the record buffers allocated by mbedtls_ssl_setup() count towards the handshake's heap cost
+  _handshakeStartMicros = sgMicros();
+  _handshakeHeapBase = heapInUse();
+  heapPeakReset();
+
+  mbedtls_ssl_init(&_ssl);
+  _sslActive = true;
+  if (mbedtls_ssl_setup(&_ssl, &_tlsConfig) != 0 || mbedtls_ssl_set_hostname(&_ssl, _host.c_str()) != 0)
+    return false;
+  mbedtls_ssl_set_bio(&_ssl, this, tlsSend, tlsRecv, nullptr);
+  if (_haveSession && mbedtls_ssl_set_session(&_ssl, &_session) != 0)
+    forgetTlsSession();  // not fatal, we just pay for a full handshake
+  return true;
+}
+
+// poll() only, with the lock held once: a handshake step is seconds of CPU, so it runs without it
+void MqttSocketTransport::tlsHandshake() {
+  _unlocked = true;
+  _lock.unlock();
+  int rc = mbedtls_ssl_handshake(&_ssl);
+  _lock.lock();
+  if (!resume())
+    return;
+  heapPeakSample();
+
+  if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    if (sgMillis() - _stateSinceMillis > MQTT_TLS_HANDSHAKE_TIMEOUT_MS) {
+      _tlsStats.failedHandshakes++;
+      fail(MqttDisconnectReason::CONNECT_TIMEOUT);
+    }
+    return;
+  }
+
+  if (rc != 0 || !tlsPinMatches()) {
+    _tlsStats.failedHandshakes++;
+    forgetTlsSession();  // a stale session may be why the server refused us
+    fail(rc != 0 ? MqttDisconnectReason::TLS_HANDSHAKE_FAILED : MqttDisconnectReason::TLS_BAD_FINGERPRINT);
+    return;
+  }
+
+  // a resumed handshake keeps the master secret of the session we offered
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  bool saved = mbedtls_ssl_get_session(&_ssl, &session) == 0;
+  bool resumed = saved && _haveSession &&
+    memcmp(SESSION_MASTER(session), SESSION_MASTER(_session), sizeof(SESSION_MASTER(session))) == 0;
+
+  uint32_t elapsed = sgMicros() - _handshakeStartMicros;
+  size_t peak = heapPeak();
+  uint32_t peakHeap = uint32_t(peak > _handshakeHeapBase ? peak - _handshakeHeapBase : 0);
+  _tlsStats.lastHandshakeMicros = elapsed;
+  _tlsStats.lastResumed = resumed;
+  _tlsStats.lastPeakHeap = peakHeap;
+  if (resumed) {
+    _tlsStats.resumedHandshakes++;
+    _tlsStats.resumedMicrosTotal += elapsed;
+    if (peakHeap > _tlsStats.resumedPeakHeap)
+      _tlsStats.resumedPeakHeap = peakHeap;
+  }
+  else {
+    _tlsStats.fullHandshakes++;
+    _tlsStats.fullMicrosTotal += elapsed;
+    if (peakHeap > _tlsStats.fullPeakHeap)
+      _tlsStats.fullPeakHeap = peakHeap;
+  }
+
+  if (saved) {
+    mbedtls_ssl_session_free(&_session);
+    _session = session;  // takes over the ticket and peer certificate
+    _haveSession = true;
+  }
+  else
+    mbedtls_ssl_session_free(&session);
+
+  sendConnect();
+  _state = State::MQTT_CONNECTING;
+  _stateSinceMillis = sgMillis();
+}
+
+bool MqttSocketTransport::tlsPinMatches() {
+  if (!_tlsPinned)
+    return true;
+
+  const mbedtls_x509_crt* peer = mbedtls_ssl_get_peer_cert(&_ssl);
+  if (!peer)
+    return false;
+
+  // mbedtls writes the DER at the end of the buffer; an RSA-4096 SubjectPublicKeyInfo is ~550 bytes
+  unsigned char der[1024];
+  int length = mbedtls_pk_write_pubkey_der(const_cast<mbedtls_pk_context*>(&peer->pk), der, sizeof(der));
+  if (length <= 0)
+    return false;
+
+  unsigned char hash[32];
+  sha256(der + sizeof(der) - length, size_t(length), hash);
+  return memcmp(hash, _tlsPin, sizeof(hash)) == 0;
+}
+
+void MqttSocketTransport::tlsEnd() {
+  if (_sslActive)
+    mbedtls_ssl_free(&_ssl);
+  _sslActive = false;
+}
+
+int MqttSocketTransport::tlsSend(void* ctx, const unsigned char* data, size_t length) {
+  ssize_t n = send(static_cast<MqttSocketTransport*>(ctx)->_fd, data, length, MSG_NOSIGNAL);
+  if (n >= 0)
+    return int(n);
+  return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int MqttSocketTransport::tlsRecv(void* ctx, unsigned char* data, size_t length) {
+  ssize_t n = recv(static_cast<MqttSocketTransport*>(ctx)->_fd, data, length, 0);
+  if (n >= 0)
+    return int(n);  // 0 is EOF
+  return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+#endif
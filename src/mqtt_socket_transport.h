@@ -0,0 +1,196 @@
+/*
+  MqttTransport over a plain non-blocking BSD socket, speaking MQTT 3.1.1 directly.
+
+  Written against the POSIX socket API only, so it builds on Linux for the native build and on
+  lwIP. There is no network task: poll() performs all I/O and must be called regularly (every few
+  milliseconds for good RTT figures). All public methods are thread-safe and callbacks are invoked
+  from inside poll(), so a callback may publish or subscribe directly.
+
+  connect() only starts a connect; poll() resolves the host with getaddrinfo(), which blocks, and
+  runs the TLS handshake, which takes seconds of CPU. Both run with the lock released, so another
+  task's publish() fails at once instead of waiting, and connected() never waits for the lock. A
+  disconnect() made meanwhile takes effect when the step returns.
+
+  Built with MQTT_TLS=1 the connection can be wrapped in TLS (mbedTLS) by calling setTls(). The
+  server is authenticated by a pinned SHA-256 of its public key, by a CA certificate, or both. The
+  session of the last successful handshake is kept and offered on the next connect, so a reconnect
+  normally costs an abbreviated handshake (session ticket or session ID) instead of a full one.
+  tlsStats() reports the time and peak heap of full versus resumed handshakes.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+#include "mqtt_transport.h"
+
+#if MQTT_TLS
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#endif
+
+#ifndef MQTT_SOCKET_TX_BUFFER
+#define MQTT_SOCKET_TX_BUFFER 4096  // outgoing bytes not yet accepted by the socket; publish() fails when full
+#endif
+
+#ifndef MQTT_SOCKET_RX_BUFFER
+#define MQTT_SOCKET_RX_BUFFER 2048  // largest packet we accept from the broker
+#endif
+
+#ifndef MQTT_SOCKET_MAX_TOPIC
+#define MQTT_SOCKET_MAX_TOPIC 128
+#endif
+
+#ifndef MQTT_SOCKET_CONNECT_TIMEOUT_MS
+#define MQTT_SOCKET_CONNECT_TIMEOUT_MS 5000  // TCP connect, and separately CONNECT to CONNACK
+#endif
+
+#ifndef MQTT_TLS_HANDSHAKE_TIMEOUT_MS
+#define MQTT_TLS_HANDSHAKE_TIMEOUT_MS 15000  // a full handshake takes seconds of CPU on the ESP32
+#endif
+
+struct MqttTlsStats {
+  uint32_t fullHandshakes;
+  uint32_t resumedHandshakes;
+  uint32_t failedHandshakes;
+  uint32_t lastHandshakeMicros;
+  bool lastResumed;
+  uint64_t fullMicrosTotal;     // divide by fullHandshakes for the mean
+  uint64_t resumedMicrosTotal;  // divide by resumedHandshakes for the mean
+  uint32_t lastPeakHeap;        // heap in use at the handshake's high-water mark, above the level before it
+  uint32_t fullPeakHeap;        // largest lastPeakHeap of each kind
+  uint32_t resumedPeakHeap;
+};
+
+class MqttSocketTransport : public MqttTransport {
+ public:
+  MqttSocketTransport();
+  ~MqttSocketTransport() override;
+
+  const char* name() const override { return "socket"; }
+
+  void setServer(const char* host, uint16_t port) override;
+  void setCredentials(const char* user, const char* pass) override;
+  void setClientId(const char* clientId) override;
+  void setKeepAlive(uint16_t seconds) override;
+  void setCleanSession(bool cleanSession) override;
+  void setWill(const char* topic, uint8_t qos, bool retain, const char* payload) override;
+
+  void connect() override;
+  void disconnect() override;
+  bool connected() const override;
+
+  uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length = 0) override;
+  uint16_t subscribe(const char* topic, uint8_t qos) override;
+  uint16_t unsubscribe(const char* topic) override;
+
+  void poll() override;
+
+  // bytes queued but not yet written to the socket
+  size_t pendingBytes() const { return _txLen; }
+
+#if MQTT_TLS
+  // enable TLS for the following connects; pinSha256 is the hex SHA-256 of the server's DER
+  // SubjectPublicKeyInfo, caPem a PEM certificate; either may be null but not both
+  bool setTls(const char* pinSha256, const char* caPem);
+  void forgetTlsSession();  // force the next handshake to be a full one
+  const MqttTlsStats& tlsStats() const { return _tlsStats; }
+#endif
+
+ private:
+  enum class State : uint8_t {
+    DISCONNECTED,
+    RESOLVING,        // connect() called, poll() looks up the host
+    TCP_CONNECTING,   // non-blocking connect() in progress
+    TLS_HANDSHAKE,
+    MQTT_CONNECTING,  // CONNECT sent, waiting for CONNACK
+    CONNECTED
+  };
+
+  bool openSocket();
+  void closeSocket();
+  bool resume();
+  void fail(MqttDisconnectReason reason);
+
+  void sendConnect();
+  ssize_t ioSend(const uint8_t* data, size_t length);
+  ssize_t ioRecv(uint8_t* data, size_t length);
+  bool flushTx();
+  bool readRx();
+  void processRx();
+  void handlePacket(uint8_t header, const uint8_t* body, size_t length);
+  void handlePublish(uint8_t flags, const uint8_t* body, size_t length);
+
+  bool beginPacket(uint8_t header, size_t remainingLength);
+  void putByte(uint8_t b) { _tx[_txLen++] = b; }
+  void putU16(uint16_t v);
+  void putBytes(const void* data, size_t length);
+  void putString(const char* s, size_t length);
+  bool queueAck(uint8_t header, uint16_t packetId);
+  uint16_t nextPacketId();
+
+  mutable std::recursive_mutex _lock;
+
+  std::string _host;
+  uint16_t _port;
+  std::string _user;
+  std::string _pass;
+  std::string _clientId;
+  uint16_t _keepAlive;
+  bool _cleanSession;
+  std::string _willTopic;  // empty = no will
+  std::string _willPayload;
+  uint8_t _willQos;
+  bool _willRetain;
+
+  int _fd;
+  State _state;
+  bool _up;          // _state == CONNECTED, for connected() without the lock
+  bool _unlocked;    // poll() runs a blocking step without the lock
+  bool _abort;       // disconnect() was called meanwhile
+  bool _reconnect;   // and connect() after it
+  uint32_t _stateSinceMillis;
+  uint32_t _lastTxMillis;
+  uint32_t _pingSentMillis;
+  bool _pingOutstanding;
+  uint16_t _lastPacketId;
+  uint32_t _generation;  // bumped per socket so processRx() notices a reconnect made from a callback
+
+  uint8_t _tx[MQTT_SOCKET_TX_BUFFER];
+  size_t _txLen;
+  uint8_t _rx[MQTT_SOCKET_RX_BUFFER];
+  size_t _rxLen;
+
+#if MQTT_TLS
+  bool tlsBegin();
+  void tlsHandshake();
+  bool tlsPinMatches();
+  void tlsEnd();
+  static int tlsSend(void* ctx, const unsigned char* data, size_t length);
+  static int tlsRecv(void* ctx, unsigned char* data, size_t length);
+
+  bool _tls;
+  bool _tlsConfigured;  // _tlsConfig, RNG and CA chain are set up
+  bool _tlsPinned;
+  uint8_t _tlsPin[32];
+  std::string _tlsCaPem;
+  mbedtls_entropy_context _entropy;
+  mbedtls_ctr_drbg_context _drbg;
+  mbedtls_x509_crt _tlsCa;
+  mbedtls_ssl_config _tlsConfig;
+  mbedtls_ssl_context _ssl;     // per connection, so its record buffers are freed while disconnected
+  bool _sslActive;
+  mbedtls_ssl_session _session;  // from the last good handshake, offered for resumption
+  bool _haveSession;
+  uint32_t _handshakeStartMicros;
+  size_t _handshakeHeapBase;
+  size_t _handshakeHeapPeak;
+  MqttTlsStats _tlsStats;
+#endif
+};
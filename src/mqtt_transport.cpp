@@ -0,0 +1,82 @@
+#include "mqtt_transport.h"
+#include "sg_clock.h"
+
+#include <string.h>
+
+static_assert((MQTT_RTT_SLOTS & (MQTT_RTT_SLOTS - 1)) == 0, "MQTT_RTT_SLOTS must be a power of two");
+
+MqttTransport::MqttTransport() {
+  resetStats();
+}
+
+void MqttTransport::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_inFlight, 0, sizeof(_inFlight));
+  _stats.minRttMicros = UINT32_MAX;
+  _connectStartMicros = 0;
+}
+
+void MqttTransport::notifyConnecting() {
+  _stats.connectAttempts++;
+  _connectStartMicros = sgMicros();
+}
+
+void MqttTransport::notifyConnected(bool sessionPresent) {
+  _stats.connects++;
+  _stats.lastConnectMicros = sgMicros() - _connectStartMicros;
+  if (_onConnect)
+    _onConnect(sessionPresent);
+}
+
+void MqttTransport::notifyDisconnected(MqttDisconnectReason reason) {
+  _stats.disconnects++;
+  memset(_inFlight, 0, sizeof(_inFlight));  // PUBACKs from the old session will never arrive
+  if (_onDisconnect)
+    _onDisconnect(reason);
+}
+
+void MqttTransport::notifyPublishSent(uint16_t packetId, uint8_t qos, size_t length) {
+  _stats.publishes++;
+  _stats.bytesPublished += length;
+  if (qos == 0 || packetId == 0)
+    return;
+
+  // a slot still in use belongs to a publish that was never acked; it simply loses its RTT sample
+  InFlight& slot = _inFlight[packetId & (MQTT_RTT_SLOTS - 1)];
+  slot.packetId = packetId;
+  slot.sentMicros = sgMicros();
+}
+
+void MqttTransport::notifyPublishAcked(uint16_t packetId) {
+  InFlight& slot = _inFlight[packetId & (MQTT_RTT_SLOTS - 1)];
+  if (slot.packetId == packetId) {
+    uint32_t rtt = sgMicros() - slot.sentMicros;
+    slot.packetId = 0;
+    _stats.acks++;
+    _stats.lastRttMicros = rtt;
+    _stats.totalRttMicros += rtt;
+    if (rtt < _stats.minRttMicros)
+      _stats.minRttMicros = rtt;
+    if (rtt > _stats.maxRttMicros)
+      _stats.maxRttMicros = rtt;
+  }
+
+  if (_onPublish)
+    _onPublish(packetId);
+}
+
+void MqttTransport::notifySubscribed(uint16_t packetId, uint8_t qos) {
+  if (_onSubscribe)
+    _onSubscribe(packetId, qos);
+}
+
+void MqttTransport::notifyUnsubscribed(uint16_t packetId) {
+  if (_onUnsubscribe)
+    _onUnsubscribe(packetId);
+}
+
+void MqttTransport::notifyMessage(const char* topic, const char* payload, size_t length) {
+  _stats.messagesReceived++;
+  if (_onMessage)
+    _onMessage(topic, payload, length);
+}
@@ -0,0 +1,130 @@
+/*
+  Abstract MQTT client used by the controller.
+
+  The firmware talks to the broker only through this interface so that the MQTT library can be
+  swapped without touching the control logic:
+
+    - MqttAsyncTransport  (mqtt_async_transport.h)  AsyncMqttClient, the default on the ESP32
+    - MqttEspTransport    (mqtt_esp_transport.h)    ESP-IDF's esp-mqtt client
+    - MqttSocketTransport (mqtt_socket_transport.h) plain non-blocking BSD sockets with optional TLS,
+                                                    also used by the native build
+
+  The API deliberately mirrors AsyncMqttClient. Backends report protocol events through the
+  protected notify*() helpers, which keep the connect time, publish-to-ack RTT and throughput
+  counters in stats() identical for every backend.
+
+  Message payloads handed to the onMessage callback are NOT null-terminated; always use 'length'.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+#ifndef MQTT_RTT_SLOTS
+#define MQTT_RTT_SLOTS 16  // QoS 1 publishes tracked for RTT at once; must be a power of two
+#endif
+
+// values 1..5 are the MQTT 3.1.1 CONNACK return codes
+enum class MqttDisconnectReason : uint8_t {
+  TCP_DISCONNECTED = 0,
+  MQTT_UNACCEPTABLE_PROTOCOL_VERSION = 1,
+  MQTT_IDENTIFIER_REJECTED = 2,
+  MQTT_SERVER_UNAVAILABLE = 3,
+  MQTT_MALFORMED_CREDENTIALS = 4,
+  MQTT_NOT_AUTHORIZED = 5,
+  CONNECT_TIMEOUT = 6,      // no CONNACK (or TCP connect) within the connect timeout
+  PROTOCOL_ERROR = 7,       // malformed or oversized packet from the broker
+  KEEPALIVE_TIMEOUT = 8,    // broker stopped answering PINGREQs
+  TLS_HANDSHAKE_FAILED = 9,
+  TLS_BAD_FINGERPRINT = 10  // server key does not match the pinned SHA-256
+};
+
+struct MqttStats {
+  uint32_t connectAttempts;
+  uint32_t connects;
+  uint32_t disconnects;
+  uint32_t lastConnectMicros;   // connect() to CONNACK of the latest successful connect
+  uint32_t publishes;
+  uint32_t acks;                // PUBACKs matched to a tracked publish
+  uint32_t lastRttMicros;       // publish() to PUBACK
+  uint32_t minRttMicros;
+  uint32_t maxRttMicros;
+  uint64_t totalRttMicros;      // divide by 'acks' for the mean
+  uint64_t bytesPublished;      // payload bytes handed to publish()
+  uint32_t messagesReceived;
+};
+
+class MqttTransport {
+ public:
+  typedef std::function<void(bool sessionPresent)> OnConnectCallback;
+  typedef std::function<void(MqttDisconnectReason reason)> OnDisconnectCallback;
+  typedef std::function<void(uint16_t packetId, uint8_t qos)> OnSubscribeCallback;
+  typedef std::function<void(uint16_t packetId)> OnUnsubscribeCallback;
+  typedef std::function<void(const char* topic, const char* payload, size_t length)> OnMessageCallback;
+  typedef std::function<void(uint16_t packetId)> OnPublishCallback;
+
+  MqttTransport();
+  virtual ~MqttTransport() {}
+
+  virtual const char* name() const = 0;
+
+  // configuration; strings are copied by the backend
+  virtual void setServer(const char* host, uint16_t port) = 0;
+  virtual void setCredentials(const char* user, const char* pass) = 0;
+  virtual void setClientId(const char* clientId) = 0;
+  virtual void setKeepAlive(uint16_t seconds) = 0;
+  virtual void setCleanSession(bool cleanSession) = 0;
+  // Last Will, published by the broker when the connection drops without a DISCONNECT; takes effect on the next connect
+  virtual void setWill(const char* topic, uint8_t qos, bool retain, const char* payload) = 0;
+
+  virtual void connect() = 0;
+  virtual void disconnect() = 0;
+  virtual bool connected() const = 0;
+
+  // return the packet id, 1 for an accepted QoS 0 publish, or 0 on failure
+  virtual uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length = 0) = 0;
+  virtual uint16_t subscribe(const char* topic, uint8_t qos) = 0;
+  virtual uint16_t unsubscribe(const char* topic) = 0;
+
+  // drive the connection; backends without their own network task must have this called regularly
+  virtual void poll() {}
+
+  void onConnect(OnConnectCallback cb) { _onConnect = cb; }
+  void onDisconnect(OnDisconnectCallback cb) { _onDisconnect = cb; }
+  void onSubscribe(OnSubscribeCallback cb) { _onSubscribe = cb; }
+  void onUnsubscribe(OnUnsubscribeCallback cb) { _onUnsubscribe = cb; }
+  void onMessage(OnMessageCallback cb) { _onMessage = cb; }
+  void onPublish(OnPublishCallback cb) { _onPublish = cb; }
+
+  const MqttStats& stats() const { return _stats; }
+  void resetStats();
+
+ protected:
+  void notifyConnecting();
+  void notifyConnected(bool sessionPresent);
+  void notifyDisconnected(MqttDisconnectReason reason);
+  void notifyPublishSent(uint16_t packetId, uint8_t qos, size_t length);
+  void notifyPublishAcked(uint16_t packetId);
+  void notifySubscribed(uint16_t packetId, uint8_t qos);
+  void notifyUnsubscribed(uint16_t packetId);
+  void notifyMessage(const char* topic, const char* payload, size_t length);
+
+ private:
+  struct InFlight {
+    uint16_t packetId;  // 0 = slot free
+    uint32_t sentMicros;
+  };
+
+  OnConnectCallback _onConnect;
+  OnDisconnectCallback _onDisconnect;
+  OnSubscribeCallback _onSubscribe;
+  OnUnsubscribeCallback _onUnsubscribe;
+  OnMessageCallback _onMessage;
+  OnPublishCallback _onPublish;
+
+  MqttStats _stats;
+  uint32_t _connectStartMicros;
+  InFlight _inFlight[MQTT_RTT_SLOTS];  // indexed by packet id, so lookups are O(1)
+};
@@ -0,0 +1,363 @@
+#ifndef ARDUINO
+
+#include "oled_emulator.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// the SSD1306 commands the driver sends
+#define CMD_DISPLAYOFF 0xae
+#define CMD_DISPLAYON 0xaf
+#define CMD_SETCONTRAST 0x81
+#define CMD_SETPRECHARGE 0xd9
+#define CMD_SETVCOMDETECT 0xdb
+#define CMD_SEGREMAP 0xa0
+#define CMD_COMSCANINC 0xc0
+#define CMD_COMSCANDEC 0xc8
+#define CMD_COLUMNADDR 0x21
+#define CMD_PAGEADDR 0x22
+
+#define INIT_COMMANDS 26  // sendInitCommands() in the driver
+
+#define FONT_FIRST ' '
+#define FONT_LAST '~'
+#define FONT_ADVANCE 6
+
+// 5x7 ASCII, one byte per column, least significant bit at the top
+static const uint8_t FONT[FONT_LAST - FONT_FIRST + 1][5] = {
+  { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5f, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+  { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+  { 0x36, 0x49, 0x56, 0x20, 0x50 }, { 0x00, 0x08, 0x07, 0x03, 0x00 }, { 0x00, 0x1c, 0x22, 0x41, 0x00 },
+  { 0x00, 0x41, 0x22, 0x1c, 0x00 }, { 0x2a, 0x1c, 0x7f, 0x1c, 0x2a }, { 0x08, 0x08, 0x3e, 0x08, 0x08 },
+  { 0x00, 0x80, 0x70, 0x30, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x00, 0x60, 0x60, 0x00 },
+  { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3e, 0x51, 0x49, 0x45, 0x3e }, { 0x00, 0x42, 0x7f, 0x40, 0x00 },
+  { 0x72, 0x49, 0x49, 0x49, 0x46 }, { 0x21, 0x41, 0x49, 0x4d, 0x33 }, { 0x18, 0x14, 0x12, 0x7f, 0x10 },
+  { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3c, 0x4a, 0x49, 0x49, 0x31 }, { 0x41, 0x21, 0x11, 0x09, 0x07 },
+  { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x46, 0x49, 0x49, 0x29, 0x1e }, { 0x00, 0x00, 0x14, 0x00, 0x00 },
+  { 0x00, 0x40, 0x34, 0x00, 0x00 }, { 0x00, 0x08, 0x14, 0x22, 0x41 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+  { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x59, 0x09, 0x06 }, { 0x3e, 0x41, 0x5d, 0x59, 0x4e },
+  { 0x7c, 0x12, 0x11, 0x12, 0x7c }, { 0x7f, 0x49, 0x49, 0x49, 0x36 }, { 0x3e, 0x41, 0x41, 0x41, 0x22 },
+  { 0x7f, 0x41, 0x41, 0x41, 0x3e }, { 0x7f, 0x49, 0x49, 0x49, 0x41 }, { 0x7f, 0x09, 0x09, 0x09, 0x01 },
+  { 0x3e, 0x41, 0x41, 0x51, 0x73 }, { 0x7f, 0x08, 0x08, 0x08, 0x7f }, { 0x00, 0x41, 0x7f, 0x41, 0x00 },
+  { 0x20, 0x40, 0x41, 0x3f, 0x01 }, { 0x7f, 0x08, 0x14, 0x22, 0x41 }, { 0x7f, 0x40, 0x40, 0x40, 0x40 },
+  { 0x7f, 0x02, 0x1c, 0x02, 0x7f }, { 0x7f, 0x04, 0x08, 0x10, 0x7f }, { 0x3e, 0x41, 0x41, 0x41, 0x3e },
+  { 0x7f, 0x09, 0x09, 0x09, 0x06 }, { 0x3e, 0x41, 0x51, 0x21, 0x5e }, { 0x7f, 0x09, 0x19, 0x29, 0x46 },
+  { 0x26, 0x49, 0x49, 0x49, 0x32 }, { 0x03, 0x01, 0x7f, 0x01, 0x03 }, { 0x3f, 0x40, 0x40, 0x40, 0x3f },
+  { 0x1f, 0x20, 0x40, 0x20, 0x1f }, { 0x3f, 0x40, 0x38, 0x40, 0x3f }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+  { 0x03, 0x04, 0x78, 0x04, 0x03 }, { 0x61, 0x59, 0x49, 0x4d, 0x43 }, { 0x00, 0x7f, 0x41, 0x41, 0x41 },
+  { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x41, 0x7f }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+  { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x03, 0x07, 0x08, 0x00 }, { 0x20, 0x54, 0x54, 0x78, 0x40 },
+  { 0x7f, 0x28, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x28 }, { 0x38, 0x44, 0x44, 0x28, 0x7f },
+  { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x00, 0x08, 0x7e, 0x09, 0x02 }, { 0x18, 0xa4, 0xa4, 0x9c, 0x78 },
+  { 0x7f, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7d, 0x40, 0x00 }, { 0x20, 0x40, 0x40, 0x3d, 0x00 },
+  { 0x7f, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7f, 0x40, 0x00 }, { 0x7c, 0x04, 0x78, 0x04, 0x78 },
+  { 0x7c, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0xfc, 0x18, 0x24, 0x24, 0x18 },
+  { 0x18, 0x24, 0x24, 0x18, 0xfc }, { 0x7c, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x24 },
+  { 0x04, 0x04, 0x3f, 0x44, 0x24 }, { 0x3c, 0x40, 0x40, 0x20, 0x7c }, { 0x1c, 0x20, 0x40, 0x20, 0x1c },
+  { 0x3c, 0x40, 0x30, 0x40, 0x3c }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x4c, 0x90, 0x90, 0x90, 0x7c },
+  { 0x44, 0x64, 0x54, 0x4c, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x77, 0x00, 0x00 },
+  { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x02, 0x01, 0x02, 0x04, 0x02 },
+};
+
+OledEmulator::OledEmulator(uint32_t busHz)
+  : buffer(), _shown(), _window{ 0, OLED_WIDTH - 1, 0, OLED_HEIGHT / 8 - 1 }, _column(0), _page(0), _shownValid(false), _on(false), _contrast(0), _argument(0), _color(WHITE), _alignment(TEXT_ALIGN_LEFT), _busHz(busHz), _stats() {
+}
+
+void OledEmulator::transaction(size_t payload) {
+  uint32_t micros = uint32_t((uint64_t(1 + payload) * 9 + 2) * 1000000 / _busHz);
+  _stats.transactions++;
+  _stats.bytes += 1 + payload;
+  _stats.busMicros += micros;
+  _stats.maxTransactionMicros = micros > _stats.maxTransactionMicros ? micros : _stats.maxTransactionMicros;
+}
+
+void OledEmulator::command(uint8_t c) {
+  transaction(2);  // control byte 0x80, command
+  if (_argument) {  // the byte after a command that takes one
+    if (_argument == CMD_SETCONTRAST)
+      _contrast = c;
+    _argument = 0;
+    return;
+  }
+  if (c == CMD_SETCONTRAST || c == CMD_SETPRECHARGE || c == CMD_SETVCOMDETECT)
+    _argument = c;
+  else if (c == CMD_DISPLAYON)
+    _on = true;
+  else if (c == CMD_DISPLAYOFF)
+    _on = false;
+}
+
+void OledEmulator::write(const uint8_t* data, size_t length) {
+  transaction(length);
+  if (!length)
+    return;
+  if (data[0] == 0x40) {
+    for (size_t i = 1; i < length; i++) {
+      _shown[_column + _page * OLED_WIDTH] = data[i];
+      if (++_column > _window[1]) {
+        _column = _window[0];
+        _page = _page >= _window[3] ? _window[2] : _page + 1;
+      }
+    }
+    return;
+  }
+  for (size_t i = 1; i < length; i++) {
+    uint8_t c = data[i];
+    if ((c == CMD_COLUMNADDR || c == CMD_PAGEADDR) && i + 2 < length) {
+      uint8_t* w = _window + (c == CMD_PAGEADDR ? 2 : 0);
+      w[0] = data[++i];
+      w[1] = data[++i];
+      _column = _window[0];
+      _page = _window[2];
+    }
+    else if (c == CMD_SETCONTRAST && i + 1 < length)
+      _contrast = data[++i];
+    else if (c == CMD_SETPRECHARGE || c == CMD_SETVCOMDETECT)
+      i++;  // one argument
+    else if (c == CMD_DISPLAYON)
+      _on = true;
+    else if (c == CMD_DISPLAYOFF)
+      _on = false;
+  }
+}
+
+void OledEmulator::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+bool OledEmulator::init() {
+  for (int i = 0; i < INIT_COMMANDS - 1; i++)
+    command(0);
+  command(CMD_DISPLAYON);
+  _contrast = 0xcf;  // what sendInitCommands() sets for a 128x64 panel
+  _shownValid = false;
+  clear();
+  display();
+  return true;
+}
+
+void OledEmulator::display() {
+  int minX = OLED_WIDTH, maxX = -1, minPage = OLED_HEIGHT / 8, maxPage = -1;
+  for (int page = 0; page < OLED_HEIGHT / 8; page++)
+    for (int x = 0; x < OLED_WIDTH; x++) {
+      int i = x + page * OLED_WIDTH;
+      if (_shownValid && buffer[i] == _shown[i])
+        continue;
+      _shown[i] = buffer[i];
+      minX = x < minX ? x : minX;
+      maxX = x > maxX ? x : maxX;
+      minPage = page < minPage ? page : minPage;
+      maxPage = page;
+    }
+  _shownValid = true;
+  if (maxX < 0) {
+    _stats.skipped++;
+    return;
+  }
+
+  _stats.flushes++;
+  const uint8_t addressing[] = { CMD_COLUMNADDR, uint8_t(minX), uint8_t(maxX), CMD_PAGEADDR, uint8_t(minPage), uint8_t(maxPage) };
+  for (uint8_t c : addressing)
+    command(c);
+  size_t bytes = size_t(maxX - minX + 1) * (maxPage - minPage + 1);
+  for (; bytes > OLED_I2C_CHUNK; bytes -= OLED_I2C_CHUNK)
+    transaction(1 + OLED_I2C_CHUNK);  // control byte 0x40, data
+  transaction(1 + bytes);
+}
+
+void OledEmulator::clear() {
+  memset(buffer, 0, sizeof(buffer));
+}
+
+void OledEmulator::displayOn() {
+  command(CMD_DISPLAYON);
+}
+
+void OledEmulator::displayOff() {
+  command(CMD_DISPLAYOFF);
+}
+
+void OledEmulator::setContrast(uint8_t contrast, uint8_t precharge, uint8_t comdetect) {
+  const uint8_t commands[] = { CMD_SETPRECHARGE, precharge, CMD_SETCONTRAST, contrast, CMD_SETVCOMDETECT, comdetect };
+  for (uint8_t c : commands)
+    command(c);
+}
+
+void OledEmulator::setBrightness(uint8_t brightness) {
+  uint8_t contrast = brightness < 128 ? brightness * 1.171 : brightness * 1.171 - 43;  // as the driver computes it
+  uint8_t precharge = brightness == 0 ? 0 : 241;
+  uint8_t comdetect = brightness / 8;
+  setContrast(contrast, precharge, comdetect);
+}
+
+void OledEmulator::flipScreenVertically() {
+  command(CMD_SEGREMAP | 0x01);
+  command(CMD_COMSCANDEC);
+}
+
+void OledEmulator::resetOrientation() {
+  command(CMD_SEGREMAP);
+  command(CMD_COMSCANINC);
+}
+
+void OledEmulator::drawColumn(int16_t x, int16_t y, uint8_t bits) {
+  if (x < 0 || x >= OLED_WIDTH || !bits)
+    return;
+  for (int part = 0; part < 2; part++) {  // a byte that doesn't start on a page boundary spans two pages
+    int16_t top = part ? y + 8 - (y & 7) : y;
+    if (top < 0 || top >= OLED_HEIGHT || (part && !(y & 7)))
+      continue;
+    uint8_t mask = part ? uint8_t(bits >> (8 - (y & 7))) : uint8_t(bits << (y & 7));
+    uint8_t& b = buffer[x + (top / 8) * OLED_WIDTH];
+    switch (_color) {
+      case WHITE:   b |= mask; break;
+      case BLACK:   b &= ~mask; break;
+      case INVERSE: b ^= mask; break;
+    }
+  }
+}
+
+void OledEmulator::setPixel(int16_t x, int16_t y) {
+  if (y >= 0 && y < OLED_HEIGHT)
+    drawColumn(x, y & ~7, uint8_t(1 << (y & 7)));
+}
+
+void OledEmulator::drawHorizontalLine(int16_t x, int16_t y, int16_t length) {
+  for (int16_t i = 0; i < length; i++)
+    setPixel(x + i, y);
+}
+
+void OledEmulator::drawVerticalLine(int16_t x, int16_t y, int16_t length) {
+  for (int16_t i = 0; i < length; i++)
+    setPixel(x, y + i);
+}
+
+void OledEmulator::fillRect(int16_t x, int16_t y, int16_t width, int16_t height) {
+  for (int16_t i = 0; i < width; i++)
+    drawVerticalLine(x + i, y, height);
+}
+
+// the driver's drawInternal(): column-major, (height + 7) / 8 bytes per column
+void OledEmulator::drawFastImage(int16_t x, int16_t y, int16_t width, int16_t height, const uint8_t* image) {
+  int rows = (height + 7) / 8;
+  for (int16_t c = 0; c < width; c++)
+    for (int r = 0; r < rows; r++)
+      drawColumn(x + c, y + 8 * r, image[c * rows + r]);
+}
+
+uint16_t OledEmulator::getStringWidth(const char*, uint16_t length, bool) {
+  return uint16_t(length * FONT_ADVANCE);
+}
+
+uint16_t OledEmulator::drawString(int16_t x, int16_t y, const char* text) {
+  uint16_t width = getStringWidth(text, uint16_t(strlen(text)));
+  if (_alignment == TEXT_ALIGN_RIGHT)
+    x -= width;
+  else if (_alignment != TEXT_ALIGN_LEFT)
+    x -= width / 2;
+  for (; *text; text++, x += FONT_ADVANCE) {
+    char c = *text >= FONT_FIRST && *text <= FONT_LAST ? *text : '?';
+    for (int i = 0; i < 5; i++)
+      drawColumn(x + i, y, FONT[c - FONT_FIRST][i]);
+  }
+  return width;
+}
+
+uint16_t OledEmulator::drawStringf(int16_t x, int16_t y, char* buffer, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, 100, format, args);  // the driver assumes a buffer of this size too
+  va_end(args);
+  return drawString(x, y, buffer);
+}
+
+// PNG with stored (uncompressed) deflate blocks, so no zlib is needed
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+  }
+  return ~crc;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v >> 24);
+  p[1] = uint8_t(v >> 16);
+  p[2] = uint8_t(v >> 8);
+  p[3] = uint8_t(v);
+}
+
+static void writeChunk(FILE* f, const char* type, const uint8_t* data, size_t length) {
+  uint8_t header[8];
+  put32(header, uint32_t(length));
+  memcpy(header + 4, type, 4);
+  uint8_t trailer[4];
+  put32(trailer, crc32(crc32(0, header + 4, 4), data, length));
+  fwrite(header, 1, 8, f);
+  fwrite(data, 1, length, f);
+  fwrite(trailer, 1, 4, f);
+}
+
+bool OledEmulator::writePng(const char* path, int scale) const {
+  const size_t width = OLED_WIDTH * scale, height = OLED_HEIGHT * scale;
+  const size_t stride = 1 + width;  // filter byte, one gray byte per pixel
+  const size_t raw = stride * height;
+  const size_t blocks = (raw + 65534) / 65535;
+
+  uint8_t* image = new uint8_t[raw];
+  for (size_t y = 0; y < height; y++) {
+    uint8_t* row = image + y * stride;
+    row[0] = 0;
+    for (size_t x = 0; x < width; x++) {
+      size_t px = x / scale, py = y / scale;
+      bool lit = _on && (_shown[px + (py / 8) * OLED_WIDTH] >> (py & 7) & 1);
+      row[1 + x] = lit ? 0xff : 0x00;
+    }
+  }
+
+  size_t zlength = 2 + raw + 5 * blocks + 4;
+  uint8_t* z = new uint8_t[zlength];
+  uint8_t* p = z;
+  *p++ = 0x78;
+  *p++ = 0x01;
+  uint32_t a = 1, b = 0;
+  for (size_t offset = 0; offset < raw;) {
+    size_t n = raw - offset < 65535 ? raw - offset : 65535;
+    *p++ = offset + n == raw;  // BFINAL, stored
+    *p++ = uint8_t(n);
+    *p++ = uint8_t(n >> 8);
+    *p++ = uint8_t(~n);
+    *p++ = uint8_t(~n >> 8);
+    memcpy(p, image + offset, n);
+    for (size_t i = 0; i < n; i++) {
+      a = (a + p[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    p += n;
+    offset += n;
+  }
+  put32(p, b << 16 | a);
+
+  uint8_t ihdr[13];
+  put32(ihdr, uint32_t(width));
+  put32(ihdr + 4, uint32_t(height));
+  const uint8_t rest[] = { 8, 0, 0, 0, 0 };  // 8 bit grayscale, no interlace
+  memcpy(ihdr + 8, rest, sizeof(rest));
+
+  FILE* f = fopen(path, "wb");
+  if (f) {
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, f);
+    writeChunk(f, "IHDR", ihdr, sizeof(ihdr));
+    writeChunk(f, "IDAT", z, zlength);
+    writeChunk(f, "IEND", nullptr, 0);
+    fclose(f);
+  }
+  delete[] image;
+  delete[] z;
+  return f != nullptr;
+}
+
+#endif
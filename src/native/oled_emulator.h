@@ -0,0 +1,101 @@
+/*
+  Headless stand-in for the SSD1306 driver (thingpulse "ESP8266 and ESP32 OLED driver for SSD1306
+  displays", SSD1306Wire), for the native build.
+
+  It has the same drawing API, so display_ui.h renders into it unchanged, and a 128x64 framebuffer
+  in the same page layout. display() does what the real driver does with its default double
+  buffer. It compares the framebuffer with what the panel already shows and sends only the
+  bounding box of the changed bytes: six addressing commands, then the data in transactions of 16
+  bytes. Nothing goes out when nothing changed. No bytes are actually sent. Instead every
+  transaction is counted, with the bus time it would take at the configured clock. Commands
+  (init, flip, on/off, contrast) are counted the same way, and on() and contrast() follow them.
+
+  write() takes one raw I2C transaction, as display_flush.h produces them: a control byte, then
+  commands (0x00) or data (0x40). The data lands in the panel's memory at the column and page
+  window the commands set, as in the controller's horizontal addressing mode.
+
+  Text uses a built-in 5x7 font instead of the driver's proportional ArialMT_Plain_10, so text
+  positions and widths differ slightly from the board. Glyph fields, images and pixels come out
+  exactly as on the board. writePng() saves what the panel shows as of the last display(), for
+  comparison with reference snapshots.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define OLED_WIDTH 128
+#define OLED_HEIGHT 64
+#define OLED_BUFFER_SIZE (OLED_WIDTH * OLED_HEIGHT / 8)
+#define OLED_I2C_CHUNK 16  // data bytes per transaction, as I2C_MAX_TRANSFER_BYTE - 1 in the driver
+
+enum OLEDDISPLAY_TEXT_ALIGNMENT { TEXT_ALIGN_LEFT, TEXT_ALIGN_RIGHT, TEXT_ALIGN_CENTER, TEXT_ALIGN_CENTER_BOTH };
+enum OLEDDISPLAY_COLOR { BLACK, WHITE, INVERSE };
+
+struct OledBusStats {
+  uint32_t transactions;
+  uint32_t bytes;      // on the bus, the address byte of each transaction included
+  uint32_t flushes;    // display() calls that sent data
+  uint32_t skipped;    // display() calls with nothing to send
+  uint64_t busMicros;  // at the bus clock: 9 clocks per byte, 2 per start and stop
+  uint32_t maxTransactionMicros;
+};
+
+class OledEmulator {
+ public:
+  explicit OledEmulator(uint32_t busHz = 700000);
+
+  bool init();
+  void display();
+  void clear();
+  void displayOn();
+  void displayOff();
+  void setContrast(uint8_t contrast, uint8_t precharge = 241, uint8_t comdetect = 64);
+  void setBrightness(uint8_t brightness);
+  void flipScreenVertically();
+  void resetOrientation();
+
+  void setColor(OLEDDISPLAY_COLOR color) { _color = color; }
+  void setPixel(int16_t x, int16_t y);
+  void drawHorizontalLine(int16_t x, int16_t y, int16_t length);
+  void drawVerticalLine(int16_t x, int16_t y, int16_t length);
+  void fillRect(int16_t x, int16_t y, int16_t width, int16_t height);
+  void drawFastImage(int16_t x, int16_t y, int16_t width, int16_t height, const uint8_t* image);
+
+  void setTextAlignment(OLEDDISPLAY_TEXT_ALIGNMENT alignment) { _alignment = alignment; }
+  uint16_t drawString(int16_t x, int16_t y, const char* text);
+  uint16_t drawStringf(int16_t x, int16_t y, char* buffer, const char* format, ...) __attribute__((format(printf, 5, 6)));
+  uint16_t getStringWidth(const char* text, uint16_t length, bool utf8 = false);
+
+  void write(const uint8_t* data, size_t length);  // one I2C transaction to the panel
+
+  uint16_t getWidth() const { return OLED_WIDTH; }
+  uint16_t getHeight() const { return OLED_HEIGHT; }
+
+  const OledBusStats& stats() const { return _stats; }
+  void resetStats();
+  bool on() const { return _on; }
+  uint8_t contrast() const { return _contrast; }
+  const uint8_t* shown() const { return _shown; }  // what the panel holds
+  bool writePng(const char* path, int scale = 4) const;
+
+  uint8_t buffer[OLED_BUFFER_SIZE];
+
+ private:
+  void command(uint8_t c);
+  void transaction(size_t payload);
+  void drawColumn(int16_t x, int16_t y, uint8_t bits);
+
+  uint8_t _shown[OLED_BUFFER_SIZE];  // the driver's buffer_back, which matches the panel
+  uint8_t _window[4];                // first and last column, first and last page
+  uint8_t _column, _page;            // where the next data byte goes
+  bool _shownValid;                  // false until the first display() sends everything
+  bool _on;
+  uint8_t _contrast;
+  uint8_t _argument;                 // the command waiting for its argument byte, if any
+  OLEDDISPLAY_COLOR _color;
+  OLEDDISPLAY_TEXT_ALIGNMENT _alignment;
+  uint32_t _busHz;
+  OledBusStats _stats;
+};
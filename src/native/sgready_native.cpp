@@ -0,0 +1,1002 @@
+/*
+  Native (host) driver for the portable parts of the firmware.
+
+  Build and run with PlatformIO against a local broker, e.g. mosquitto:
+
+    mosquitto -p 1883 &
+    pio run -e native && .pio/build/native/program bench 127.0.0.1 1883 [user pass] [count]
+
+  'bench' measures the same figures the firmware reports over serial through MqttTransport::stats():
+  connect time, publish-to-ack RTT and QoS 1 publish throughput.
+
+  'tls-bench' (native_tls environment, broker listening with TLS) alternates full and resumed
+  handshakes and reports the time and peak heap of each kind:
+
+    .pio/build/native_tls/program tls-bench 127.0.0.1 8883 <pin-sha256|-> <ca.pem|-> [rounds]
+
+  'standby' runs the hot-standby leadership (leadership.h) with a simulated mode, so a failover can
+  be timed with two instances; tools/failover_test.py starts both, kills the leader and measures.
+  With <stall-s>, the node stops sending publishes and ignores their acks that many seconds after it
+  starts, while its connection stays up; the script uses it for a leader that loses its acks:
+
+    .pio/build/native/program standby 127.0.0.1 1883 <node> [<mode> [<stall-s>]]
+
+  'broker-failover' publishes QoS 1 through a BrokerPool (broker_pool.h) of two brokers and reports
+  how long it takes to get acknowledgements again when one of them dies; tools/broker_failover_test.py
+  kills the primary mid-run:
+
+    .pio/build/native/program broker-failover 127.0.0.1 1883 1884 [seconds]
+
+  'tariff' sets its clock from an SNTP server, usually the stand-in tools/sntp_server.py started a
+  few seconds before a tariff boundary, and ticks once a second like the firmware. It prints how
+  long each cheap/normal change came after the hour and what one evaluation costs (tariff.h):
+
+    TZ=CET-1CEST,M3.5.0,M10.5.0/3 .pio/build/native/program tariff 127.0.0.1 12300 "Mo-Fr 0-6,22-24" ["12-25"] [seconds]
+
+  'display' plays a scripted run through the status screen (display_ui.h) on the SSD1306 emulator
+  (oled_emulator.h), with both renderers and with the chunked flush (display_flush.h), and through
+  the other pages (display_pages.h). It reports render time, I2C traffic per frame and the longest
+  single transaction, which is the longest the bus is held at once. The history page is measured
+  twice: scrolling its chart one column per frame, and redrawing the whole chart every frame. With a directory, it writes a PNG snapshot of every frame for comparison
+  with reference snapshots:
+
+    .pio/build/native/program display [<frames>] [<dir>]
+
+  'display-power' plays a scripted day, one view a second, through the power policies of
+  display_power.h, the chunked flush and the emulator. Per policy it reports I2C bytes and
+  transactions per day, how long the emulated panel was lit, dim and off, and the savings against
+  always on:
+
+    .pio/build/native/program display-power [<hours>]
+
+  'button' replays bouncing presses of the override button (override_button.h). A SIGALRM handler
+  stands in for the ISR: at each scripted edge it stamps the time and pushes the edge into the
+  EdgeQueue, while the main loop drains and debounces it as the timer task does. It reports
+  presses found against presses made, the bounces swallowed, and the time from a press's first
+  edge to its debounced detection:
+
+    .pio/build/native/program button [<presses>]
+
+  'quota' plays adversarial command sequences through the arbiter (arbiter.h) and the mode quota
+  (mode_quota.h), one tick a second with the 10 minute dwell, as the timer task does. Among them
+  are a Block that is never withdrawn, one renewed by its lease, one that flaps, bursts across hour
+  boundaries, a higher-priority source that interrupts a Block, and random commands with and
+  without the high bit wired. Every run is logged and checked against the limits by brute force:
+  no Block longer than its longest time, no 24 h with more starts than allowed, no mode the wiring
+  can't drive. It also reports how long the hourly buckets refused a start that an exact sliding
+  window would have allowed, and what admit() costs:
+
+    .pio/build/native/program quota [<days>]
+*/
+
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <string>
+
+#include "../mqtt_socket_transport.h"
+#include "../sg_clock.h"
+#include "../leadership.h"
+#include "../broker_pool.h"
+#include "../tariff.h"
+#include "../display_pages.h"
+#include "../display_flush.h"
+#include "../display_power.h"
+#include "../override_button.h"
+#include "../arbiter.h"
+#include "../mode_quota.h"
+#include "oled_emulator.h"
+
+#define BENCH_WINDOW 8          // QoS 1 publishes in flight at once (must not exceed MQTT_RTT_SLOTS)
+#define BENCH_PAYLOAD_SIZE 64
+#define BENCH_TIMEOUT_MS 30000
+#define FAILOVER_PUBLISH_MS 100     // one QoS 1 publish this often
+#define FAILOVER_STALL_MS 1000      // no PUBACK for this long and the broker is given up
+#define NTP_EPOCH_OFFSET 2208988800u  // 1900 to 1970
+#define TARIFF_EVALUATIONS 1000000
+#define DISPLAY_RENDER_REPEAT 200   // renders per frame for the timing
+
+static void printStats(const MqttTransport& mqtt, uint32_t elapsedMicros) {
+  const MqttStats& s = mqtt.stats();
+  double seconds = elapsedMicros / 1e6;
+
+  printf("backend          %s\n", mqtt.name());
+  printf("connect          %.2f ms\n", s.lastConnectMicros / 1e3);
+  printf("publishes/acks   %u/%u\n", s.publishes, s.acks);
+  if (s.acks)
+    printf("rtt min/avg/max  %.3f/%.3f/%.3f ms\n", s.minRttMicros / 1e3, double(s.totalRttMicros) / s.acks / 1e3, s.maxRttMicros / 1e3);
+  if (seconds > 0)
+    printf("throughput       %.0f msg/s, %.1f kB/s\n", s.acks / seconds, s.bytesPublished / seconds / 1024);
+}
+
+static int bench(const char* host, uint16_t port, const char* user, const char* pass, uint32_t count) {
+  MqttSocketTransport mqtt;
+  bool connected = false;
+  bool failed = false;
+
+  char clientId[32];
+  snprintf(clientId, sizeof(clientId), "sgready-bench-%d", int(getpid()));
+
+  mqtt.setServer(host, port);
+  mqtt.setClientId(clientId);
+  mqtt.setKeepAlive(15);
+  mqtt.setCleanSession(true);
+  if (user)
+    mqtt.setCredentials(user, pass);
+  mqtt.onConnect([&](bool) { connected = true; });
+  mqtt.onDisconnect([&](MqttDisconnectReason reason) {
+    printf("disconnected, reason %u\n", unsigned(reason));
+    failed = true;
+  });
+
+  mqtt.connect();
+  while (!connected && !failed) {
+    mqtt.poll();
+    usleep(100);
+  }
+  if (failed)
+    return 1;
+
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s/bench", clientId);
+  char payload[BENCH_PAYLOAD_SIZE];
+  memset(payload, 'x', sizeof(payload));
+
+  uint32_t start = sgMicros();
+  uint32_t sent = 0;
+  bool done = false;
+  uint32_t lastProgress = sgMillis();
+  while (!done && !failed) {
+    const MqttStats& s = mqtt.stats();
+    while (sent < count && sent - s.acks < BENCH_WINDOW && mqtt.publish(topic, 1, false, payload, sizeof(payload)))
+      sent++;
+    mqtt.poll();
+    done = s.acks >= count;
+    if (sgMillis() - lastProgress > BENCH_TIMEOUT_MS) {
+      printf("timed out waiting for PUBACKs\n");
+      return 1;
+    }
+    if (s.acks == sent)
+      lastProgress = sgMillis();
+  }
+  uint32_t elapsed = sgMicros() - start;
+
+  printStats(mqtt, elapsed);
+
+  mqtt.onDisconnect(nullptr);
+  mqtt.disconnect();
+  return 0;
+}
+
+#if MQTT_TLS
+static bool connectAndClose(MqttSocketTransport& mqtt) {
+  bool connected = false;
+  bool failed = false;
+  mqtt.onConnect([&](bool) { connected = true; });
+  mqtt.onDisconnect([&](MqttDisconnectReason reason) {
+    if (!connected) {
+      printf("connect failed, reason %u\n", unsigned(reason));
+      failed = true;
+    }
+  });
+
+  mqtt.connect();
+  while (!connected && !failed) {
+    mqtt.poll();
+    usleep(100);
+  }
+  mqtt.disconnect();
+  return connected;
+}
+
+static int tlsBench(const char* host, uint16_t port, const char* pin, const char* caFile, uint32_t rounds) {
+  std::string ca;
+  if (caFile) {
+    FILE* f = fopen(caFile, "r");
+    if (!f) {
+      perror(caFile);
+      return 1;
+    }
+    char buf[512];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      ca.append(buf, n);
+    fclose(f);
+  }
+
+  MqttSocketTransport mqtt;
+  mqtt.setServer(host, port);
+  mqtt.setClientId("sgready-tls-bench");
+  if (!mqtt.setTls(pin, caFile ? ca.c_str() : nullptr)) {
+    printf("invalid pin or CA certificate\n");
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    mqtt.forgetTlsSession();
+    for (int attempt = 0; attempt < 2; attempt++) {  // full, then resumed
+      if (!connectAndClose(mqtt))
+        return 1;
+      const MqttTlsStats& t = mqtt.tlsStats();
+      printf("%-8s %8.2f ms %8u B peak heap\n", t.lastResumed ? "resumed" : "full", t.lastHandshakeMicros / 1e3, t.lastPeakHeap);
+    }
+  }
+
+  const MqttTlsStats& t = mqtt.tlsStats();
+  if (t.fullHandshakes)
+    printf("full     avg %8.2f ms, peak heap %u B (%u handshakes)\n", t.fullMicrosTotal / 1e3 / t.fullHandshakes, t.fullPeakHeap, t.fullHandshakes);
+  if (t.resumedHandshakes)
+    printf("resumed  avg %8.2f ms, peak heap %u B (%u handshakes)\n", t.resumedMicrosTotal / 1e3 / t.resumedHandshakes, t.resumedPeakHeap, t.resumedHandshakes);
+  else
+    printf("the broker never resumed a session; enable session tickets or a session cache on it\n");
+  return 0;
+}
+#endif
+
+// one line per role change: "<ms> <node> <role> term <n> ...", for tools/failover_test.py
+static int standby(const char* host, uint16_t port, const char* node, uint8_t startMode, uint32_t stallAfter) {
+  const char* topic = "sgready_board/leader";
+  MqttSocketTransport mqtt;
+  Leadership leadership;
+  uint32_t start = sgMillis();
+  uint8_t mode = startMode;
+  uint32_t modeSince = start;  // the simulated dwell counts from here
+  bool stalled = false;         // publishes are dropped and acks ignored from stallAfter seconds on
+
+  char clientId[48];
+  snprintf(clientId, sizeof(clientId), "sgready-%s", node);
+  mqtt.setServer(host, port);
+  mqtt.setClientId(clientId);
+  mqtt.setKeepAlive(5);
+  mqtt.setCleanSession(true);
+  mqtt.onConnect([&](bool) { mqtt.subscribe(topic, 1); });
+  mqtt.onDisconnect([&](MqttDisconnectReason reason) { printf("%u %s disconnected %u\n", sgMillis() - start, node, unsigned(reason)); });
+  mqtt.onPublish([&](uint16_t) {
+    if (!stalled)
+      leadership.acked(sgMillis());
+  });
+  mqtt.onMessage([&](const char* t, const char* payload, size_t length) {
+    LeaderHeartbeat heartbeat;
+    if (!strcmp(t, topic) && Leadership::parse(payload, length, heartbeat))
+      leadership.receive(heartbeat, sgMillis());
+  });
+
+  leadership.begin(node, start);
+  mqtt.connect();
+  uint32_t lastConnect = sgMillis();
+  for (;;) {
+    mqtt.poll();
+    uint32_t now = sgMillis();
+    if (!mqtt.connected() && now - lastConnect > 1000) {
+      mqtt.connect();
+      lastConnect = now;
+    }
+    if (stallAfter && !stalled && now - start >= stallAfter * 1000) {
+      stalled = true;
+      printf("%u %s stalled\n", now - start, node);
+      fflush(stdout);
+    }
+
+    if (leadership.poll(now, mqtt.connected())) {
+      uint8_t inheritedMode;
+      uint32_t stateTime;
+      bool inherited = leadership.role() == LeaderRole::Leader && leadership.inherited(now, inheritedMode, stateTime);
+      if (inherited) {
+        mode = inheritedMode;
+        modeSince = now - stateTime * 1000;
+      }
+      printf("%u %s %s term %u", now - start, node, Leadership::roleName(leadership.role()), unsigned(leadership.term()));
+      if (leadership.role() == LeaderRole::Leader)
+        printf(" after %u ms silence, mode %u state %u s%s", leadership.lastFailoverMs(), unsigned(mode), (now - modeSince) / 1000, inherited ? " (inherited)" : "");
+      printf("\n");
+      fflush(stdout);
+    }
+
+    if (leadership.heartbeatDue(now)) {
+      LeaderHeartbeat heartbeat;
+      char payload[LEADER_HEARTBEAT_SIZE];
+      leadership.heartbeat(mode, (now - modeSince) / 1000, heartbeat, now);
+      Leadership::format(heartbeat, payload, sizeof(payload));
+      if (!stalled)
+        mqtt.publish(topic, 1, true, payload);
+    }
+    usleep(1000);
+  }
+}
+
+// the firmware's connect/timeout/failover cycle, compressed into one loop
+static int brokerFailover(const char* host, uint16_t port1, uint16_t port2, uint32_t seconds) {
+  MqttSocketTransport mqtt;
+  BrokerPool pool;
+  pool.add(host, port1);
+  pool.add(host, port2);
+
+  uint32_t start = sgMillis();
+  size_t current = 0;
+  bool connecting = false, sessionUp = false, waited = false;
+  uint32_t attemptAt = 0, sessionStart = 0, lastAck = 0, lastPublish = 0, lostAt = 0;
+  uint32_t failovers = 0, worst = 0;
+
+  mqtt.setClientId("sgready-broker-failover");
+  mqtt.setKeepAlive(5);
+  mqtt.setCleanSession(true);
+  mqtt.onConnect([&](bool) {
+    uint32_t now = sgMillis();
+    pool.connected(current, now);
+    connecting = false;
+    sessionUp = true;
+    sessionStart = lastAck = now;
+    printf("%u connected %s:%u in %u ms\n", now - start, pool.broker(current).host, pool.broker(current).port, now - attemptAt);
+  });
+  mqtt.onDisconnect([&](MqttDisconnectReason) {
+    uint32_t now = sgMillis();
+    if (sessionUp)
+      pool.lost(current, now, now - sessionStart);
+    else if (connecting)
+      pool.failed(current, now);
+    if ((sessionUp || connecting) && !lostAt)
+      lostAt = lastAck;
+    sessionUp = connecting = false;
+  });
+  mqtt.onPublish([&](uint16_t) {
+    uint32_t now = sgMillis();
+    if (lostAt) {
+      uint32_t gap = now - lostAt;
+      printf("%u healthy on %s:%u, %u ms after the last acknowledged publish\n", now - start, pool.broker(current).host, pool.broker(current).port, gap);
+      fflush(stdout);
+      failovers++;
+      worst = gap > worst ? gap : worst;
+      lostAt = 0;
+    }
+    lastAck = now;
+  });
+
+  while (sgMillis() - start < seconds * 1000) {
+    mqtt.poll();
+    uint32_t now = sgMillis();
+
+    if (!mqtt.connected() && !connecting) {
+      current = pool.select(now);
+      uint32_t wait = pool.wait(current, now);
+      if (wait && !waited) {
+        waited = true;
+        attemptAt = now + wait;
+      }
+      if (!waited || int32_t(now - attemptAt) >= 0) {
+        waited = false;
+        pool.attempt(current);
+        connecting = true;
+        attemptAt = now;
+        mqtt.setServer(pool.broker(current).host, pool.broker(current).port);
+        mqtt.connect();
+      }
+    }
+    else if (connecting && now - attemptAt > BROKER_CONNECT_TIMEOUT_MS) {
+      printf("%u %s:%u did not answer within %u ms\n", now - start, pool.broker(current).host, pool.broker(current).port, BROKER_CONNECT_TIMEOUT_MS);
+      pool.failed(current, now);
+      if (!lostAt)
+        lostAt = lastAck;
+      connecting = false;
+      mqtt.disconnect();
+    }
+    else if (sessionUp && now - lastAck > FAILOVER_STALL_MS) {
+      printf("%u %s:%u stopped acknowledging\n", now - start, pool.broker(current).host, pool.broker(current).port);
+      pool.failed(current, now);
+      lostAt = lastAck;
+      sessionUp = false;
+      mqtt.disconnect();
+    }
+    else if (sessionUp && now - lastPublish >= FAILOVER_PUBLISH_MS) {
+      mqtt.publish("sgready-broker-failover/ping", 1, false, "x");
+      lastPublish = now;
+    }
+    usleep(1000);
+  }
+
+  printf("failovers %u, worst %u ms\n", failovers, worst);
+  mqtt.onDisconnect(nullptr);
+  mqtt.disconnect();
+  return 0;
+}
+
+static int64_t wallMillis() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// one SNTP exchange; the offset to add to the local wall clock, in ms
+static bool sntpOffset(const char* host, uint16_t port, int64_t& offset) {
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  addrinfo hints = {}, *addr;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host, service, &hints, &addr))
+    return false;
+  int fd = socket(addr->ai_family, addr->ai_socktype, 0);
+  timeval timeout = { 2, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  uint8_t packet[48] = { 0x23 };  // version 4, client
+  int64_t sent = wallMillis();
+  bool ok = sendto(fd, packet, sizeof(packet), 0, addr->ai_addr, addr->ai_addrlen) == sizeof(packet) &&
+            recv(fd, packet, sizeof(packet), 0) == sizeof(packet) && (packet[0] & 7) == 4;
+  int64_t received = wallMillis();
+  close(fd);
+  freeaddrinfo(addr);
+  if (!ok)
+    return false;
+
+  uint32_t seconds = uint32_t(packet[40]) << 24 | packet[41] << 16 | packet[42] << 8 | packet[43];
+  uint32_t fraction = uint32_t(packet[44]) << 24 | packet[45] << 16 | packet[46] << 8 | packet[47];
+  int64_t server = int64_t(seconds - NTP_EPOCH_OFFSET) * 1000 + (uint64_t(fraction) * 1000 >> 32);
+  offset = server - (sent + received) / 2;
+  return true;
+}
+
+// the firmware's updateTariff() against a clock set by SNTP
+static int tariff(const char* host, uint16_t port, const char* week, const char* holidays, uint32_t seconds) {
+  TariffCalendar calendar;
+  if (!calendar.setWeek(week) || !calendar.setHolidays(holidays)) {
+    fprintf(stderr, "invalid week or holidays\n");
+    return 2;
+  }
+  int64_t offset;
+  if (!sntpOffset(host, port, offset)) {
+    fprintf(stderr, "no answer from %s:%u\n", host, port);
+    return 1;
+  }
+  printf("clock offset     %lld ms\n", (long long)offset);
+
+  struct tm local = {};
+  uint32_t start = sgMicros();
+  uint32_t cheapHours = 0;
+  for (uint32_t i = 0; i < TARIFF_EVALUATIONS; i++) {
+    local.tm_hour = i % 24;
+    local.tm_wday = (i / 24) % 7;
+    local.tm_yday = (i / 168) % 365;  // a new day now and then, for the holiday lookup
+    cheapHours += calendar.cheap(local);
+  }
+  printf("evaluation       %.1f ns (%u cheap)\n", double(sgMicros() - start) * 1000 / TARIFF_EVALUATIONS, cheapHours);
+
+  int first = -1;
+  bool cheap = false;
+  uint32_t changes = 0, worst = 0;
+  uint32_t ticks = sgMillis();
+  for (uint32_t tick = 0; tick <= seconds; tick++) {
+    int64_t now = wallMillis() + offset;
+    time_t t = time_t(now / 1000);
+    localtime_r(&t, &local);
+    bool c = calendar.cheap(local);
+    if (first < 0 || c != cheap) {
+      uint32_t late = uint32_t(local.tm_min * 60000 + local.tm_sec * 1000 + now % 1000);
+      printf("%02d:%02d:%02d.%03d    %s", local.tm_hour, local.tm_min, local.tm_sec, int(now % 1000), c ? "cheap" : "normal");
+      if (first >= 0) {
+        printf(", %u ms after the hour", late);
+        changes++;
+        worst = late > worst ? late : worst;
+      }
+      printf("\n");
+      fflush(stdout);
+      first = 0;
+      cheap = c;
+    }
+    int32_t wait = int32_t(ticks + (tick + 1) * 1000 - sgMillis());  // a fixed period with any phase, like the timer
+    if (wait > 0)
+      usleep(wait * 1000);
+  }
+  printf("changes %u, worst %u ms after the hour\n", changes, worst);
+  return 0;
+}
+
+static uint64_t monotonicNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// second 's' of a scripted day: cheap hours 0-6 and 22-24 in mode 1, a short MQTT outage at 3:00 and
+// the wake button pressed at 7:30, 12:15 and 19:00
+static DisplayView dayView(uint32_t s) {
+  static const uint32_t changes[] = { 0, 6 * 3600, 22 * 3600 };  // when the mode changes
+  static const uint32_t presses[] = { 7 * 3600 + 1800, 12 * 3600 + 900, 19 * 3600 };
+  uint32_t day = s % 86400;
+  DisplayView v = {};
+  v.ip = 0x2a00a8c0;
+  v.mqttConnected = day < 3 * 3600 || day >= 3 * 3600 + 20;
+  v.mode = day < 6 * 3600 || day >= 22 * 3600;
+  v.excess = v.mode;
+  v.source = v.excess ? CommandSource::Schedule : CommandSource::Count;
+  v.lease = v.excess ? 3600 - day % 3600 : 0;
+  v.dwellSeconds = 600;
+  v.uptime = s;
+  for (uint32_t change : changes)
+    if (day >= change)
+      v.stateSeconds = day - change;
+  v.wakes = s / 86400 * 3;
+  for (uint32_t press : presses)
+    v.wakes += day >= press;
+  return v;
+}
+
+// second 'tick' of the script: WiFi, then MQTT, then an Excess request with a lease through the dwell
+static DisplayView scriptedView(uint32_t tick) {
+  DisplayView v = {};
+  v.ip = tick >= 3 ? 0x2a00a8c0 : 0;  // 192.168.0.42
+  v.mqttConnected = tick >= 5;
+  v.role = nullptr;
+  v.source = CommandSource::Count;
+  v.stateSeconds = 585 + tick;
+  v.dwellSeconds = 600;
+  if (tick >= 8) {
+    v.excess = true;
+    v.source = CommandSource::Mqtt;
+    v.lease = 3600 - (tick - 8);
+  }
+  if (tick >= 20) {  // the dwell has passed, the mode follows
+    v.mode = 1;
+    v.stateSeconds = tick - 20;
+  }
+  v.rssi = int8_t(-60 - tick % 7);
+  v.rttMicros = v.mqttConnected ? 9000 + tick * 700 : 0;
+  v.rttAvgMicros = v.mqttConnected ? 12000 : 0;
+  v.mqttDrops = tick >= 5;
+  v.uptime = 86400 + tick * DISPLAY_HISTORY_COLUMN_SECONDS;  // a new chart column every frame
+  return v;
+}
+
+enum class ChartUpdate { None, Scroll, Rebuild };
+
+struct RendererResult {
+  uint64_t renderNanos;
+  uint64_t maxNanos;
+  uint64_t maxBlockingMicros;  // the longest one call keeps the bus: display(), or one chunk
+  OledBusStats bus;
+};
+
+template <class Render>
+static RendererResult runDisplay(uint32_t frames, const char* dir, const char* name, Render render, bool chunked = false,
+                                 ChartUpdate chart = ChartUpdate::None) {
+  OledEmulator display;
+  DisplayPages<OledEmulator> pages;
+  display.init();
+  display.flipScreenVertically();
+  DisplayFlush flush;
+  flush.begin(display.shown());
+  pages.begin(display);
+  for (uint32_t s = 0; s < 86400; s += 60)  // a full chart to start with
+    pages.chart().sample(dayView(s));
+  display.resetStats();
+
+  RendererResult r = {};
+  for (uint32_t tick = 0; tick < frames; tick++) {
+    DisplayView v = scriptedView(tick);
+    uint64_t start = monotonicNanos();
+    if (chart != ChartUpdate::None) {  // once per frame; only the first sample of a column scrolls
+      pages.chart().sample(v);
+      if (chart == ChartUpdate::Rebuild)
+        pages.chart().rebuild();
+    }
+    uint64_t chartNanos = monotonicNanos() - start;
+    start = monotonicNanos();
+    for (int i = 0; i < DISPLAY_RENDER_REPEAT; i++)
+      render(pages, display, v);
+    uint64_t nanos = chartNanos + (monotonicNanos() - start) / DISPLAY_RENDER_REPEAT;
+    r.renderNanos += nanos;
+    r.maxNanos = nanos > r.maxNanos ? nanos : r.maxNanos;
+    uint64_t busBefore = display.stats().busMicros;
+    if (chunked) {
+      uint8_t transaction[DISPLAY_FLUSH_MAX_TRANSACTION];
+      flush.start(display.buffer);
+      while (size_t n = flush.next(transaction))
+        display.write(transaction, n);
+      if (memcmp(display.shown(), display.buffer, OLED_BUFFER_SIZE))
+        printf("frame %u: the panel differs from the framebuffer\n", tick);
+    }
+    else {
+      display.display();
+      uint64_t blocking = display.stats().busMicros - busBefore;
+      r.maxBlockingMicros = blocking > r.maxBlockingMicros ? blocking : r.maxBlockingMicros;
+    }
+    if (dir) {
+      char path[256];
+      snprintf(path, sizeof(path), "%s/%s-%03u.png", dir, name, tick);
+      display.writePng(path);
+    }
+  }
+  r.bus = display.stats();
+  if (chunked)
+    r.maxBlockingMicros = r.bus.maxTransactionMicros;
+  return r;
+}
+
+static void printDisplayResult(const char* name, const RendererResult& r, uint32_t frames) {
+  printf("%-8s %8.2f %8.2f %9.1f %9.1f %9.0f %9u\n", name, r.renderNanos / 1e3 / frames, r.maxNanos / 1e3,
+    double(r.bus.bytes) / frames, double(r.bus.transactions) / frames, double(r.bus.busMicros) / frames, unsigned(r.maxBlockingMicros));
+}
+
+static int displayBench(uint32_t frames, const char* dir) {
+  typedef DisplayPages<OledEmulator> Pages;
+  RendererResult glyphs = runDisplay(frames, dir, "glyphs", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.render(d, DisplayPage::Status, v); });
+  RendererResult text = runDisplay(frames, dir, "text", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.renderText(d, DisplayPage::Status, v); });
+  RendererResult chunked = runDisplay(frames, dir, "chunked", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.render(d, DisplayPage::Status, v); }, true);
+  RendererResult health = runDisplay(frames, dir, "health", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.render(d, DisplayPage::Health, v); }, true);
+  RendererResult history = runDisplay(frames, dir, "history", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.render(d, DisplayPage::History, v); },
+    true, ChartUpdate::Scroll);
+  RendererResult rebuilt = runDisplay(frames, nullptr, "rebuilt", [](Pages& p, OledEmulator& d, const DisplayView& v) { p.render(d, DisplayPage::History, v); },
+    true, ChartUpdate::Rebuild);
+
+  printf("%u frames, I2C at 700 kHz\n", frames);
+  printf("         render us        per frame                 blocking\n");
+  printf("           avg      max     bytes    trans.    bus us     max us\n");
+  printDisplayResult("glyphs", glyphs, frames);
+  printDisplayResult("text", text, frames);
+  printDisplayResult("chunked", chunked, frames);
+  printf("per page, chunked; the chart scrolls one column a frame\n");
+  printDisplayResult("status", chunked, frames);
+  printDisplayResult("health", health, frames);
+  printDisplayResult("history", history, frames);
+  printDisplayResult("redrawn", rebuilt, frames);
+  return 0;
+}
+
+struct PowerResult {
+  OledBusStats bus;
+  DisplayPowerStats power;
+  uint32_t litSeconds;  // as the emulated panel saw it
+  uint32_t dimSeconds;
+};
+
+static PowerResult runDisplayPower(uint32_t seconds, DisplayPowerMode mode, uint32_t blankSeconds, uint32_t dimSeconds) {
+  OledEmulator display;
+  StatusScreen<OledEmulator> screen;
+  display.init();
+  display.flipScreenVertically();
+  DisplayFlush flush;
+  flush.begin(display.shown());
+  screen.begin(display);
+  display.resetStats();
+  DisplayPower power(mode, blankSeconds * 1000, dimSeconds * 1000);
+  power.begin(0);
+
+  PowerResult r = {};
+  DisplayPanel panel = DisplayPanel::Bright;
+  uint8_t transaction[DISPLAY_FLUSH_MAX_TRANSACTION];
+  for (uint32_t s = 0; s < seconds; s++) {
+    uint32_t now = s * 1000;
+    DisplayView v = dayView(s);
+    if (power.view(v, now)) {
+      screen.render(display, v);
+      flush.start(display.buffer);
+    }
+    DisplayPanel next = power.panel(now);
+    if (next != panel) {
+      display.write(transaction, power.command(next, transaction));
+      panel = next;
+    }
+    if (panel != DisplayPanel::Off)
+      while (size_t n = flush.next(transaction))
+        display.write(transaction, n);
+    r.litSeconds += display.on();
+    r.dimSeconds += display.on() && display.contrast() != 0xcf;
+  }
+  r.bus = display.stats();
+  r.power = power.stats();
+  return r;
+}
+
+static int displayPower(uint32_t hours) {
+  struct Policy {
+    const char* name;
+    DisplayPowerMode mode;
+    uint32_t blankSeconds;
+    uint32_t dimSeconds;
+  };
+  static const Policy policies[] = {
+    { "always on", DisplayPowerMode::AlwaysOn, 0, 0 },
+    { "on change", DisplayPowerMode::OnChange, 0, 0 },
+    { "dim 60 s", DisplayPowerMode::AlwaysOn, 0, 60 },
+    { "blank 120 s", DisplayPowerMode::Blank, 120, 0 },
+    { "dim+blank", DisplayPowerMode::Blank, 120, 30 },
+  };
+  uint32_t seconds = hours * 3600;
+  double perDay = 86400.0 / seconds;
+  printf("%u h, one view a second, chunked flush\n", hours);
+  printf("               bytes/day  trans./day  bus ms/day   lit %%   dim %%  wakes  skipped   bytes saved  lit saved\n");
+  PowerResult always = {};
+  for (const Policy& p : policies) {
+    PowerResult r = runDisplayPower(seconds, p.mode, p.blankSeconds, p.dimSeconds);
+    if (&p == policies)
+      always = r;
+    printf("%-12s %11.0f %11.0f %11.0f %7.1f %7.1f %6u %8u %12.1f%% %9.1f%%\n", p.name, r.bus.bytes * perDay,
+      r.bus.transactions * perDay, r.bus.busMicros / 1e3 * perDay, 100.0 * r.litSeconds / seconds, 100.0 * r.dimSeconds / seconds,
+      r.power.wakes, r.power.skipped, 100.0 - 100.0 * r.bus.bytes / always.bus.bytes, 100.0 - 100.0 * r.litSeconds / always.litSeconds);
+  }
+  return 0;
+}
+
+struct ScriptedEdge {
+  uint64_t at;  // micros from the start
+  bool level;
+};
+
+static std::vector<ScriptedEdge> s_edges;
+static size_t s_nextEdge;
+static uint64_t s_edgeStart;
+static EdgeQueue s_edgeQueue;
+
+static uint64_t monotonicMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void armEdge() {
+  if (s_nextEdge >= s_edges.size())
+    return;
+  int64_t wait = int64_t(s_edges[s_nextEdge].at + s_edgeStart) - int64_t(monotonicMicros());
+  itimerval t = {};
+  t.it_value.tv_usec = wait > 1 ? wait : 1;
+  t.it_value.tv_sec = t.it_value.tv_usec / 1000000;
+  t.it_value.tv_usec %= 1000000;
+  setitimer(ITIMER_REAL, &t, nullptr);
+}
+
+// the "ISR": one edge per signal, stamped when it is taken, as on the board
+static void edgeSignal(int) {
+  uint64_t now = monotonicMicros();
+  while (s_nextEdge < s_edges.size() && s_edges[s_nextEdge].at + s_edgeStart <= now)
+    s_edgeQueue.push({ uint32_t(now), s_edges[s_nextEdge++].level });
+  armEdge();
+}
+
+// a burst of 'bounces' extra edges 30-800 us apart that settles at 'level'
+static uint64_t scriptBurst(uint64_t at, bool level, int bounces) {
+  for (int i = bounces; i >= 0; i--) {
+    s_edges.push_back({ at, i % 2 ? !level : level });
+    at += 30 + rand() % 770;
+  }
+  return at;
+}
+
+static int button(uint32_t presses) {
+  srand(1);
+  uint64_t at = 50000;
+  for (uint32_t i = 0; i < presses; i++) {
+    at = scriptBurst(at, false, rand() % 7);
+    at += 40000 + rand() % 80000;                 // held
+    at = scriptBurst(at, true, rand() % 7);
+    at += BUTTON_DEBOUNCE_US + rand() % 100000;   // released
+  }
+
+  signal(SIGALRM, edgeSignal);
+  s_edgeStart = monotonicMicros();
+  armEdge();
+  ButtonDebouncer debouncer;
+  std::vector<uint32_t> latency;
+  uint64_t nanos = 0;
+  while (s_nextEdge < s_edges.size() || !s_edgeQueue.empty()) {
+    ButtonEdge edge;
+    while (s_edgeQueue.pop(edge)) {
+      uint64_t start = monotonicNanos();
+      bool press = debouncer.edge(edge);
+      nanos += monotonicNanos() - start;
+      if (press)
+        latency.push_back(uint32_t(monotonicMicros()) - edge.micros);
+    }
+    usleep(100);  // the timer task's wake-up, roughly
+  }
+  signal(SIGALRM, SIG_DFL);
+
+  const ButtonStats& b = debouncer.stats();
+  std::sort(latency.begin(), latency.end());
+  printf("presses        %u found of %u made\n", b.presses, presses);
+  printf("edges          %u, %u bounces, %u dropped\n", b.edges, b.bounces, s_edgeQueue.dropped());
+  if (!latency.empty())
+    printf("press to task  p50 %u us  max %u us\n", latency[latency.size() / 2], latency.back());
+  printf("debounce       %.0f ns per edge\n", b.edges ? double(nanos) / b.edges : 0.0);
+  return b.presses == presses ? 0 : 1;
+}
+
+#define QUOTA_DWELL 600          // MIN_STATE_SECONDS
+#define QUOTA_BLOCK_SECONDS 7200  // the firmware's defaults
+#define QUOTA_BLOCK_STARTS 3
+
+struct QuotaRun {
+  uint8_t mode;
+  uint32_t start;
+  uint32_t end;
+};
+
+// the controller around the arbiter and the quota: updateMode(), applyQuota() and switchMode()
+struct QuotaModel {
+  Arbiter arbiter;
+  ModeQuota quota;
+  uint8_t mode = 0;
+  uint32_t stateTime = QUOTA_DWELL;
+  std::vector<QuotaRun> runs;
+  uint64_t nanos = 0;
+  uint32_t admits = 0;
+  uint32_t roomySeconds = 0;  // a start refused that an exact 24 h window would have allowed
+
+  explicit QuotaModel(uint8_t modes) : quota(modes) {
+    quota.limit(2, { QUOTA_BLOCK_SECONDS, QUOTA_BLOCK_STARTS });
+    runs.push_back({ 0, 0, 0 });
+  }
+
+  uint32_t exactStarts(uint8_t m, uint32_t now) const {
+    uint32_t n = 0;
+    for (const QuotaRun& r : runs)
+      n += r.mode == m && r.start + 86400 > now && r.start <= now && r.start;
+    return n;
+  }
+
+  void tick(uint32_t now) {
+    arbiter.expire(now);
+    uint8_t asked = arbiter.mode();
+    uint64_t start = monotonicNanos();
+    QuotaVerdict verdict = quota.admit(asked, now);
+    nanos += monotonicNanos() - start;
+    admits++;
+    if (verdict == QuotaVerdict::Starts && exactStarts(asked, now) < QUOTA_BLOCK_STARTS)
+      roomySeconds++;
+    uint8_t target = verdict == QuotaVerdict::Allowed ? asked : 0;
+    if (++stateTime >= QUOTA_DWELL && target != mode) {
+      runs.back().end = now;
+      runs.push_back({ target, now, 0 });
+      mode = target;
+      stateTime = 0;
+      quota.entered(mode, now);
+    }
+  }
+};
+
+typedef void (*QuotaScript)(QuotaModel& m, uint32_t now);
+
+static void quotaStuck(QuotaModel& m, uint32_t now) {
+  if (now == 1)
+    m.arbiter.set(CommandSource::Mqtt, 2, 50, 0, now);
+}
+
+static void quotaRenewed(QuotaModel& m, uint32_t now) {
+  if (now % 300 == 1)
+    m.arbiter.set(CommandSource::Mqtt, 2, 50, 900, now);
+}
+
+static void quotaFlapping(QuotaModel& m, uint32_t now) {
+  if (now % 1202 == 1)
+    m.arbiter.set(CommandSource::Mqtt, 2, 50, 0, now);
+  else if (now % 1202 == 602)
+    m.arbiter.clear(CommandSource::Mqtt, now);
+}
+
+// a Block asked for just before each hour and withdrawn just after, so starts straddle the buckets
+static void quotaBoundary(QuotaModel& m, uint32_t now) {
+  if (now % 3600 == 3590)
+    m.arbiter.set(CommandSource::Mqtt, 2, 50, 0, now);
+  else if (now % 3600 == 1210)
+    m.arbiter.clear(CommandSource::Mqtt, now);
+}
+
+// a Block held throughout, interrupted every 3 h by a manual Excess that outranks it
+static void quotaInterrupted(QuotaModel& m, uint32_t now) {
+  if (now == 1)
+    m.arbiter.set(CommandSource::Mqtt, 2, 50, 0, now);
+  if (now % 10800 == 9000)
+    m.arbiter.set(CommandSource::Manual, 1, 90, 700, now);
+}
+
+static void quotaRandom(QuotaModel& m, uint32_t now) {
+  int r = rand() % 1000;
+  if (r < 4)
+    m.arbiter.set(CommandSource::Mqtt, uint8_t(rand() % SG_MODES), 50, rand() % 3 ? 0 : 60 + rand() % 7200, now);
+  else if (r < 6)
+    m.arbiter.clear(CommandSource::Mqtt, now);
+  else if (r < 7)
+    m.arbiter.set(CommandSource::Manual, uint8_t(rand() % 2), 90, 3600, now);
+  else if (r < 8)
+    m.arbiter.set(CommandSource::Schedule, 1, 30, 3720, now);
+}
+
+static int quota(uint32_t days) {
+  struct { const char* name; QuotaScript script; uint8_t modes; } scripts[] = {
+    { "stuck", quotaStuck, SG_MODES },
+    { "renewed", quotaRenewed, SG_MODES },
+    { "flapping", quotaFlapping, SG_MODES },
+    { "boundary", quotaBoundary, SG_MODES },
+    { "interrupted", quotaInterrupted, SG_MODES },
+    { "random", quotaRandom, SG_MODES },
+    { "unwired", quotaRandom, 2 },
+  };
+  uint32_t seconds = days * 86400;
+  int violations = 0;
+  printf("%-12s %6s %9s %8s %5s %8s %9s %10s\n", "script", "blocks", "longest", "max/24h", "cuts", "refused", "roomy s", "admit ns");
+  for (auto& script : scripts) {
+    srand(7);
+    QuotaModel m(script.modes);
+    for (uint32_t now = 1; now <= seconds; now++) {
+      script.script(m, now);
+      m.tick(now);
+    }
+    m.runs.back().end = seconds;
+
+    uint32_t blocks = 0, longest = 0, most = 0, bad = 0;
+    for (const QuotaRun& r : m.runs) {
+      if (r.mode >= script.modes)
+        bad++;
+      if (r.mode != 2)
+        continue;
+      blocks++;
+      longest = std::max(longest, r.end - r.start);
+      most = std::max(most, m.exactStarts(2, r.start));
+    }
+    bad += longest > uint32_t(std::max(QUOTA_BLOCK_SECONDS, QUOTA_DWELL));
+    bad += most > QUOTA_BLOCK_STARTS;
+    violations += bad;
+    const QuotaStats& q = m.quota.stats();
+    printf("%-12s %6u %8us %8u %5u %8u %9u %10.0f%s\n", script.name, blocks, longest, most, q.cuts, q.refusals,
+      m.roomySeconds, double(m.nanos) / m.admits, bad ? "  VIOLATION" : "");
+  }
+  printf("%u days per script, Block at most %u s and %u starts in 24 h\n", days, QUOTA_BLOCK_SECONDS, QUOTA_BLOCK_STARTS);
+  return violations ? 1 : 0;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: program bench <host> <port> [<user> <pass>] [<count>]\n");
+  fprintf(stderr, "       program standby <host> <port> <node> [<mode> [<stall-s>]]\n");
+  fprintf(stderr, "       program broker-failover <host> <port1> <port2> [<seconds>]\n");
+  fprintf(stderr, "       program tariff <ntp-host> <port> <week> [<holidays>] [<seconds>]\n");
+  fprintf(stderr, "       program display [<frames>] [<dir>]\n");
+  fprintf(stderr, "       program display-power [<hours>]\n");
+  fprintf(stderr, "       program button [<presses>]\n");
+  fprintf(stderr, "       program quota [<days>]\n");
+#if MQTT_TLS
+  fprintf(stderr, "       program tls-bench <host> <port> <pin-sha256|-> <ca.pem|-> [<rounds>]\n");
+#endif
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 4 && !strcmp(argv[1], "bench")) {
+    const char* user = argc >= 6 ? argv[4] : nullptr;
+    const char* pass = argc >= 6 ? argv[5] : nullptr;
+    uint32_t count = argc == 5 ? atoi(argv[4]) : argc >= 7 ? atoi(argv[6]) : 1000;
+    return bench(argv[2], uint16_t(atoi(argv[3])), user, pass, count);
+  }
+  if (argc >= 5 && !strcmp(argv[1], "standby"))
+    return standby(argv[2], uint16_t(atoi(argv[3])), argv[4], argc >= 6 ? uint8_t(atoi(argv[5])) : 0,
+                   argc >= 7 ? uint32_t(atoi(argv[6])) : 0);
+  if (argc >= 5 && !strcmp(argv[1], "broker-failover"))
+    return brokerFailover(argv[2], uint16_t(atoi(argv[3])), uint16_t(atoi(argv[4])), argc >= 6 ? atoi(argv[5]) : 30);
+  if (argc >= 2 && !strcmp(argv[1], "display"))
+    return displayBench(argc >= 3 ? atoi(argv[2]) : 30, argc >= 4 ? argv[3] : nullptr);
+  if (argc >= 2 && !strcmp(argv[1], "button"))
+    return button(argc >= 3 ? atoi(argv[2]) : 40);
+  if (argc >= 2 && !strcmp(argv[1], "quota"))
+    return quota(argc >= 3 ? atoi(argv[2]) : 7);
+  if (argc >= 2 && !strcmp(argv[1], "display-power"))
+    return displayPower(argc >= 3 ? atoi(argv[2]) : 24);
+  if (argc >= 5 && !strcmp(argv[1], "tariff"))
+    return tariff(argv[2], uint16_t(atoi(argv[3])), argv[4], argc >= 6 ? argv[5] : "", argc >= 7 ? atoi(argv[6]) : 30);
+#if MQTT_TLS
+  if (argc >= 6 && !strcmp(argv[1], "tls-bench")) {
+    const char* pin = strcmp(argv[4], "-") ? argv[4] : nullptr;
+    const char* ca = strcmp(argv[5], "-") ? argv[5] : nullptr;
+    return tlsBench(argv[2], uint16_t(atoi(argv[3])), pin, ca, argc >= 7 ? atoi(argv[6]) : 5);
+  }
+#endif
+
+  usage();
+  return 2;
+}
+
+#endif
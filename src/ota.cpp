@@ -0,0 +1,263 @@
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <esp_rom_crc.h>
+#if __has_include(<esp32/rom/miniz.h>)
+#include <esp32/rom/miniz.h>
+#else
+#include <rom/miniz.h>
+#endif
+
+#include "ota.h"
+
+#define OTA_READ_TIMEOUT_MS 10000
+#define OTA_RESTART_DELAY_MS 1000  // lets the report go out before the restart
+
+struct OtaRequest {
+  String url;
+  String md5;
+  OtaReportCallback report;
+  OtaRestartCallback beforeRestart;
+};
+
+static volatile bool s_active = false;
+
+static bool readFully(Stream& stream, uint8_t* buf, size_t length, OtaResult& r) {
+  size_t n = stream.readBytes(buf, length);
+  r.downloadedBytes += n;
+  return n == length;
+}
+
+static bool writeFlash(uint8_t* data, size_t length, OtaResult& r) {
+  uint32_t start = micros();
+  bool ok = Update.write(data, length) == length;
+  r.flashMillis += (micros() - start) / 1000;
+  r.writtenBytes += length;
+  return ok;
+}
+
+static bool skipZeroTerminated(Stream& stream, OtaResult& r) {
+  uint8_t c;
+  do {
+    if (!readFully(stream, &c, 1, r))
+      return false;
+  } while (c);
+  return true;
+}
+
+// RFC 1952 member header
+static bool skipGzipHeader(Stream& stream, OtaResult& r) {
+  uint8_t h[10];
+  if (!readFully(stream, h, sizeof(h), r) || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8)
+    return false;
+
+  uint8_t flags = h[3];
+  if (flags & 0x04) {  // FEXTRA
+    uint8_t x[2];
+    if (!readFully(stream, x, 2, r))
+      return false;
+    for (size_t skip = x[0] | (x[1] << 8); skip; skip--)
+      if (!readFully(stream, x, 1, r))
+        return false;
+  }
+  if ((flags & 0x08) && !skipZeroTerminated(stream, r))  // FNAME
+    return false;
+  if ((flags & 0x10) && !skipZeroTerminated(stream, r))  // FCOMMENT
+    return false;
+  uint8_t crc16[2];
+  if ((flags & 0x02) && !readFully(stream, crc16, 2, r))  // FHCRC
+    return false;
+  return true;
+}
+
+static const char* copyRaw(Stream& stream, int length, OtaResult& r) {
+  uint8_t buf[OTA_CHUNK];
+  while (length > 0) {
+    size_t n = min(size_t(length), sizeof(buf));
+    if (!readFully(stream, buf, n, r))
+      return "download truncated";
+    if (!writeFlash(buf, n, r))
+      return Update.errorString();
+    length -= n;
+  }
+  return nullptr;
+}
+
+// 'length' is the Content-Length; reads stop there, as readBytes() would wait out its timeout for more
+static const char* inflateGzip(Stream& stream, int length, OtaResult& r) {
+  if (!skipGzipHeader(stream, r))
+    return "not a gzip file";
+
+  tinfl_decompressor* inflator = static_cast<tinfl_decompressor*>(malloc(sizeof(tinfl_decompressor)));
+  uint8_t* window = static_cast<uint8_t*>(malloc(TINFL_LZ_DICT_SIZE));  // wrapping output buffer = the LZ77 window
+  if (!inflator || !window) {
+    free(inflator);
+    free(window);
+    return "out of memory";
+  }
+  tinfl_init(inflator);
+
+  uint8_t in[OTA_CHUNK];
+  size_t inLength = 0;
+  size_t inPos = 0;
+  size_t outPos = 0;
+  uint32_t crc = 0;
+  const char* error = nullptr;
+  tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+  for (;;) {
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      memmove(in, in + inPos, inLength - inPos);
+      inLength -= inPos;
+      inPos = 0;
+      size_t left = r.downloadedBytes < uint32_t(length) ? uint32_t(length) - r.downloadedBytes : 0;
+      size_t n = left ? stream.readBytes(in + inLength, min(sizeof(in) - inLength, left)) : 0;
+      if (!n) {
+        error = "download truncated";
+        break;
+      }
+      r.downloadedBytes += n;
+      inLength += n;
+    }
+
+    size_t inBytes = inLength - inPos;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - outPos;
+    uint32_t start = micros();
+    status = tinfl_decompress(inflator, in + inPos, &inBytes, window, window + outPos, &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+    r.inflateMillis += (micros() - start) / 1000;
+    inPos += inBytes;
+
+    if (outBytes) {
+      crc = esp_rom_crc32_le(crc, window + outPos, outBytes);
+      if (!writeFlash(window + outPos, outBytes, r)) {
+        error = Update.errorString();
+        break;
+      }
+      outPos = (outPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    if (status == TINFL_STATUS_DONE)
+      break;
+    if (status < 0) {
+      error = "corrupt deflate stream";
+      break;
+    }
+  }
+
+  free(inflator);
+  free(window);
+  if (error)
+    return error;
+
+  // trailer: CRC32 and length of the uncompressed data, little endian; part of it may already be buffered
+  uint8_t trailer[8];
+  size_t buffered = min(inLength - inPos, sizeof(trailer));
+  memcpy(trailer, in + inPos, buffered);
+  if (buffered < sizeof(trailer) && !readFully(stream, trailer + buffered, sizeof(trailer) - buffered, r))
+    return "gzip trailer missing";
+
+  uint32_t expectedCrc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (uint32_t(trailer[3]) << 24);
+  uint32_t expectedSize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (uint32_t(trailer[7]) << 24);
+  if (crc != expectedCrc || r.writtenBytes != expectedSize)
+    return "gzip CRC or length mismatch";
+  return nullptr;
+}
+
+static void runUpdate(const OtaRequest& req, OtaResult& r) {
+  uint32_t start = millis();
+  r.compressed = req.url.endsWith(".gz");
+
+  HTTPClient http;
+  if (!http.begin(req.url)) {
+    r.error = "bad URL";
+    return;
+  }
+  int code = http.GET();
+  if (code != HTTP_CODE_OK) {
+    r.error = code < 0 ? "connection failed" : "HTTP error";
+    http.end();
+    return;
+  }
+
+  int length = http.getSize();  // -1 with chunked encoding, whose framing the raw stream below would pass on
+  if (length <= 0) {
+    r.error = "no Content-Length (chunked transfer is not supported)";
+    http.end();
+    return;
+  }
+
+  if (!Update.begin(r.compressed ? UPDATE_SIZE_UNKNOWN : size_t(length))) {
+    r.error = Update.errorString();
+    http.end();
+    return;
+  }
+  if (!req.md5.length() || !Update.setMD5(req.md5.c_str())) {
+    r.error = "bad MD5";
+    Update.abort();
+    http.end();
+    return;
+  }
+
+  WiFiClient* stream = http.getStreamPtr();
+  stream->setTimeout(OTA_READ_TIMEOUT_MS);
+  r.error = r.compressed ? inflateGzip(*stream, length, r) : copyRaw(*stream, length, r);
+  http.end();
+
+  if (r.error) {
+    Update.abort();
+    return;
+  }
+  if (!Update.end(true)) {  // verifies the image and switches the boot partition
+    r.error = Update.errorString();
+    return;
+  }
+
+  r.flashSectors = (r.writtenBytes + OTA_FLASH_SECTOR - 1) / OTA_FLASH_SECTOR;
+  r.totalMillis = millis() - start;
+  r.ok = true;
+}
+
+static void otaTask(void* arg) {
+  OtaRequest* req = static_cast<OtaRequest*>(arg);
+  OtaResult r;
+  memset(&r, 0, sizeof(r));
+
+  runUpdate(*req, r);
+  if (!r.ok)
+    r.totalMillis = 0;
+  if (req->report)
+    req->report(r);
+
+  if (r.ok) {
+    if (req->beforeRestart)
+      req->beforeRestart();
+    vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MS));
+    ESP.restart();
+  }
+
+  delete req;
+  s_active = false;
+  vTaskDelete(nullptr);
+}
+
+bool otaStart(const char* url, const char* md5, OtaReportCallback report, OtaRestartCallback beforeRestart) {
+  if (s_active)
+    return false;
+  s_active = true;
+
+  OtaRequest* req = new OtaRequest{ url, md5 ? md5 : "", report, beforeRestart };
+  if (xTaskCreate(otaTask, "ota", OTA_TASK_STACK, req, 1, nullptr) != pdPASS) {
+    delete req;
+    s_active = false;
+    return false;
+  }
+  return true;
+}
+
+bool otaActive() {
+  return s_active;
+}
+
+#endif
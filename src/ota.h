@@ -0,0 +1,49 @@
+/*
+  Firmware update over HTTP into the inactive OTA partition.
+
+  The image is streamed straight into flash. If the URL ends in ".gz", the image is gunzipped on the
+  fly with the miniz inflater in the ESP32 ROM, using a 32 KiB window. The gzip CRC32 and length are
+  checked, and the updater then verifies the image itself and the MD5 of the uncompressed image,
+  which is required: it comes with the signed command, so the signature covers the image and not
+  only its URL, which is fetched over plain HTTP. Any local web server that sends a Content-Length will do as the image source; chunked
+  responses are refused, because the stream is read raw:
+
+    gzip -9k .pio/build/uno/firmware.bin && cd .pio/build/uno && python3 -m http.server 8000
+
+  The update runs in its own task. When it finishes, the report callback gets the figures. On
+  success, the beforeRestart callback runs and the board restarts into the new image.
+*/
+
+#pragma once
+
+#ifdef ARDUINO
+
+#include <stdint.h>
+
+#ifndef OTA_TASK_STACK
+#define OTA_TASK_STACK 8192
+#endif
+
+#define OTA_CHUNK 1024  // network read size
+#define OTA_FLASH_SECTOR 4096
+
+struct OtaResult {
+  bool ok;
+  bool compressed;
+  const char* error;          // nullptr on success
+  uint32_t downloadedBytes;   // as received over HTTP
+  uint32_t writtenBytes;      // image bytes written to flash
+  uint32_t flashSectors;      // 4 KiB sectors erased and written
+  uint32_t totalMillis;       // request to last byte written
+  uint32_t flashMillis;       // time spent in flash writes
+  uint32_t inflateMillis;     // time spent decompressing
+};
+
+typedef void (*OtaReportCallback)(const OtaResult& result);
+typedef void (*OtaRestartCallback)();
+
+// false if an update is already running; the strings are copied. Without an md5 the update fails
+bool otaStart(const char* url, const char* md5, OtaReportCallback report, OtaRestartCallback beforeRestart);
+bool otaActive();
+
+#endif
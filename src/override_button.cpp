@@ -0,0 +1,22 @@
+#include "override_button.h"
+
+ButtonDebouncer::ButtonDebouncer(uint32_t quietMicros)
+  : _quietMicros(quietMicros), _lastEdge(0), _seen(false), _level(true), _stats() {
+}
+
+bool ButtonDebouncer::edge(const ButtonEdge& edge) {
+  _stats.edges++;
+  bool burst = !_seen || edge.micros - _lastEdge >= _quietMicros;
+  _lastEdge = edge.micros;
+  _seen = true;
+  bool released = _level;
+  _level = edge.level;
+  if (!burst) {
+    _stats.bounces++;
+    return false;
+  }
+  if (!released)
+    return false;  // the line leaves the pressed state: a release
+  _stats.presses++;
+  return true;
+}
@@ -0,0 +1,88 @@
+/*
+  The manual override button: edges captured by the ISR, debounced in the control task.
+
+  The ISR does no more than stamp each edge with the microsecond clock, read the pin, and push
+  both into an EdgeQueue. The queue is a lock-free ring for one producer (the ISR) and one
+  consumer (the timer task). Each side only writes its own index and publishes it with release
+  ordering, so neither side ever waits and the ISR never takes a lock. A full queue drops the
+  edge and counts it.
+
+  ButtonDebouncer turns the edges into presses. A contact bounces for a few milliseconds on both
+  press and release. So the first edge after BUTTON_DEBOUNCE_US of quiet starts a new burst, and
+  the rest of the burst is bounce. A burst that leaves a released (high) line is a press, and its
+  first edge is the press time, so the debounce adds no latency. The level read with each edge
+  only tracks where the line settled; a read taken mid-bounce can't lose a press.
+
+  Portable; push() may run in an interrupt handler, everything else in one task.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUTTON_EDGE_QUEUE 32        // edges, a power of two
+#define BUTTON_DEBOUNCE_US 20000
+
+struct ButtonEdge {
+  uint32_t micros;  // when the edge was seen
+  bool level;       // the pin right after it; high = released
+};
+
+class EdgeQueue {
+ public:
+  EdgeQueue() : _head(0), _tail(0), _dropped(0) {}
+
+  // producer only
+  bool push(const ButtonEdge& edge) {
+    uint32_t head = _head;
+    if (head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) >= BUTTON_EDGE_QUEUE) {
+      _dropped++;
+      return false;
+    }
+    _edges[head % BUTTON_EDGE_QUEUE] = edge;
+    __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // consumer only
+  bool pop(ButtonEdge& edge) {
+    uint32_t tail = _tail;
+    if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+      return false;
+    edge = _edges[tail % BUTTON_EDGE_QUEUE];
+    __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool empty() const { return __atomic_load_n(&_head, __ATOMIC_ACQUIRE) == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE); }
+  uint32_t dropped() const { return __atomic_load_n(&_dropped, __ATOMIC_RELAXED); }
+
+ private:
+  ButtonEdge _edges[BUTTON_EDGE_QUEUE];
+  uint32_t _head;     // written by the producer
+  uint32_t _tail;     // written by the consumer
+  uint32_t _dropped;  // written by the producer
+};
+
+struct ButtonStats {
+  uint32_t edges;
+  uint32_t bounces;  // edges inside a burst
+  uint32_t presses;
+};
+
+class ButtonDebouncer {
+ public:
+  explicit ButtonDebouncer(uint32_t quietMicros = BUTTON_DEBOUNCE_US);
+
+  bool edge(const ButtonEdge& edge);  // true if the edge starts a press
+  bool pressed() const { return !_level; }
+  const ButtonStats& stats() const { return _stats; }
+
+ private:
+  uint32_t _quietMicros;
+  uint32_t _lastEdge;
+  bool _seen;
+  bool _level;  // where the line settled after the latest burst, as far as we know
+  ButtonStats _stats;
+};
@@ -0,0 +1,32 @@
+/*
+  Monotonic time sources shared by the firmware and the native (host) build.
+
+  Both wrap around (micros after ~71 minutes, millis after ~49 days), so always compare
+  them by unsigned subtraction, never by magnitude.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+inline uint32_t sgMicros() { return micros(); }
+inline uint32_t sgMillis() { return millis(); }
+
+#else
+#include <time.h>
+
+inline uint32_t sgMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint32_t(uint64_t(ts.tv_sec) * 1000000u + uint64_t(ts.tv_nsec) / 1000u);
+}
+
+inline uint32_t sgMillis() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint32_t(uint64_t(ts.tv_sec) * 1000u + uint64_t(ts.tv_nsec) / 1000000u);
+}
+#endif
@@ -0,0 +1,379 @@
+#ifdef ARDUINO
+
+#include "status_server.h"
+#include "arbiter.h"
+
+#include <stdarg.h>
+#include <strings.h>
+#include <mbedtls/md.h>
+#include <mbedtls/base64.h>
+
+#define STATUS_CLIENT_TIMEOUT 5  // seconds a client may take to send its request
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xa
+#define WS_FIN 0x80
+
+static const char NOT_FOUND[] =
+  "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+static const char UNAVAILABLE[] =
+  "HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\nContent-Length: 13\r\nConnection: close\r\n\r\ntoo many ws\r\n";
+
+char StatusServer::_metricsBuffers[2][STATUS_HEADER_RESERVE + STATUS_METRICS_SIZE];
+char StatusServer::_jsonBuffers[2][STATUS_HEADER_RESERVE + STATUS_JSON_SIZE];
+
+// snprintf into a body buffer, remembering truncation instead of overrunning
+struct Appender {
+  char* out;
+  size_t size;
+  size_t length;
+
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    if (length >= size)
+      return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out + length, size - length, format, args);
+    va_end(args);
+    length = n < 0 ? size : length + size_t(n);
+  }
+
+  void metric(const char* name, const char* type, uint32_t value) {
+    printf("# TYPE sgready_%s %s\nsgready_%s %u\n", name, type, name, value);
+  }
+
+  void seconds(const char* name, uint32_t micros) {
+    printf("# TYPE sgready_%s gauge\nsgready_%s %u.%06u\n", name, name, micros / 1000000, micros % 1000000);
+  }
+};
+
+StatusServer::StatusServer()
+  : _server(nullptr), _lock(nullptr), _snapshot(), _rendered(false), _requested(false), _clients(0), _metrics(), _json(), _stats(),
+    _wsClients(), _frame(), _frameLength(0), _frameSeq(0) {
+  _metrics.buffers[0] = _metricsBuffers[0];
+  _metrics.buffers[1] = _metricsBuffers[1];
+  _metrics.bodySize = STATUS_METRICS_SIZE;
+  _json.buffers[0] = _jsonBuffers[0];
+  _json.buffers[1] = _jsonBuffers[1];
+  _json.bodySize = STATUS_JSON_SIZE;
+}
+
+void StatusServer::begin(uint16_t port) {
+  if (_server || !port)
+    return;
+  _lock = xSemaphoreCreateMutex();
+  _server = new AsyncServer(port);
+  _server->onClient([this](void*, AsyncClient* client) { onClient(client); }, nullptr);
+  _server->begin();
+  Serial.printf("Status server listening on port %u.\n", port);
+}
+
+void StatusServer::update(const StatusSnapshot& snapshot) {
+  if (!_lock)
+    return;
+  bool changed = !_rendered || memcmp(&snapshot, &_snapshot, STATUS_STATE_SIZE);
+  bool pushNeeded = !_rendered || pushChanged(snapshot);
+  bool requested = __atomic_exchange_n(&_requested, false, __ATOMIC_RELAXED);
+  _snapshot = snapshot;
+  if (pushNeeded)
+    push();
+  if (!changed && !requested)
+    return;  // the clocks alone; nobody has seen the last render yet
+  _rendered = true;
+
+  uint32_t start = micros();
+  Response& m = _metrics;
+  commit(m, renderMetrics(m.buffers[m.front ^ 1] + STATUS_HEADER_RESERVE, m.bodySize), "text/plain; version=0.0.4");
+  Response& j = _json;
+  commit(j, renderJson(j.buffers[j.front ^ 1] + STATUS_HEADER_RESERVE, j.bodySize), "application/json");
+
+  _stats.renders++;
+  _stats.lastRenderMicros = micros() - start;
+  if (_stats.lastRenderMicros > _stats.maxRenderMicros)
+    _stats.maxRenderMicros = _stats.lastRenderMicros;
+}
+
+// only what the wall displays show; the rest changes too often to be worth a frame
+bool StatusServer::pushChanged(const StatusSnapshot& snapshot) const {
+  return snapshot.mode != _snapshot.mode || snapshot.excess != _snapshot.excess ||
+    snapshot.remainingSeconds != _snapshot.remainingSeconds || snapshot.mqttAlive != _snapshot.mqttAlive;
+}
+
+// serialize the state frame once and hand the same bytes to every WebSocket client
+void StatusServer::push() {
+  const StatusSnapshot& s = _snapshot;
+  uint8_t frame[STATUS_WS_FRAME_SIZE];
+  int n = snprintf(reinterpret_cast<char*>(frame) + 2, sizeof(frame) - 2,
+    "{\"seq\":%u,\"t\":%u,\"mode\":%u,\"excess\":%s,\"remaining\":%u,\"mqtt\":%s}",
+    ++_frameSeq, uint32_t(millis()), s.mode, s.excess ? "true" : "false", s.remainingSeconds, s.mqttAlive ? "true" : "false");
+  if (n < 0 || n > 125)  // one length byte
+    return;
+  frame[0] = WS_FIN | WS_OPCODE_TEXT;
+  frame[1] = n;  // server frames are not masked
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  memcpy(_frame, frame, n + 2);
+  _frameLength = n + 2;
+  for (AsyncClient* client : _wsClients)
+    if (client && client->space() >= _frameLength) {  // a stalled client skips frames; each one is complete
+      client->write(reinterpret_cast<const char*>(_frame), _frameLength);
+      _stats.pushWrites++;
+    }
+  xSemaphoreGive(_lock);
+  _stats.pushes++;
+}
+
+// put the header right in front of the freshly rendered back body and make it the front
+void StatusServer::commit(Response& r, size_t bodyLength, const char* contentType) {
+  uint8_t back = r.front ^ 1;
+  char* body = r.buffers[back] + STATUS_HEADER_RESERVE;
+  if (bodyLength >= r.bodySize) {
+    Serial.printf("Error: Status body for %s truncated.\n", contentType);
+    bodyLength = strlen(body);
+  }
+
+  char header[STATUS_HEADER_RESERVE];
+  int n = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+    contentType, unsigned(bodyLength));
+  if (n < 0 || size_t(n) >= sizeof(header))
+    return;
+  memcpy(body - n, header, n);
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  r.data[back] = body - n;
+  r.length[back] = n + bodyLength;
+  r.front = back;
+  xSemaphoreGive(_lock);
+}
+
+size_t StatusServer::renderMetrics(char* body, size_t size) {
+  const StatusSnapshot& s = _snapshot;
+  Appender a = { body, size, 0 };
+
+  a.metric("mode", "gauge", s.mode);
+  a.metric("excess", "gauge", s.excess);
+  a.printf("# TYPE sgready_pending_mode gauge\nsgready_pending_mode %d\n", s.pending);
+  a.printf("# TYPE sgready_source gauge\nsgready_source{source=\"%s\"} 1\n", Arbiter::sourceName(CommandSource(s.source)));
+  a.metric("state_seconds", "gauge", s.stateSeconds);
+  a.metric("dwell_remaining_seconds", "gauge", s.remainingSeconds);
+  a.metric("lease_remaining_seconds", "gauge", s.leaseSeconds);
+  a.metric("uptime_seconds", "counter", s.uptimeSeconds);
+  a.metric("free_heap_bytes", "gauge", s.freeHeap);
+
+  a.metric("wifi_connected", "gauge", s.ip != 0);
+  a.printf("# TYPE sgready_wifi_rssi_dbm gauge\nsgready_wifi_rssi_dbm %d\n", s.rssi);
+  a.metric("wifi_roams_total", "counter", s.wifiRoams);
+  a.seconds("wifi_roam_seconds", s.wifiRoamMillis * 1000);
+  a.metric("wifi_roam_mqtt_drops_total", "counter", s.wifiRoamMqttDrops);
+  a.metric("mqtt_connected", "gauge", s.mqttConnected);
+  a.metric("mqtt_alive", "gauge", s.mqttAlive);
+  a.metric("mqtt_silent_seconds", "gauge", s.mqttSilentSeconds);
+  a.metric("mqtt_connects_total", "counter", s.mqttConnects);
+  a.metric("mqtt_disconnects_total", "counter", s.mqttDisconnects);
+  a.metric("mqtt_publishes_total", "counter", s.mqttPublishes);
+  a.metric("mqtt_acks_total", "counter", s.mqttAcks);
+  a.seconds("mqtt_rtt_last_seconds", s.mqttRttLastMicros);
+  a.seconds("mqtt_rtt_avg_seconds", s.mqttRttAvgMicros);
+  a.seconds("mqtt_connect_seconds", s.mqttConnectMicros);
+  a.metric("telemetry_published_total", "counter", s.telemetryPublished);
+
+  a.printf("# TYPE sgready_boot_phase_seconds gauge\n");
+  a.printf("sgready_boot_phase_seconds{phase=\"pins_safe\"} %u.%06u\n", s.bootPinsMicros / 1000000, s.bootPinsMicros % 1000000);
+  a.printf("sgready_boot_phase_seconds{phase=\"wifi_up\"} %u.%06u\n", s.bootWifiMicros / 1000000, s.bootWifiMicros % 1000000);
+  a.printf("sgready_boot_phase_seconds{phase=\"mqtt_up\"} %u.%06u\n", s.bootMqttMicros / 1000000, s.bootMqttMicros % 1000000);
+
+  // as of the previous render
+  a.metric("status_renders_total", "counter", _stats.renders);
+  a.seconds("status_render_seconds", _stats.lastRenderMicros);
+  a.metric("ws_clients", "gauge", _stats.pushClients);
+  a.metric("ws_pushes_total", "counter", _stats.pushes);
+  return a.length;
+}
+
+size_t StatusServer::renderJson(char* body, size_t size) {
+  const StatusSnapshot& s = _snapshot;
+  Appender a = { body, size, 0 };
+
+  a.printf("{\"wifi\":{\"ip\":\"%u.%u.%u.%u\",\"rssi\":%d,\"roams\":%u,\"roam_ms\":%u,\"roam_mqtt_drops\":%u},",
+    s.ip & 0xff, (s.ip >> 8) & 0xff, (s.ip >> 16) & 0xff, s.ip >> 24, s.rssi, s.wifiRoams, s.wifiRoamMillis, s.wifiRoamMqttDrops);
+  a.printf("\"mqtt\":{\"connected\":%s,\"alive\":%s,\"silent\":%u,\"connects\":%u,\"disconnects\":%u,\"publishes\":%u,\"acks\":%u,\"rtt_us\":%u,\"rtt_avg_us\":%u,\"connect_us\":%u},",
+    s.mqttConnected ? "true" : "false", s.mqttAlive ? "true" : "false", s.mqttSilentSeconds, s.mqttConnects, s.mqttDisconnects, s.mqttPublishes, s.mqttAcks,
+    s.mqttRttLastMicros, s.mqttRttAvgMicros, s.mqttConnectMicros);
+  a.printf("\"mode\":%u,\"excess\":%s,", s.mode, s.excess ? "true" : "false");
+  if (s.pending < 0)
+    a.printf("\"pending\":null,");
+  else
+    a.printf("\"pending\":%d,", s.pending);
+  a.printf("\"source\":\"%s\",\"lease\":%u,\"state_time\":%u,\"remaining\":%u,",
+    Arbiter::sourceName(CommandSource(s.source)), s.leaseSeconds, s.stateSeconds, s.remainingSeconds);
+  a.printf("\"uptime\":%u,\"free_heap\":%u,\"telemetry_published\":%u,", s.uptimeSeconds, s.freeHeap, s.telemetryPublished);
+  a.printf("\"boot_us\":{\"pins_safe\":%u,\"wifi_up\":%u,\"mqtt_up\":%u},", s.bootPinsMicros, s.bootWifiMicros, s.bootMqttMicros);
+  a.printf("\"renders\":%u,\"render_us\":%u,\"ws_clients\":%u}\n", _stats.renders, _stats.lastRenderMicros, _stats.pushClients);
+  return a.length;
+}
+
+// AsyncTCP task from here on
+void StatusServer::onClient(AsyncClient* client) {
+  client->onDisconnect([this](void*, AsyncClient* c) {
+    int slot = wsSlot(c);
+    if (slot >= 0) {
+      xSemaphoreTake(_lock, portMAX_DELAY);
+      _wsClients[slot] = nullptr;
+      _stats.pushClients--;
+      xSemaphoreGive(_lock);
+    }
+    _clients--;
+    delete c;
+  }, nullptr);
+  _clients++;
+  if (_clients > STATUS_HTTP_MAX_CLIENTS + STATUS_WS_MAX_CLIENTS) {
+    client->close(true);
+    return;
+  }
+
+  client->setRxTimeout(STATUS_CLIENT_TIMEOUT);
+  client->onData([this](void*, AsyncClient* c, void* data, size_t length) {
+    if (wsSlot(c) >= 0)
+      wsReceive(c, static_cast<const uint8_t*>(data), length);
+    else
+      serve(c, static_cast<const char*>(data), length);
+  }, nullptr);
+}
+
+int StatusServer::wsSlot(AsyncClient* client) const {
+  for (int i = 0; i < STATUS_WS_MAX_CLIENTS; i++)
+    if (_wsClients[i] == client)
+      return i;
+  return -1;
+}
+
+// copy the value of a request header (case-insensitive name) into 'value'; false if missing or too long
+static bool headerValue(const char* request, size_t length, const char* name, char* value, size_t size) {
+  size_t n = strlen(name);
+  const char* end = request + length;
+  for (const char* line = request; line < end; ) {
+    const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (!eol)
+      return false;
+    if (size_t(eol - line) > n && line[n] == ':' && !strncasecmp(line, name, n)) {
+      const char* v = line + n + 1;
+      while (v < eol && *v == ' ')
+        v++;
+      size_t len = eol - v;
+      while (len && (v[len - 1] == '\r' || v[len - 1] == ' '))
+        len--;
+      if (len >= size)
+        return false;
+      memcpy(value, v, len);
+      value[len] = 0;
+      return true;
+    }
+    line = eol + 1;
+  }
+  return false;
+}
+
+static bool isRequest(const char* request, size_t length, const char* path) {
+  size_t n = strlen(path);
+  return length > n && !memcmp(request, path, n) && (request[n] == ' ' || request[n] == '?');
+}
+
+void StatusServer::serve(AsyncClient* client, const char* request, size_t length) {
+  _stats.requests++;
+
+  if (isRequest(request, length, "GET /ws") && upgrade(client, request, length))
+    return;
+
+  const Response* r = nullptr;
+  if (isRequest(request, length, "GET /metrics"))
+    r = &_metrics;
+  else if (isRequest(request, length, "GET /status.json"))
+    r = &_json;
+
+  if (r)
+    __atomic_store_n(&_requested, true, __ATOMIC_RELAXED);  // the next update() brings the clocks up to date
+  if (!r || !send(client, *r))
+    client->write(NOT_FOUND, sizeof(NOT_FOUND) - 1);
+  client->close();
+}
+
+// RFC 6455 handshake, then the current frame; false if the request is not a valid upgrade
+bool StatusServer::upgrade(AsyncClient* client, const char* request, size_t length) {
+  char key[32];
+  if (!headerValue(request, length, "Sec-WebSocket-Key", key, sizeof(key)))
+    return false;
+
+  int slot = wsSlot(nullptr);
+  if (slot < 0) {
+    client->write(UNAVAILABLE, sizeof(UNAVAILABLE) - 1);
+    client->close();
+    return true;
+  }
+
+  char accept[64];
+  unsigned char digest[20];
+  size_t acceptLength = 0;
+  strlcpy(accept, key, sizeof(accept));
+  strlcat(accept, WS_GUID, sizeof(accept));
+  if (mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA1), reinterpret_cast<const unsigned char*>(accept), strlen(accept), digest) ||
+      mbedtls_base64_encode(reinterpret_cast<unsigned char*>(accept), sizeof(accept), &acceptLength, digest, sizeof(digest)))
+    return false;
+  accept[acceptLength] = 0;
+
+  char response[160];
+  int n = snprintf(response, sizeof(response),
+    "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+  client->setRxTimeout(0);  // dashboards stay connected and silent
+  client->setNoDelay(true);
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  client->write(response, n);
+  if (_frameLength)
+    client->write(reinterpret_cast<const char*>(_frame), _frameLength);
+  _wsClients[slot] = client;
+  _stats.pushClients++;
+  xSemaphoreGive(_lock);
+  return true;
+}
+
+// clients only send control frames we care about: close and ping
+void StatusServer::wsReceive(AsyncClient* client, const uint8_t* data, size_t length) {
+  if (length < 2)
+    return;
+  uint8_t opcode = data[0] & 0x0f;
+  size_t payloadLength = data[1] & 0x7f;
+  bool masked = data[1] & 0x80;
+  size_t offset = 2 + (masked ? 4 : 0);
+  if (payloadLength > 125 || length < offset + payloadLength)
+    return;  // data frames of that size are not for us, control frames never are
+
+  if (opcode == WS_OPCODE_CLOSE) {
+    static const uint8_t closeFrame[2] = { WS_FIN | WS_OPCODE_CLOSE, 0 };
+    client->write(reinterpret_cast<const char*>(closeFrame), sizeof(closeFrame));
+    client->close();
+  }
+  else if (opcode == WS_OPCODE_PING) {
+    uint8_t pong[2 + 125];
+    pong[0] = WS_FIN | WS_OPCODE_PONG;
+    pong[1] = payloadLength;
+    for (size_t i = 0; i < payloadLength; i++)
+      pong[2 + i] = data[offset + i] ^ (masked ? data[2 + (i & 3)] : 0);
+    client->write(reinterpret_cast<const char*>(pong), 2 + payloadLength);
+  }
+}
+
+// write() copies into lwIP, so the lock only keeps a render from swapping buffers under the copy
+bool StatusServer::send(AsyncClient* client, const Response& r) {
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  size_t length = r.length[r.front];
+  size_t written = length ? client->write(r.data[r.front], length) : 0;
+  xSemaphoreGive(_lock);
+
+  if (written && written < length)
+    Serial.printf("Error: Status response cut at %u of %u bytes.\n", unsigned(written), unsigned(length));
+  return length != 0;
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*
+  Local HTTP endpoints for monitoring without MQTT or Home Assistant:
+
+    GET /metrics       Prometheus text format
+    GET /status.json   the same state as JSON
+    GET /ws            WebSocket; pushes a small state frame whenever mode, excess, remaining dwell or
+                       MQTT liveness change
+
+  Both responses, HTTP headers included, are pre-rendered into static buffers by update(), on the
+  caller's task. A render follows a change of the state in the StatusSnapshot. The clocks at its end
+  (uptime, time in the state, the countdowns, free heap) change every tick and are left out of that
+  test; they are brought up to date by the next update() after a request, so a board nobody polls
+  doesn't render at all, and a poller sees clocks at most one polling interval old. Serving a
+  request is then a single write of a ready buffer from the AsyncTCP task, with no formatting and no
+  allocation. Each endpoint is double-buffered: a render writes the back buffer and swaps it in
+  under a mutex, so a request never sees half a render.
+
+  The WebSocket frame, header included, is serialized once per change into one buffer and that
+  buffer is written to every connected client. A client gets the current frame right after the
+  handshake. tools/ws_client.py measures push latency and the heap each client costs.
+*/
+
+#pragma once
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <AsyncTCP.h>
+extern "C" {
+	#include "freertos/FreeRTOS.h"
+	#include "freertos/semphr.h"
+}
+
+#ifndef STATUS_HTTP_PORT
+#define STATUS_HTTP_PORT 80  // 0 disables the server
+#endif
+
+#ifndef STATUS_HTTP_MAX_CLIENTS
+#define STATUS_HTTP_MAX_CLIENTS 4
+#endif
+
+#ifndef STATUS_WS_MAX_CLIENTS
+#define STATUS_WS_MAX_CLIENTS 4  // WebSocket clients, on top of STATUS_HTTP_MAX_CLIENTS
+#endif
+
+#define STATUS_METRICS_SIZE 3072
+#define STATUS_JSON_SIZE 1024
+#define STATUS_HEADER_RESERVE 128  // room in front of each body for the HTTP header
+#define STATUS_WS_FRAME_SIZE 128   // 2 byte frame header, payload below 126 bytes
+
+// everything the endpoints show; compared bytewise, so always zero it before filling it in
+struct StatusSnapshot {
+  // the state: any change renders
+  uint32_t ip;                 // 0 while WiFi is down
+  int32_t rssi;
+  uint32_t wifiRoams;
+  uint32_t wifiRoamMillis;     // of the latest roam
+  uint32_t wifiRoamMqttDrops;  // MQTT disconnects during or right after a roam
+  bool mqttConnected;
+  bool mqttAlive;              // connected and acknowledged within the dead time
+  uint8_t mode;
+  bool excess;
+  int8_t pending;              // -1 = none
+  uint8_t source;              // CommandSource, Count = none
+  uint32_t mqttConnects;
+  uint32_t mqttDisconnects;
+  uint32_t mqttPublishes;
+  uint32_t mqttAcks;
+  uint32_t mqttRttLastMicros;
+  uint32_t mqttRttAvgMicros;
+  uint32_t mqttConnectMicros;
+  uint32_t telemetryPublished;
+  uint32_t bootPinsMicros;
+  uint32_t bootWifiMicros;
+  uint32_t bootMqttMicros;
+
+  // the clocks: they change every tick, and render only after a request (STATUS_STATE_SIZE)
+  uint32_t stateSeconds;
+  uint32_t remainingSeconds;   // of the 10 minute dwell
+  uint32_t leaseSeconds;       // left on the winning request, 0 = none
+  uint32_t mqttSilentSeconds;  // since the last PUBACK
+  uint32_t uptimeSeconds;
+  uint32_t freeHeap;
+};
+
+#define STATUS_STATE_SIZE offsetof(StatusSnapshot, stateSeconds)  // the bytes compared for a change
+
+struct StatusServerStats {
+  uint32_t requests;
+  uint32_t renders;
+  uint32_t lastRenderMicros;
+  uint32_t maxRenderMicros;
+  uint32_t pushes;      // state frames broadcast
+  uint32_t pushWrites;  // frames written, one per client per push
+  uint8_t pushClients;  // WebSocket clients now
+};
+
+class StatusServer {
+ public:
+  StatusServer();
+
+  void begin(uint16_t port);
+  // render if the state changed, or the clocks after a request; push if the frame changed; call from one task only
+  void update(const StatusSnapshot& snapshot);
+
+  const StatusServerStats& stats() const { return _stats; }
+
+ private:
+  struct Response {
+    char* buffers[2];     // STATUS_HEADER_RESERVE bytes of header room, then the body
+    size_t bodySize;
+    const char* data[2];  // start of the header within each buffer
+    size_t length[2];     // header and body
+    uint8_t front;
+  };
+
+  size_t renderMetrics(char* body, size_t size);
+  size_t renderJson(char* body, size_t size);
+  bool pushChanged(const StatusSnapshot& snapshot) const;
+  void push();
+  void commit(Response& r, size_t bodyLength, const char* contentType);
+  bool send(AsyncClient* client, const Response& r);
+  bool upgrade(AsyncClient* client, const char* request, size_t length);
+  void wsReceive(AsyncClient* client, const uint8_t* data, size_t length);
+  int wsSlot(AsyncClient* client) const;
+  void onClient(AsyncClient* client);
+  void serve(AsyncClient* client, const char* request, size_t length);
+
+  AsyncServer* _server;
+  SemaphoreHandle_t _lock;
+  StatusSnapshot _snapshot;
+  bool _rendered;
+  bool _requested;  // set by the AsyncTCP task when it serves a body, cleared by update()
+  uint8_t _clients;
+  Response _metrics;
+  Response _json;
+  StatusServerStats _stats;
+
+  AsyncClient* _wsClients[STATUS_WS_MAX_CLIENTS];  // changed by the AsyncTCP task under _lock
+  uint8_t _frame[STATUS_WS_FRAME_SIZE];            // the latest state frame, guarded by _lock
+  size_t _frameLength;
+  uint32_t _frameSeq;
+
+  static char _metricsBuffers[2][STATUS_HEADER_RESERVE + STATUS_METRICS_SIZE];
+  static char _jsonBuffers[2][STATUS_HEADER_RESERVE + STATUS_JSON_SIZE];
+};
+
+#endif
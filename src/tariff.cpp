@@ -0,0 +1,167 @@
+#include "tariff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const DAY_NAMES[] = { "Su", "Mo", "Tu", "We", "Th", "Fr", "Sa", "Ho" };
+
+TariffCalendar::TariffCalendar() : _hours(), _holidays(), _holidayCount(0), _dayKey(-1), _today(false) {
+}
+
+void TariffCalendar::clear() {
+  memset(_hours, 0, sizeof(_hours));
+  _holidayCount = 0;
+  _dayKey = -1;
+}
+
+static const char* skipSpaces(const char* p) {
+  while (*p == ' ')
+    p++;
+  return p;
+}
+
+static int parseDay(const char*& p) {
+  for (int d = 0; d < 8; d++)
+    if (!strncmp(p, DAY_NAMES[d], 2)) {
+      p += 2;
+      return d;
+    }
+  return -1;
+}
+
+static int parseNumber(const char*& p, int max) {
+  if (*p < '0' || *p > '9')
+    return -1;
+  char* end;
+  long v = strtol(p, &end, 10);
+  p = end;
+  return v <= max ? int(v) : -1;
+}
+
+// "<days> <hours>", ending at ';' or the end of the string
+static bool parseEntry(const char*& p, uint32_t* hours) {
+  uint8_t days = 0;  // bit d = bitmap d
+  do {
+    int first = parseDay(p);
+    int last = first;
+    if (*p == '-') {
+      p++;
+      last = parseDay(p);
+    }
+    if (first < 0 || last < 0)
+      return false;
+    if (first == TARIFF_HOLIDAY || last == TARIFF_HOLIDAY) {
+      if (first != last)
+        return false;  // Ho has no place in a range
+      days |= 1 << TARIFF_HOLIDAY;
+      continue;
+    }
+    for (int d = first;; d = (d + 1) % 7) {  // Fr-Mo wraps over the weekend
+      days |= 1 << d;
+      if (d == last)
+        break;
+    }
+  } while (*p == ',' && *++p);
+
+  if (*p != ' ')
+    return false;
+  p = skipSpaces(p);
+
+  uint32_t mask = 0;
+  do {
+    int from = parseNumber(p, 23);
+    int to = from + 1;
+    if (*p == '-') {
+      p++;
+      to = parseNumber(p, 24);
+    }
+    if (from < 0 || to < 0 || to == from)
+      return false;
+    for (int h = from; h != to; h = (h + 1) % 24) {
+      mask |= 1u << h;
+      if (to == 24 && h == 23)
+        break;
+    }
+  } while (*p == ',' && *++p);
+
+  p = skipSpaces(p);
+  if (*p && *p != ';')
+    return false;
+  for (int d = 0; d < 8; d++)
+    if (days & (1 << d))
+      hours[d] |= mask;
+  return true;
+}
+
+bool TariffCalendar::setWeek(const char* spec) {
+  uint32_t hours[8] = {};
+  const char* p = skipSpaces(spec);
+  while (*p) {
+    if (!parseEntry(p, hours))
+      return false;
+    if (*p == ';')
+      p = skipSpaces(p + 1);
+  }
+  memcpy(_hours, hours, sizeof(_hours));
+  return true;
+}
+
+bool TariffCalendar::setHolidays(const char* list) {
+  TariffHoliday holidays[TARIFF_MAX_HOLIDAYS];
+  size_t count = 0;
+  const char* p = skipSpaces(list);
+  while (*p) {
+    if (count == TARIFF_MAX_HOLIDAYS)
+      return false;
+    int a = parseNumber(p, 9999), b = -1, c = -1;
+    if (*p == '-') {
+      p++;
+      b = parseNumber(p, 31);
+    }
+    if (*p == '-') {
+      p++;
+      c = parseNumber(p, 31);
+    }
+    TariffHoliday& h = holidays[count++];
+    if (c >= 0)
+      h = { uint16_t(a), uint8_t(b), uint8_t(c) };
+    else
+      h = { 0, uint8_t(a), uint8_t(b) };
+    if (h.month < 1 || h.month > 12 || h.day < 1 || h.day > 31 || (c >= 0 && a < 1970))
+      return false;
+    p = skipSpaces(p);
+    if (*p == ',')
+      p = skipSpaces(p + 1);
+    else if (*p)
+      return false;
+  }
+  memcpy(_holidays, holidays, sizeof(TariffHoliday) * count);
+  _holidayCount = count;
+  _dayKey = -1;
+  return true;
+}
+
+bool TariffCalendar::empty() const {
+  for (uint32_t h : _hours)
+    if (h)
+      return false;
+  return true;
+}
+
+bool TariffCalendar::holiday(const struct tm& local) const {
+  for (size_t i = 0; i < _holidayCount; i++) {
+    const TariffHoliday& h = _holidays[i];
+    if (h.month == local.tm_mon + 1 && h.day == local.tm_mday && (!h.year || h.year == local.tm_year + 1900))
+      return true;
+  }
+  return false;
+}
+
+bool TariffCalendar::cheap(const struct tm& local) {
+  int32_t key = int32_t(local.tm_year) * 400 + local.tm_yday;
+  if (key != _dayKey) {
+    _dayKey = key;
+    _today = holiday(local);
+  }
+  return _hours[_today ? TARIFF_HOLIDAY : local.tm_wday] & (1u << local.tm_hour);
+}
@@ -0,0 +1,54 @@
+/*
+  Time-of-use tariff calendar: which local hours are cheap.
+
+  The week is one bitmap per weekday, bit h standing for the hour from h:00 to h+1:00, plus one
+  more bitmap for holidays. Holidays are dates, either every year (MM-DD) or once (YYYY-MM-DD).
+  cheap() is O(1): a bit test, with the holiday list searched only on the first call of a new
+  calendar day.
+
+  The week is written as "<days> <hours>" entries separated by ';', for example
+
+    Mo-Fr 0-6,22-24; Sa,Su,Ho 0-24
+
+  Days are Mo Tu We Th Fr Sa Su and Ho for holidays; a range may wrap (Fr-Mo). Hours are single
+  hours or ranges with an exclusive end; a range that wraps (22-6) covers the end and the start of
+  the same day. Hours not listed are not cheap.
+
+  Portable and not thread-safe; the caller converts its clock to local time.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TARIFF_MAX_HOLIDAYS 32
+#define TARIFF_HOLIDAY 7  // the bitmap index of holidays; 0-6 are tm_wday, Sunday first
+
+struct TariffHoliday {
+  uint16_t year;  // 0 = every year
+  uint8_t month;  // 1-12
+  uint8_t day;
+};
+
+class TariffCalendar {
+ public:
+  TariffCalendar();
+
+  void clear();
+  bool setWeek(const char* spec);      // false and unchanged on a syntax error
+  bool setHolidays(const char* list);  // "MM-DD,YYYY-MM-DD,..."
+  bool empty() const;                  // no cheap hour at all
+
+  bool cheap(const struct tm& local);
+  bool holiday(const struct tm& local) const;
+  size_t holidays() const { return _holidayCount; }
+
+ private:
+  uint32_t _hours[8];
+  TariffHoliday _holidays[TARIFF_MAX_HOLIDAYS];
+  size_t _holidayCount;
+  int32_t _dayKey;  // year * 400 + yday of the cached day, -1 = none
+  bool _today;      // the cached day is a holiday
+};
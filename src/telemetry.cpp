@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+TelemetryRegistry::TelemetryRegistry() : _count(0) {
+  _prefix[0] = '\0';
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void TelemetryRegistry::setTopicPrefix(const char* prefix) {
+  snprintf(_prefix, sizeof(_prefix), "%s", prefix);
+}
+
+bool TelemetryRegistry::add(const TelemetrySensor& sensor) {
+  if (_count >= TELEMETRY_MAX_SENSORS)
+    return false;
+
+  Entry& e = _entries[_count++];
+  e.sensor = sensor;
+  e.lastValue = 0;
+  e.lastPublishMs = 0;
+  e.published = false;
+  return true;
+}
+
+void TelemetryRegistry::republishAll() {
+  for (size_t i = 0; i < _count; i++)
+    _entries[i].published = false;
+}
+
+void TelemetryRegistry::poll(MqttTransport& mqtt, uint32_t nowMs) {
+  if (!mqtt.connected())
+    return;
+
+  for (size_t i = 0; i < _count; i++) {
+    Entry& e = _entries[i];
+    const TelemetrySensor& s = e.sensor;
+    uint32_t elapsed = nowMs - e.lastPublishMs;
+    if (e.published && elapsed < s.minIntervalMs)
+      continue;  // don't even sample
+
+    float value = s.sample();
+    if (isnan(value))
+      continue;
+
+    bool due = !e.published || fabsf(value - e.lastValue) >= s.deadband || (s.maxIntervalMs && elapsed >= s.maxIntervalMs);
+    if (!due) {
+      _stats.suppressed++;
+      continue;
+    }
+
+    char topic[TELEMETRY_MAX_TOPIC];
+    char payload[24];
+    stateTopic(i, topic, sizeof(topic));
+    snprintf(payload, sizeof(payload), "%.*f", int(s.precision), double(value));
+    if (!mqtt.publish(topic, 0, true, payload))
+      continue;  // try again on the next poll
+
+    e.lastValue = value;
+    e.lastPublishMs = nowMs;
+    e.published = true;
+    _stats.published++;
+  }
+}
+
+void TelemetryRegistry::stateTopic(size_t i, char* buf, size_t size) const {
+  snprintf(buf, size, "%s%s/state", _prefix, _entries[i].sensor.key);
+}
+
+void TelemetryRegistry::writeDiscovery(size_t i, JsonObject cfg) const {
+  const TelemetrySensor& s = _entries[i].sensor;
+  char topic[TELEMETRY_MAX_TOPIC];
+  char uniqueId[TELEMETRY_MAX_TOPIC];
+  stateTopic(i, topic, sizeof(topic));
+  snprintf(uniqueId, sizeof(uniqueId), "%s%s", _prefix, s.key);
+
+  // non-const char* is copied into the document, the buffers go away
+  cfg["name"] = s.name;
+  cfg["uniq_id"] = uniqueId;
+  cfg["stat_t"] = topic;
+  if (s.unit)
+    cfg["unit_of_meas"] = s.unit;
+  if (s.deviceClass)
+    cfg["dev_cla"] = s.deviceClass;
+  if (s.stateClass)
+    cfg["stat_cla"] = s.stateClass;
+  if (s.diagnostic)
+    cfg["ent_cat"] = "diagnostic";
+}
@@ -0,0 +1,78 @@
+/*
+  Declarative telemetry sensors.
+
+  Each sensor is one TelemetrySensor entry: a sampler plus unit, deadband, publish intervals and
+  Home Assistant discovery metadata. poll() runs from a single scheduler job. It publishes a sensor
+  only when the value has moved by at least its deadband, or when maxIntervalMs has passed as a
+  heartbeat, and never more often than minIntervalMs. MQTT traffic therefore follows how much the
+  values change, not how much time passes.
+
+  State topics are "<prefix><key>/state", matching the controller's other entities.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ArduinoJson.h>
+
+#include "mqtt_transport.h"
+
+#ifndef TELEMETRY_MAX_SENSORS
+#define TELEMETRY_MAX_SENSORS 8
+#endif
+
+#define TELEMETRY_MAX_TOPIC 64
+
+struct TelemetrySensor {
+  const char* key;             // topic and unique id suffix
+  const char* name;            // entity name in Home Assistant
+  const char* unit;            // unit_of_measurement, or nullptr
+  const char* deviceClass;     // or nullptr
+  const char* stateClass;      // "measurement", "total_increasing" or nullptr
+  bool diagnostic;             // entity_category diagnostic
+  uint8_t precision;           // decimals in the payload
+  float deadband;              // smallest change worth publishing
+  uint32_t minIntervalMs;      // rate limit
+  uint32_t maxIntervalMs;      // heartbeat, 0 = on change only
+  float (*sample)();           // NAN = no value right now
+};
+
+struct TelemetryStats {
+  uint32_t published;
+  uint32_t suppressed;  // samples inside the deadband
+};
+
+class TelemetryRegistry {
+ public:
+  TelemetryRegistry();
+
+  void setTopicPrefix(const char* prefix);
+  bool add(const TelemetrySensor& sensor);  // false when the registry is full
+
+  // sample due sensors and publish the significant ones; call about once a second
+  void poll(MqttTransport& mqtt, uint32_t nowMs);
+  // publish everything again on the next poll(), e.g. after a reconnect
+  void republishAll();
+
+  size_t count() const { return _count; }
+  const TelemetrySensor& sensor(size_t i) const { return _entries[i].sensor; }
+  void stateTopic(size_t i, char* buf, size_t size) const;
+  // the entity part of the discovery config (abbreviated keys); the caller adds availability and device
+  void writeDiscovery(size_t i, JsonObject cfg) const;
+
+  const TelemetryStats& stats() const { return _stats; }
+
+ private:
+  struct Entry {
+    TelemetrySensor sensor;
+    float lastValue;
+    uint32_t lastPublishMs;
+    bool published;  // since the last republishAll()
+  };
+
+  char _prefix[32];
+  Entry _entries[TELEMETRY_MAX_SENSORS];
+  size_t _count;
+  TelemetryStats _stats;
+};
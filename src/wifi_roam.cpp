@@ -0,0 +1,121 @@
+#include "wifi_roam.h"
+
+#include <stdio.h>
+#include <string.h>
+
+WifiRoamer::WifiRoamer()
+  : _networks(), _networkCount(0), _cache(), _cacheCount(0), _scanned(false), _lastScan(0), _weak(false), _weakSince(0),
+    _roamed(false), _lastRoam(0) {
+}
+
+void WifiRoamer::clear() {
+  _networkCount = 0;
+  _cacheCount = 0;  // the sightings belong to the old networks
+}
+
+bool WifiRoamer::parseBssid(const char* text, uint8_t* bssid) {
+  unsigned b[6];
+  if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    return false;
+  for (int i = 0; i < 6; i++)
+    bssid[i] = uint8_t(b[i]);
+  return true;
+}
+
+bool WifiRoamer::addNetwork(const char* ssid, const char* pass, const char* bssid) {
+  if (_networkCount >= WIFI_ROAM_MAX_NETWORKS || !ssid || !*ssid || strlen(ssid) >= sizeof(WifiNetwork::ssid) ||
+      strlen(pass) >= sizeof(WifiNetwork::pass))
+    return false;
+
+  WifiNetwork& n = _networks[_networkCount];
+  memset(&n, 0, sizeof(n));
+  strcpy(n.ssid, ssid);
+  strcpy(n.pass, pass);
+  if (bssid && *bssid) {
+    if (!parseBssid(bssid, n.bssid))
+      return false;
+    n.pinned = true;
+  }
+  _networkCount++;
+  return true;
+}
+
+void WifiRoamer::sighting(const char* ssid, const uint8_t* bssid, int rssi, uint8_t channel, uint32_t now) {
+  size_t network = 0;
+  for (; network < _networkCount; network++) {
+    const WifiNetwork& n = _networks[network];
+    if (!strcmp(n.ssid, ssid) && (!n.pinned || !memcmp(n.bssid, bssid, 6)))
+      break;
+  }
+  if (network == _networkCount)
+    return;
+
+  // update the AP's entry, or take a free slot, or evict the oldest sighting
+  size_t slot = 0;
+  for (; slot < _cacheCount; slot++)
+    if (!memcmp(_cache[slot].bssid, bssid, 6))
+      break;
+  if (slot == _cacheCount) {
+    if (_cacheCount < WIFI_SCAN_CACHE)
+      _cacheCount++;
+    else
+      for (size_t i = 1, oldest = slot = 0; i < _cacheCount; i++)
+        if (now - _cache[i].seenAt > now - _cache[oldest].seenAt)
+          slot = oldest = i;
+  }
+
+  WifiSighting& s = _cache[slot];
+  memcpy(s.bssid, bssid, 6);
+  s.rssi = int8_t(rssi < -128 ? -128 : rssi > 0 ? 0 : rssi);
+  s.channel = channel;
+  s.network = uint8_t(network);
+  s.seenAt = now;
+}
+
+size_t WifiRoamer::fresh(uint32_t now) const {
+  size_t n = 0;
+  for (size_t i = 0; i < _cacheCount; i++)
+    if (now - _cache[i].seenAt <= WIFI_SCAN_MAX_AGE_MS)
+      n++;
+  return n;
+}
+
+const WifiSighting* WifiRoamer::best(uint32_t now, const uint8_t* exclude) const {
+  const WifiSighting* best = nullptr;
+  for (size_t i = 0; i < _cacheCount; i++) {
+    const WifiSighting& s = _cache[i];
+    if (now - s.seenAt > WIFI_SCAN_MAX_AGE_MS || (exclude && !memcmp(s.bssid, exclude, 6)))
+      continue;
+    if (!best || s.rssi > best->rssi)
+      best = &s;
+  }
+  return best;
+}
+
+bool WifiRoamer::scanDue(uint32_t now, int rssi) const {
+  if (!_scanned)
+    return true;
+  return now - _lastScan >= (rssi < WIFI_ROAM_RSSI ? WIFI_SCAN_LOW_INTERVAL_MS : WIFI_SCAN_INTERVAL_MS);
+}
+
+const WifiSighting* WifiRoamer::poll(int rssi, const uint8_t* bssid, uint32_t now) {
+  if (rssi >= WIFI_ROAM_RSSI) {
+    _weak = false;
+    return nullptr;
+  }
+  if (!_weak) {
+    _weak = true;
+    _weakSince = now;
+  }
+  if (now - _weakSince < WIFI_ROAM_LOW_MS || (_roamed && now - _lastRoam < WIFI_ROAM_HOLDOFF_MS))
+    return nullptr;
+
+  const WifiSighting* target = best(now, bssid);
+  if (!target || target->rssi < rssi + WIFI_ROAM_HYSTERESIS)
+    return nullptr;
+
+  _roamed = true;
+  _lastRoam = now;
+  _weak = false;
+  return target;
+}
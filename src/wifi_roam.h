@@ -0,0 +1,84 @@
+/*
+  Access point selection for roaming between several APs with marginal signal.
+
+  The configured networks are SSIDs, each optionally pinned to one AP by BSSID. Passive background
+  scans feed a small cache of sightings of those networks, with their RSSI, channel and time. The
+  station joins the strongest fresh sighting, on its channel and BSSID, which also skips the
+  driver's own scan. While connected, poll() watches the live RSSI. Once it has stayed below
+  WIFI_ROAM_RSSI for WIFI_ROAM_LOW_MS and a cached AP is at least WIFI_ROAM_HYSTERESIS dB
+  stronger, poll() names it as the roam target. Scans run every WIFI_SCAN_INTERVAL_MS, and every
+  WIFI_SCAN_LOW_INTERVAL_MS while the signal is weak, so a target is known when it is needed.
+
+  Portable and not thread-safe; times are milliseconds on any monotonic clock.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef WIFI_ROAM_RSSI
+#define WIFI_ROAM_RSSI -75           // dBm; weaker than this counts as a weak signal
+#endif
+#ifndef WIFI_ROAM_HYSTERESIS
+#define WIFI_ROAM_HYSTERESIS 8       // dB a candidate must beat the current AP by
+#endif
+#define WIFI_ROAM_LOW_MS 30000       // the signal must stay weak this long before a roam
+#define WIFI_ROAM_HOLDOFF_MS 120000  // no roam this soon after the previous one
+#define WIFI_SCAN_INTERVAL_MS 600000
+#define WIFI_SCAN_LOW_INTERVAL_MS 30000
+#define WIFI_SCAN_MAX_AGE_MS 180000  // older sightings are ignored
+#define WIFI_ROAM_MAX_NETWORKS 4
+#define WIFI_SCAN_CACHE 12
+
+struct WifiNetwork {
+  char ssid[33];
+  char pass[65];
+  uint8_t bssid[6];
+  bool pinned;  // only the AP with 'bssid'
+};
+
+struct WifiSighting {
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+  uint8_t network;  // index of the matching WifiNetwork
+  uint32_t seenAt;
+};
+
+class WifiRoamer {
+ public:
+  WifiRoamer();
+
+  void clear();
+  // 'bssid' is "aa:bb:cc:dd:ee:ff", or null or empty for any AP with the SSID
+  bool addNetwork(const char* ssid, const char* pass, const char* bssid);
+  size_t networks() const { return _networkCount; }
+  const WifiNetwork& network(size_t i) const { return _networks[i]; }
+
+  // one scan result; ignored unless it matches a configured network
+  void sighting(const char* ssid, const uint8_t* bssid, int rssi, uint8_t channel, uint32_t now);
+  size_t fresh(uint32_t now) const;  // sightings young enough to use
+  // the strongest fresh sighting other than 'exclude', or null
+  const WifiSighting* best(uint32_t now, const uint8_t* exclude = nullptr) const;
+
+  bool scanDue(uint32_t now, int rssi) const;
+  void scanStarted(uint32_t now) { _lastScan = now; _scanned = true; }
+
+  // call about once a second while connected; returns the AP to roam to, or null
+  const WifiSighting* poll(int rssi, const uint8_t* bssid, uint32_t now);
+
+  static bool parseBssid(const char* text, uint8_t* bssid);
+
+ private:
+  WifiNetwork _networks[WIFI_ROAM_MAX_NETWORKS];
+  size_t _networkCount;
+  WifiSighting _cache[WIFI_SCAN_CACHE];
+  size_t _cacheCount;
+  bool _scanned;
+  uint32_t _lastScan;
+  bool _weak;
+  uint32_t _weakSince;
+  bool _roamed;
+  uint32_t _lastRoam;
+};
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""Time the failover to a standby broker with two local brokers, one of which dies mid-run.
+
+    pio run -e native
+    tools/broker_failover_test.py .pio/build/native/program [--stop] [--broker "mosquitto -p {port}"]
+
+Starts two brokers on ports 18831 and 18832 and the native 'broker-failover' command against
+them. After five seconds the primary is killed (SIGKILL) or, with --stop, frozen (SIGSTOP). A
+frozen broker still accepts TCP connections but never answers, so it exercises the connect timeout
+and the missing PUBACKs rather than a refused connection. The output is the time from the last
+acknowledged publish on the primary to the first one on the standby.
+"""
+
+import argparse
+import shlex
+import signal
+import subprocess
+import sys
+import time
+
+PORTS = (18831, 18832)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("program")
+    parser.add_argument("--broker", default="mosquitto -p {port}", help="command that starts a broker on {port}")
+    parser.add_argument("--stop", action="store_true", help="freeze the primary instead of killing it")
+    parser.add_argument("--seconds", type=int, default=20)
+    args = parser.parse_args()
+
+    brokers = [subprocess.Popen(shlex.split(args.broker.format(port=port)), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+               for port in PORTS]
+    time.sleep(1)
+    bench = subprocess.Popen([args.program, "broker-failover", "127.0.0.1", str(PORTS[0]), str(PORTS[1]), str(args.seconds)],
+                             stdout=subprocess.PIPE, text=True)
+    try:
+        time.sleep(5)
+        brokers[0].send_signal(signal.SIGSTOP if args.stop else signal.SIGKILL)
+        print("primary %s at 5 s" % ("frozen" if args.stop else "killed"))
+        for line in bench.stdout:
+            print(line.rstrip())
+        bench.wait()
+    finally:
+        for broker in brokers:
+            broker.send_signal(signal.SIGCONT)
+            broker.kill()
+    return bench.returncode
+
+
+if __name__ == "__main__":
+    sys.exit(main())
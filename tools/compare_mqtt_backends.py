@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Pick the MQTT backend for our deployment from the serial logs of the bench_* environments.
+
+    pio run -e bench_async -t upload -t monitor | tee async.log
+    pio run -e bench_espmqtt -t upload -t monitor | tee espmqtt.log
+    tools/compare_mqtt_backends.py async.log espmqtt.log
+
+The controller publishes a handful of small messages per minute and must run for months, so
+resident RAM and heap churn weigh most, reconnect time next, raw throughput least.
+"""
+
+import re
+import sys
+
+# metric -> (weight, True if higher is better)
+METRICS = {
+    "resident": (3, False),
+    "allocs_per_msg": (3, False),
+    "bytes_per_msg": (1, False),
+    "reconnect_ms": (2, False),
+    "throughput": (1, True),
+    "rtt_avg_us": (1, False),
+}
+
+
+def parse(path):
+    results = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = re.search(r"BENCH (.*)", line)
+            if not m:
+                continue
+            fields = dict(kv.split("=", 1) for kv in m.group(1).split())
+            results[fields["backend"]] = {k: float(fields[k]) for k in METRICS if k in fields}
+    return results
+
+
+def main(paths):
+    results = {}
+    for path in paths:
+        results.update(parse(path))
+    if len(results) < 2:
+        sys.exit("need BENCH lines from at least two backends")
+
+    names = sorted(results)
+    print("%-16s" % "metric" + "".join("%16s" % n for n in names))
+    for metric in METRICS:
+        print("%-16s" % metric + "".join("%16.1f" % results[n].get(metric, float("nan")) for n in names))
+
+    # every metric awards its weight, scaled by how close each backend is to the best value
+    scores = dict.fromkeys(names, 0.0)
+    for metric, (weight, higher_is_better) in METRICS.items():
+        values = {n: results[n][metric] for n in names if metric in results[n] and results[n][metric] >= 0}
+        if not values:
+            continue
+        best = max(values.values()) if higher_is_better else min(values.values())
+        for n, v in values.items():
+            if higher_is_better:
+                scores[n] += weight * (v / best if best else 1)
+            else:
+                scores[n] += weight * (best / v if v else 1)
+
+    print("%-16s" % "score" + "".join("%16.2f" % scores[n] for n in names))
+    print("winner: %s" % max(names, key=lambda n: scores[n]))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
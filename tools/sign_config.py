@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Sign a configuration update or OTA command for the controller.
+
+    tools/sign_config.py <secret> <seq> key=value [key=value ...]
+
+prints "<hmac> <json>" for sgready_board/config/set. The secret is CONFIG_SECRET from credentials.h
+and seq must be higher than the "seq" the board last published on sgready_board/config. Keys:
+wifi_ssid, wifi_pass, mqtt_host, mqtt_port, mqtt_user, mqtt_pass, keepalive, dead_time.
+For sgready_board/ota/set the keys are url and md5 (of the uncompressed image); both are required.
+
+    mosquitto_pub -t sgready_board/config/set -m "$(tools/sign_config.py s3cret 8 dead_time=240)"
+    mosquitto_pub -t sgready_board/ota/set -m "$(tools/sign_config.py s3cret 9 url=http://pc:8000/firmware.bin.gz md5=$(md5sum < firmware.bin | cut -c1-32))"
+"""
+
+import hashlib
+import hmac
+import json
+import sys
+
+NUMERIC = {"mqtt_port", "keepalive", "dead_time"}
+
+
+def main():
+    if len(sys.argv) < 4:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+
+    secret, seq = sys.argv[1], int(sys.argv[2])
+    update = {"seq": seq}
+    for arg in sys.argv[3:]:
+        key, sep, value = arg.partition("=")
+        if not sep:
+            print(f"expected key=value, got '{arg}'", file=sys.stderr)
+            return 2
+        update[key] = int(value) if key in NUMERIC else value
+
+    body = json.dumps(update, separators=(",", ":"))
+    mac = hmac.new(secret.encode(), body.encode(), hashlib.sha256).hexdigest()
+    print(f"{mac} {body}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
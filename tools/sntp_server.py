@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Stand-in SNTP server that serves a chosen time, for testing the tariff calendar.
+
+    tools/sntp_server.py [--port 123] [--start 2026-12-24T21:59:50] [--tz CET-1CEST,M3.5.0,M10.5.0/3]
+
+The served clock starts at --start (local time in --tz, default: now) and runs at the real rate,
+so a board or the native 'tariff' command pointed at it crosses a tariff boundary a few seconds
+later. Port 123 needs root; for the native build any port will do. For a board, build with
+SNTP_SERVER set to this machine's address.
+"""
+
+import argparse
+import calendar
+import os
+import socket
+import struct
+import sys
+import time
+
+NTP_EPOCH_OFFSET = 2208988800  # 1900 to 1970
+
+
+def ntp_timestamp(t):
+    seconds = int(t)
+    return struct.pack(">II", seconds + NTP_EPOCH_OFFSET, int((t - seconds) * 2**32))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=123)
+    parser.add_argument("--start", help="local time to start from, YYYY-MM-DDTHH:MM:SS")
+    parser.add_argument("--tz", default="UTC0", help="POSIX TZ of --start, as in TARIFF_TZ")
+    args = parser.parse_args()
+
+    offset = 0.0
+    if args.start:
+        os.environ["TZ"] = args.tz
+        time.tzset()
+        offset = time.mktime(time.strptime(args.start, "%Y-%m-%dT%H:%M:%S")) - time.time()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+    print("serving %s on port %d" % (time.strftime("%Y-%m-%d %H:%M:%S %Z", time.localtime(time.time() + offset)), args.port))
+    while True:
+        request, peer = sock.recvfrom(512)
+        if len(request) < 48:
+            continue
+        received = time.time() + offset
+        version = (request[0] >> 3) & 7
+        header = struct.pack(">BBbbII4s", (version << 3) | 4, 1, 4, -20, 0, 0, b"LOCL")  # server, stratum 1
+        reply = header + ntp_timestamp(received) + request[40:48] + ntp_timestamp(received) + ntp_timestamp(time.time() + offset)
+        sock.sendto(reply, peer)
+        print("%s  %s" % (peer[0], time.strftime("%H:%M:%S", time.localtime(received))))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
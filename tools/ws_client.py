@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Measure the board's WebSocket state push: heap per client and push latency.
+
+    tools/ws_client.py <board> [--clients 4] [--seconds 60]
+    tools/ws_client.py <board> --trigger "mosquitto_pub -t sgready_board_Excess/set -m 'ON 60'"
+
+Opens the clients one by one and reads free_heap from /status.json before and after each, which
+gives the heap one WebSocket client costs on the board. Then it listens on all of them:
+
+  - every frame carries the board's millis() at render time. The smallest arrival-minus-render
+    difference per client stands for the network's best case; the report shows how much later
+    than that best case frames arrive (render-to-arrival jitter) and how far apart the same frame
+    lands on different clients (broadcast skew).
+  - with --trigger, the command is run every ten seconds and the time from running it to the
+    first frame with a changed 'excess' is the command-to-screen latency. Only changes the
+    10 minute dwell allows show up, so trigger with the pump out of its dwell.
+
+Only the standard library is used, so it runs anywhere a wall tablet's server would.
+"""
+
+import argparse
+import base64
+import json
+import os
+import select
+import socket
+import statistics
+import subprocess
+import sys
+import time
+
+
+def http_get(host, port, path):
+    with socket.create_connection((host, port), timeout=5) as s:
+        s.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, host)).encode())
+        data = b""
+        while True:
+            chunk = s.recv(4096)
+            if not chunk:
+                break
+            data += chunk
+    return data.split(b"\r\n\r\n", 1)[1]
+
+
+def free_heap(host, port):
+    return json.loads(http_get(host, port, "/status.json"))["free_heap"]
+
+
+class Client:
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall(("GET /ws HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                           "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (host, key)).encode())
+        self.buffer = b""
+        while b"\r\n\r\n" not in self.buffer:
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                raise ConnectionError("closed during the handshake")
+            self.buffer += chunk
+        header, self.buffer = self.buffer.split(b"\r\n\r\n", 1)
+        if not header.startswith(b"HTTP/1.1 101"):
+            raise ConnectionError(header.split(b"\r\n")[0].decode())
+        self.sock.setblocking(False)
+
+    def fileno(self):
+        return self.sock.fileno()
+
+    def frames(self):
+        """Return the complete text frames received so far."""
+        try:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise ConnectionError("closed by the board")
+            self.buffer += chunk
+        except BlockingIOError:
+            pass
+        frames = []
+        while len(self.buffer) >= 2:
+            length = self.buffer[1] & 0x7f  # the board only sends short, unmasked frames
+            if len(self.buffer) < 2 + length:
+                break
+            if self.buffer[0] & 0x0f == 0x1:
+                frames.append(json.loads(self.buffer[2:2 + length]))
+            self.buffer = self.buffer[2 + length:]
+        return frames
+
+    def close(self):
+        try:
+            self.sock.setblocking(True)
+            self.sock.sendall(bytes([0x88, 0x80]) + os.urandom(4))  # masked close, no payload
+        except OSError:
+            pass
+        self.sock.close()
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--seconds", type=float, default=60)
+    parser.add_argument("--trigger", action="append", default=[], help="shell command that changes the excess state; repeat to alternate")
+    args = parser.parse_args()
+
+    clients = []
+    heap = [free_heap(args.host, args.port)]
+    for _ in range(args.clients):
+        clients.append(Client(args.host, args.port))
+        time.sleep(1.5)  # /status.json re-renders on the board's next tick
+        heap.append(free_heap(args.host, args.port))
+    per_client = [a - b for a, b in zip(heap, heap[1:])]
+    print("free heap      %s" % " -> ".join(str(h) for h in heap))
+    print("heap/client    %.0f B (min %d, max %d)" % (statistics.mean(per_client), min(per_client), max(per_client)))
+
+    for c in clients:
+        c.frames()  # queued while the others connected, their arrival times mean nothing
+
+    delays = {id(c): [] for c in clients}  # arrival - render, ms, per client
+    arrivals = {}                          # seq -> arrival times on all clients
+    trigger_latency = []
+    excess = None
+    triggered_at = None
+    next_trigger = time.monotonic() + 2
+    trigger_index = 0
+
+    end = time.monotonic() + args.seconds
+    while time.monotonic() < end:
+        if args.trigger and triggered_at is None and time.monotonic() >= next_trigger:
+            triggered_at = time.monotonic()
+            subprocess.run(args.trigger[trigger_index % len(args.trigger)], shell=True, check=False)
+            trigger_index += 1
+        ready, _, _ = select.select(clients, [], [], 0.1)
+        for c in ready:
+            now = time.monotonic()
+            for frame in c.frames():
+                delays[id(c)].append(now * 1000 - frame["t"])
+                arrivals.setdefault(frame["seq"], []).append(now)
+                if c is clients[0]:
+                    if triggered_at is not None and excess is not None and frame["excess"] != excess:
+                        trigger_latency.append((now - triggered_at) * 1000)
+                        triggered_at = None
+                        next_trigger = now + 10
+                    excess = frame["excess"]
+        if triggered_at is not None and time.monotonic() - triggered_at > 10:
+            print("trigger %d produced no change (dwell?)" % trigger_index)
+            triggered_at = None
+            next_trigger = time.monotonic() + 10
+
+    for c in clients:
+        c.close()
+
+    jitter = []
+    for d in delays.values():
+        if d:
+            best = min(d)
+            jitter += [x - best for x in d]
+    skew = [(max(a) - min(a)) * 1000 for a in arrivals.values() if len(a) == len(clients) and len(a) > 1]
+    print("frames         %d per client" % max(len(d) for d in delays.values()))
+    if jitter:
+        print("jitter ms      p50 %.1f  p95 %.1f  max %.1f" % (percentile(jitter, 50), percentile(jitter, 95), max(jitter)))
+    if skew:
+        print("skew ms        p50 %.1f  p95 %.1f  max %.1f" % (percentile(skew, 50), percentile(skew, 95), max(skew)))
+    if trigger_latency:
+        print("trigger ms     p50 %.1f  max %.1f  (%d changes)" % (percentile(trigger_latency, 50), max(trigger_latency), len(trigger_latency)))
+
+
+if __name__ == "__main__":
+    sys.exit(main())